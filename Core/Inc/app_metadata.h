@@ -41,6 +41,8 @@ extern const unsigned char _flash_image_end[];
 #define APP_METADATA_VALIDATION_DOWNLOAD    { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }
 #define APP_METADATA_VALIDATION_READY       { 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00 }
 #define APP_METADATA_INVALIDATION           { 0x00, 0x00, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFF }
+/* A/B trial boot: bytes 0-3 are cleared one per boot, ready once confirmed. */
+#define APP_METADATA_VALIDATION_TRIAL       { 0xFF, 0xFF, 0xFF, 0xFF, 0x00, 0x00, 0x00, 0xFF }
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,86 @@
+/**
+  ******************************************************************************
+  * @file    bl_services.h
+  * @brief   Services the bootloader exports to the application: a versioned
+  *          function table at a fixed address in the bootloader image
+  *          (BL_SERVICES_ADDRESS, placed by STM32F401RETX_FLASH.ld right
+  *          after the vector table). The application includes this header
+  *          and sha256.h as is and calls through BlServices_Get() instead of
+  *          linking its own SHA256, flash and metadata code.
+  *
+  *          Every entry runs on the caller's stack and touches no bootloader
+  *          RAM, so it is safe to call with the application's RAM layout and
+  *          interrupts. The flash entries busy-wait on the controller and do
+  *          not depend on SysTick.
+  *
+  *          The table only grows at the end: new entries bump
+  *          BL_SERVICES_VERSION, existing ones never move or change meaning.
+  ******************************************************************************
+  */
+
+#ifndef BL_SERVICES_H
+#define BL_SERVICES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "sha256.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BL_SERVICES_ADDRESS      0x08010200u
+#define BL_SERVICES_MAGIC        0x424C5356u   /* "BLSV" */
+#define BL_SERVICES_VERSION      3
+
+typedef struct {
+    uint32_t magic;          /* BL_SERVICES_MAGIC */
+    uint16_t version;        /* BL_SERVICES_VERSION of the bootloader */
+    uint16_t size;           /* sizeof(bl_services_t) in the bootloader */
+
+    /* Version 1 */
+    void (*sha256_init)(sha256_ctx_t *ctx);
+    void (*sha256_update)(sha256_ctx_t *ctx, const uint8_t *data, size_t len);
+    void (*sha256_final)(sha256_ctx_t *ctx, uint8_t *hash);
+    /* Sectors 5-7 only. Sector 0 (first stage), 1 (session statistics),
+       2 and 3 (parameter store, read it with param_read) and 4 (this
+       bootloader) are refused. */
+    bool (*flash_erase_sector)(uint32_t sector);
+    /* address 4-byte aligned, inside the sectors flash_erase_sector allows. */
+    bool (*flash_program)(uint32_t address, const uint8_t *data, uint32_t length);
+    /* Metadata block (app_metadata.h layout) at the end of the image in the
+       given sector, or NULL. Validation state and SHA256 are not checked. */
+    const uint8_t *(*metadata_find)(uint32_t sector_addr, uint32_t sector_size);
+
+    /* Version 2 */
+    /* Call once the application is healthy. A/B builds boot a new image on
+       trial and go back to the previous slot if it has not confirmed within
+       BOOTLOADER_TRIAL_ATTEMPTS boots; this makes it permanent and retires
+       the old slot. true if the running image is (now) ready. */
+    bool (*confirm_image)(void);
+
+    /* Version 3 */
+    /* Latest value of a parameter store key (PARAM_* in param_store.h);
+       copies up to size bytes and returns the stored length, or -1 if the
+       key has no value. Replaces reading WELL_ID at 0x0800C000, which
+       the store still keeps up to date for older applications. */
+    int32_t (*param_read)(uint16_t key, void *value, uint32_t size);
+} bl_services_t;
+
+#define BL_SERVICES  ((const bl_services_t *)BL_SERVICES_ADDRESS)
+
+/* Application side: the table if the bootloader has one of at least
+   min_version, otherwise NULL (older bootloader, fall back). */
+static inline const bl_services_t *BlServices_Get(uint16_t min_version)
+{
+    if (BL_SERVICES->magic != BL_SERVICES_MAGIC || BL_SERVICES->version < min_version)
+        return NULL;
+    return BL_SERVICES;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BL_SERVICES_H */
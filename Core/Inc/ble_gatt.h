@@ -0,0 +1,60 @@
+/**
+  ******************************************************************************
+  * @file    ble_gatt.h
+  * @brief   GATT transport over the Stephano-I AT interface, as an alternative
+  *          to SPP passthrough. The PC writes data (write without response)
+  *          to a dedicated characteristic; the module reports each write as a
+  *          "+WRITE:" URC, whose value bytes are fed to the receive ring.
+  *          Replies go out as notifications on a second characteristic.
+  ******************************************************************************
+  */
+
+#ifndef BLE_GATT_H
+#define BLE_GATT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spsc_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Characteristics of the service created by AT+BLEGATTSSRVCRE (indices in
+   the module's default GATT table). SPP passthrough uses characteristics
+   1 and 2 of the same service, so these stay free for the GATT transport. */
+#define BLE_GATT_SRV_INDEX        1
+#define BLE_GATT_RX_CHAR_INDEX    5   /* PC -> WSM, write without response */
+#define BLE_GATT_TX_CHAR_INDEX    7   /* WSM -> PC, notify */
+
+/* Reset the URC parser; value bytes written to the RX characteristic are
+   appended to ring. Only call while UART receive is stopped. */
+void BleGatt_Init(spsc_ring_t *ring);
+
+/* Feed one byte of module output (from the UART receive callback). */
+void BleGatt_RxByte(uint8_t b);
+
+/* True once the PC has written the TX characteristic's CCCD, i.e. enabled
+   notifications. This is how the PC selects the GATT transport. */
+bool BleGatt_Subscribed(void);
+
+/* True once the PC has written one of the SPP characteristics (data or
+   CCCD) instead: it has chosen SPP and the wait for a subscription can end. */
+bool BleGatt_SppActivity(void);
+
+/* Send an AT command while the +WRITE parser keeps running, so data the PC
+   writes meanwhile still reaches the ring. The module's reply, URC value
+   bytes left out, goes to resp (NUL-terminated) if not NULL.
+   Returns true on OK, false on ERROR or timeout. */
+bool BleGatt_Command(const char *cmd, char *resp, uint32_t size, uint32_t timeout_ms);
+
+/* Send data as notifications of at most (mtu - 3) bytes each. Needs the
+   UART receive interrupt running so the '>' prompt is seen.
+   Returns false if the module did not prompt for data. */
+bool BleGatt_Notify(const uint8_t *data, uint32_t len, uint16_t mtu);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BLE_GATT_H */
@@ -0,0 +1,143 @@
+/**
+  ******************************************************************************
+  * @file    boot_shared.h
+  * @brief   RAM shared between the application and the bootloader across a
+  *          software reset: the last BOOT_SHARED_SIZE bytes of SRAM, kept out
+  *          of both images by their linker scripts (RAM LENGTH = 96K - 256).
+  *          The startup code of neither image touches it.
+  *
+  *          Update mailbox: the application calls BootShared_RequestUpdate()
+  *          and then NVIC_SystemReset(); the bootloader sees the request
+  *          together with a software reset cause and goes straight to the
+  *          BLE session, without scanning or hashing sectors 6 and 7.
+  *          The request is consumed on that boot, so whatever the session
+  *          ends with, the next reset boots normally.
+  *
+  *          Handoff block: written by the bootloader right before it jumps
+  *          to a verified image. It carries what the bootloader already
+  *          knows (image digest and size, reset cause, phase timings, well
+  *          ID, BLE MAC, Stephano-I state), so the application need not
+  *          re-hash itself, re-read the module or redo BLE bring-up. Check
+  *          it with BootShared_GetHandoff(); it is cleared on every boot
+  *          that does not end in a jump.
+  *
+  *          Include this header from the application as is; the layout is
+  *          the interface and must only grow at the end.
+  ******************************************************************************
+  */
+
+#ifndef BOOT_SHARED_H
+#define BOOT_SHARED_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BOOT_SHARED_ADDRESS      0x20017F00u
+#define BOOT_SHARED_SIZE         256u
+
+#define BOOT_MAILBOX_MAGIC       0x55504451u   /* "UPDQ" */
+#define BOOT_HANDOFF_MAGIC       0x484E4446u   /* "HNDF" */
+#define BOOT_HANDOFF_VERSION     1
+#define BOOT_HANDOFF_TIMING_MAX  12            /* last marks before the jump */
+
+/* boot_handoff_t.flags */
+#define BOOT_HANDOFF_WELL_ID_VALID        (1u << 0)
+#define BOOT_HANDOFF_BLE_MAC_VALID        (1u << 1)
+#define BOOT_HANDOFF_STEPHANO_POWERED     (1u << 2)   /* n_STEPHANO_ON asserted */
+#define BOOT_HANDOFF_STEPHANO_CONFIGURED  (1u << 3)   /* ready, restored, UART set */
+#define BOOT_HANDOFF_BLE_CONNECTED        (1u << 4)   /* PC still connected */
+#define BOOT_HANDOFF_TRIAL                (1u << 5)   /* unconfirmed: call confirm_image */
+
+typedef enum {
+    BOOT_REQUEST_NONE         = 0,
+    BOOT_REQUEST_UPDATE_CHECK = 1    /* run the BLE session, then boot on */
+} boot_request_t;
+
+typedef struct {
+    uint32_t magic;          /* BOOT_MAILBOX_MAGIC while a request is pending */
+    uint32_t request;        /* boot_request_t */
+    uint32_t check;          /* ~(magic ^ request) */
+    uint32_t reset_flags;    /* RCC->CSR as the bootloader found it on this boot,
+                                written on every boot; the flags are left set */
+} boot_mailbox_t;
+
+typedef struct {
+    uint16_t phase;          /* boot_phase_t (boot_timing.h) */
+    uint16_t reserved;
+    uint32_t time_us;        /* since reset; saturates at 0xFFFFFFFF (~71 min) */
+} boot_handoff_mark_t;
+
+typedef struct {
+    uint32_t magic;          /* BOOT_HANDOFF_MAGIC */
+    uint16_t version;        /* BOOT_HANDOFF_VERSION */
+    uint16_t size;           /* sizeof(boot_handoff_t) */
+    uint32_t image_address;  /* vector table of the image jumped to */
+    uint32_t image_size;     /* including the metadata block */
+    uint8_t  image_sha256[32];   /* verified against the image */
+    uint32_t reset_flags;    /* RCC->CSR of the last reset */
+    uint32_t flags;          /* BOOT_HANDOFF_* */
+    uint16_t well_id;
+    uint8_t  ble_mac[6];
+    uint32_t timing_count;
+    boot_handoff_mark_t timing[BOOT_HANDOFF_TIMING_MAX];
+    uint32_t check;          /* see BootShared_HandoffCheck() */
+} boot_handoff_t;
+
+typedef struct {
+    boot_mailbox_t mailbox;
+    boot_handoff_t handoff;
+} boot_shared_t;
+
+#define BOOT_SHARED  ((volatile boot_shared_t *)BOOT_SHARED_ADDRESS)
+
+/* Application side: leave an update request for the bootloader; reset next. */
+static inline void BootShared_RequestUpdate(void)
+{
+    BOOT_SHARED->mailbox.magic = BOOT_MAILBOX_MAGIC;
+    BOOT_SHARED->mailbox.request = BOOT_REQUEST_UPDATE_CHECK;
+    BOOT_SHARED->mailbox.check = ~(BOOT_MAILBOX_MAGIC ^ BOOT_REQUEST_UPDATE_CHECK);
+}
+
+/* XOR of every word before check, inverted. */
+static inline uint32_t BootShared_HandoffCheck(const volatile boot_handoff_t *h)
+{
+    const volatile uint32_t *w = (const volatile uint32_t *)h;
+    uint32_t x = 0;
+    uint32_t i;
+
+    for (i = 0; i < (uint32_t)(offsetof(boot_handoff_t, check) / 4); ++i)
+        x ^= w[i];
+    return ~x;
+}
+
+/* Application side: the handoff block if the bootloader left a valid one
+   for this boot, otherwise NULL (cold start, older bootloader). */
+static inline const volatile boot_handoff_t *BootShared_GetHandoff(void)
+{
+    const volatile boot_handoff_t *h = &BOOT_SHARED->handoff;
+
+    if (h->magic != BOOT_HANDOFF_MAGIC || h->version < BOOT_HANDOFF_VERSION
+        || h->check != BootShared_HandoffCheck(h))
+        return NULL;
+    return h;
+}
+
+/* Bootloader side: record the reset flags (without clearing them), then
+   return (and consume) the pending request. A request only counts after a software
+   reset; after power-up the region holds garbage. */
+boot_request_t BootShared_TakeRequest(void);
+
+/* Bootloader side: fill in the handoff block for the image at
+   image_address, described by its (verified) metadata block. */
+void BootShared_WriteHandoff(uint32_t image_address, const uint8_t *meta);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BOOT_SHARED_H */
@@ -0,0 +1,106 @@
+/**
+  ******************************************************************************
+  * @file    boot_timing.h
+  * @brief   Boot and session phase timestamps (DWT cycle counter + HAL tick).
+  *          Records live in a .noinit RAM table so the previous boot's
+  *          timeline survives a software reset (dying gasp, end of download).
+  ******************************************************************************
+  */
+
+#ifndef BOOT_TIMING_H
+#define BOOT_TIMING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BOOT_TIMING_MAX_RECORDS   48
+
+/* Each mark records the moment a phase begins; its duration is the gap
+   to the next mark. Keep in sync with the name table in boot_timing.c. */
+typedef enum {
+    BOOT_PHASE_RESET = 0,
+    BOOT_PHASE_HAL_INIT,
+    BOOT_PHASE_SCAN_DOWNLOAD,
+    BOOT_PHASE_VERIFY_DOWNLOAD,
+    BOOT_PHASE_SCAN_CURRENT,
+    BOOT_PHASE_VERIFY_CURRENT,
+    BOOT_PHASE_JUMP,
+    BOOT_PHASE_STEPHANO_POWER_OFF,
+    BOOT_PHASE_STEPHANO_POWER_ON,
+    BOOT_PHASE_STEPHANO_RESET,
+    BOOT_PHASE_STEPHANO_WAIT_READY,
+    BOOT_PHASE_AT_RESTORE,
+    BOOT_PHASE_AT_UART_CUR,
+    BOOT_PHASE_AT_BLEINIT,
+    BOOT_PHASE_AT_BLEADDR,
+    BOOT_PHASE_AT_GATTS_CREATE,
+    BOOT_PHASE_AT_GATTS_START,
+    BOOT_PHASE_AT_BLENAME,
+    BOOT_PHASE_AT_ADVDATA,
+    BOOT_PHASE_ADVERTISING,
+    BOOT_PHASE_BLE_CONNECTED,
+    BOOT_PHASE_BLE_LINK_TUNE,
+    BOOT_PHASE_SPP_READY,
+    BOOT_PHASE_HANDSHAKE,
+    BOOT_PHASE_WSM_BL,
+    BOOT_PHASE_WSM_APP,
+    BOOT_PHASE_PARAMS,
+    BOOT_PHASE_DL_ERASE,
+    BOOT_PHASE_DL_TRANSFER,
+    BOOT_PHASE_DL_COMPLETE,
+    BOOT_PHASE_SESSION_END,
+    BOOT_PHASE_COUNT
+} boot_phase_t;
+
+typedef struct {
+    uint16_t phase;
+    uint16_t reserved;
+    uint32_t tick_ms;   /* HAL_GetTick() at the mark */
+    uint32_t cycles;    /* raw DWT->CYCCNT at the mark */
+    uint64_t time_us;   /* microseconds since BootTiming_Init, clock-change safe
+                           (BootTiming_Resync) and Stop-safe (AddSleep);
+                           64 bits: an unbounded advertising wait outlasts
+                           the 71 minutes of a 32-bit count */
+} boot_timing_record_t;
+
+/* Enable the DWT cycle counter and start a new timeline. The previous
+   boot's timeline is kept if the no-init table survived the reset.
+   Call first thing in main(), before HAL_Init(). */
+void BootTiming_Init(void);
+
+/* Record the start of a phase. Cheap enough for any non-ISR context. */
+void BootTiming_Mark(boot_phase_t phase);
+
+/* Fold the cycles counted so far into the timeline at the current
+   SystemCoreClock. Call right before SystemCoreClock changes; the clock
+   profile switch does. */
+void BootTiming_Resync(void);
+
+/* Add ms slept with CYCCNT stopped (Stop mode), once the HAL tick has been
+   moved on by the same amount. */
+void BootTiming_AddSleep(uint32_t ms);
+
+/* Current cycle counter, for ad-hoc interval measurements. */
+uint32_t BootTiming_Cycles(void);
+
+/* Convert a cycle delta to microseconds at the current SystemCoreClock. */
+uint32_t BootTiming_CyclesToUs(uint32_t cycles);
+
+/* Access to the current (previous = false) or previous boot's records. */
+uint32_t BootTiming_GetRecords(bool previous, const boot_timing_record_t **records);
+
+const char *BootTiming_PhaseName(uint16_t phase);
+
+/* Emit "TIMING <boot> <idx> <phase> <time_us> <tick_ms>" lines followed by
+   "TIMING END". Scripts/boot_timing_report.sh formats the output. */
+void BootTiming_Report(void (*emit)(const char *line));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BOOT_TIMING_H */
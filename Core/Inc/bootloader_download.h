@@ -1,7 +1,7 @@
 /**
   ******************************************************************************
   * @file    bootloader_download.h
-  * @brief   BLE download via Stephano-I: WSM↔PC protocol.
+  * @brief   Download engine: WSM↔PC protocol over a pluggable transport.
   ******************************************************************************
   */
 
@@ -11,20 +11,34 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "transport.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/* Start BLE download. Powers on Stephano, configures WE SPP-like, runs protocol.
+/* Select the link for the next Bootloader_ConnectToServer(). Without a call
+   the BLE transport (Stephano-I) is used. */
+void Bootloader_SetTransport(const transport_t *transport);
+
+/* Bound the next session: nothing from the PC for ms ends it like an
+   error, but in Bootloader_BootCurrent() instead of a reset, as does any
+   other error or a link that does not open. 0 = no limit (the default). */
+void Bootloader_SetIdleTimeout(uint32_t ms);
+
+/* Start download. Opens the transport (for BLE: powers on Stephano, configures
+   WE SPP-like, waits for the PC), runs protocol.
    Never returns on success (reboots or jumps). On fatal error, sends dying gasp and reboots. */
 void Bootloader_ConnectToServer(void);
 
-/* Process received data (call from main loop). */
+/* Run the session: service received data and flash, sleeping in WFI
+   (events.h) whenever nothing is ready. Does not return; the session ends
+   in a reset or a jump to the new image. */
 void Bootloader_Download_Process(void);
 
-/* Add received byte (call from HAL_UART_RxCpltCallback). */
-void Bootloader_RxByte(uint8_t b);
+/* Well ID stored in flash by an earlier session. false (and *id = 0) when
+   none has been assigned yet. */
+bool Bootloader_GetWellId(uint16_t *id);
 
 #ifdef __cplusplus
 }
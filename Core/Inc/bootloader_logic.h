@@ -21,6 +21,35 @@ extern "C" {
    - Otherwise, start BLE download (never returns on success). */
 void Bootloader_Run(void);
 
+/* Verify the image in sector 7 (A/B: the preferred ready slot, then the
+   other) and jump to it, leaving the handoff block (boot_shared.h) behind.
+   Returns only if nothing verifies. */
+void Bootloader_BootCurrent(void);
+
+/* Sector holding the application that runs (7 unless BOOTLOADER_AB_SLOTS
+   has it in 6), and the sector an application download goes to (6 unless
+   BOOTLOADER_AB_SLOTS and 6 is the running slot, or
+   BOOTLOADER_DIRECT_PROVISION and Bootloader_Run found nothing to boot in
+   7). Metadata only. */
+uint32_t Bootloader_ActiveSlot(void);
+uint32_t Bootloader_DownloadSlot(void);
+
+/* The download slot still holds an image that may boot (A/B: the fallback
+   while the other is on trial, or a ready image after a power loss), so it
+   is erased only once a download actually needs it. */
+bool Bootloader_DownloadSlotInUse(void);
+
+/* Install in place: verify the download-state image in this slot (linked
+   for it) and flip it to ready (A/B: trial), with no copy by the first
+   stage. Single-slot builds accept sector 7 only. false leaves the flash
+   as it was. */
+bool Bootloader_CommitDownload(uint32_t sector);
+
+/* Metadata block of the image in the given sector: magic found on an 8-byte
+   boundary, and its size field puts it exactly at the end of the image.
+   Validation state and SHA256 are left to the caller. NULL if none. */
+const uint8_t *Bootloader_FindMetadata(uint32_t sector_addr, uint32_t sector_size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,56 @@
+/**
+  ******************************************************************************
+  * @file    cellular_update.h
+  * @brief   Remote application update over a cellular modem: fetches the
+  *          image from an HTTP server in Range requests, programs each range
+  *          into the download sector and resumes from the last programmed
+  *          offset after a dropped connection or a reset.
+  ******************************************************************************
+  */
+
+#ifndef CELLULAR_UPDATE_H
+#define CELLULAR_UPDATE_H
+
+#include "modem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Update server and image. Override from build, e.g.
+   -DBOOTLOADER_CELL_HOST=\"updates.example.com\" -DBOOTLOADER_CELL_PATH=\"/wsm/app.bin\". */
+#ifndef BOOTLOADER_CELL_HOST
+#define BOOTLOADER_CELL_HOST   "192.168.4.1"
+#endif
+#ifndef BOOTLOADER_CELL_PORT
+#define BOOTLOADER_CELL_PORT   8080
+#endif
+#ifndef BOOTLOADER_CELL_PATH
+#define BOOTLOADER_CELL_PATH   "/wsm/app.bin"
+#endif
+
+/* Bytes asked for per Range request; each range is programmed before the
+   next is requested. */
+#define CELL_RANGE_SIZE        4096
+
+/* Download the image into sector 6 and reset so the first stage verifies
+   and installs it. Returns only if the download could not be completed;
+   the offset reached is kept in no-init RAM, so the next attempt (after a
+   software reset too) continues from there if the server still has the
+   same image in the same download sector. */
+void CellularUpdate_Run(const modem_ops_t *modem);
+
+/* For a well that boots: as CellularUpdate_Run, but only if the version in
+   the metadata at the end of the server's image differs from the installed
+   one (or a download of it is half done). Also returns when it does not. */
+void CellularUpdate_Check(const modem_ops_t *modem);
+
+/* Drop the saved progress: the download sector is being erased, so the
+   next attempt must start from offset 0. flash_ops.c calls this. */
+void CellularUpdate_Forget(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CELLULAR_UPDATE_H */
@@ -0,0 +1,41 @@
+/**
+  ******************************************************************************
+  * @file    clock_profile.h
+  * @brief   System clock profiles, switched at run time: full speed with the
+  *          ART accelerator for hashing and flash work, HSE straight through
+  *          with the PLL off for the radio waits. USART baud rates follow
+  *          every switch.
+  *
+  *          SystemClock_Config() (CubeMX) brings up CLOCK_PROFILE_BASE; the
+  *          application is handed that one again, since its own clock setup
+  *          cannot reprogram a PLL that is already clocking the core.
+  ******************************************************************************
+  */
+
+#ifndef CLOCK_PROFILE_H
+#define CLOCK_PROFILE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    CLOCK_PROFILE_BASE = 0,   /* 72 MHz PLL, as SystemClock_Config() */
+    CLOCK_PROFILE_FAST,       /* 84 MHz PLL, the F401 maximum at VOS scale 2 */
+    CLOCK_PROFILE_LOW         /* 24 MHz HSE, PLL off, zero wait states */
+} clock_profile_t;
+
+/* Switch to profile and return the one it replaces, for restoring. Waits
+   for the enabled USARTs to finish transmitting; a byte being received at
+   the instant of the switch may be lost. Main loop only. */
+clock_profile_t ClockProfile_Set(clock_profile_t profile);
+
+clock_profile_t ClockProfile_Get(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CLOCK_PROFILE_H */
@@ -0,0 +1,36 @@
+/**
+  ******************************************************************************
+  * @file    events.h
+  * @brief   Event flags posted from interrupts, and the idle wait of the
+  *          main loop. The loop services whatever work is ready and, when
+  *          there is none, sleeps in WFI until the next interrupt instead of
+  *          polling the rings at full speed.
+  ******************************************************************************
+  */
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EVENT_RX      (1u << 0)   /* bytes landed in a transport receive ring */
+#define EVENT_FLASH   (1u << 1)   /* a background sector erase finished */
+#define EVENT_RADIO   (1u << 2)   /* Stephano power-up reached ready or timed out */
+
+/* Any context, including interrupts. */
+void Events_Post(uint32_t events);
+
+/* Main loop only. If none of mask is pending, sleep until the next
+   interrupt (SysTick at the latest, so tick timeouts keep running).
+   Returns and clears the pending events in mask, possibly none. */
+uint32_t Events_Wait(uint32_t mask);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EVENTS_H */
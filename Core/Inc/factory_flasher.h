@@ -0,0 +1,42 @@
+/**
+  ******************************************************************************
+  * @file    factory_flasher.h
+  * @brief   RAM-resident factory flasher (FACTORY_FLASHER builds only, see
+  *          Scripts/build_factory_flasher.sh): loaded into SRAM by a debugger
+  *          or the ROM bootloader, it receives a full flash image over the
+  *          USART1 wire, programs and verifies it, and reports timing.
+  *
+  *          Line protocol at FLASHER_BAUD (factory_flasher.c, 3 Mbaud
+  *          unless overridden from build), one reply line each:
+  *            PING                  -> FLASHER READY <window>
+  *            ERASE <addr> <len>    -> ERASE OK <sectors> <ms>
+  *            WRITE <addr> <len>    -> (then <len> raw bytes) WRITE OK <addr>
+  *            SHA256 <addr> <len>   -> SHA256 <hex>
+  *            TIMING                -> TIMING BYTES=.. ERASE_MS=.. PROGRAM_MS=.. VERIFY_MS=.. TOTAL_MS=..
+  *            RESET                 -> RESET OK, then system reset
+  *          Failures answer "ERR <reason>". WRITE frames may be pipelined
+  *          up to <window> bytes in flight; each WRITE OK frees its frame.
+  ******************************************************************************
+  */
+
+#ifndef FACTORY_FLASHER_H
+#define FACTORY_FLASHER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Largest WRITE payload, copied out of the receive ring before it is
+   programmed. The window PING reports (FLASHER_RX_SIZE - FLASHER_RX_MARGIN,
+   32512 bytes) holds many such frames, so the next ones keep arriving
+   while one is programmed. */
+#define FLASHER_BLOCK_SIZE   2048
+
+/* Serve the wire until RESET. Call after the HAL, clock and USART1 init. */
+void FactoryFlasher_Run(void) __attribute__((noreturn));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FACTORY_FLASHER_H */
@@ -25,8 +25,34 @@ extern "C" {
 #define FLASH_SECTOR_SIZE_6_7        0x20000  // 128KB
 #define FLASH_SECTOR_6_ADDRESS       0x08040000  // Download sector (128KB)
 #define FLASH_SECTOR_7_ADDRESS       0x08060000  // Current version sector (128KB)
+#define FLASH_SECTOR_STATS           1
+#define FLASH_SECTOR_STATS_ADDRESS   0x08004000  // Session statistics ring (16KB)
+#define FLASH_SECTOR_STATS_SIZE      0x4000
+#define FLASH_SECTOR_PARAMS_A        2
+#define FLASH_SECTOR_PARAMS_A_ADDRESS 0x08008000  // Parameter store log (16KB)
+#define FLASH_SECTOR_PARAMS_B        3
+#define FLASH_SECTOR_PARAMS_B_ADDRESS 0x0800C000  // Parameter store log (16KB)
+#define FLASH_SECTOR_PARAMS_SIZE     0x4000
 
 /* Exported types ------------------------------------------------------------*/
+/* What the download sector holds, as far as this boot has seen. */
+typedef enum {
+    FLASH_DL_UNKNOWN = 0,   /* not checked since the sector was selected */
+    FLASH_DL_BLANK,         /* all 0xFF: program without erasing */
+    FLASH_DL_ERASING,       /* background erase running */
+    FLASH_DL_DIRTY          /* holds data: erase before programming */
+} flash_dl_state_t;
+
+/* One pin change of a sequence played by Flash_EraseWhileSequencing. */
+typedef struct {
+    GPIO_TypeDef *port;     /* NULL: hold only */
+    uint16_t pin;
+    GPIO_PinState state;
+    uint16_t hold_ms;       /* before the next step */
+} flash_pin_step_t;
+
+#define FLASH_PIN_STEPS_MAX  4
+
 typedef struct {
     char version[15];  // YYYYMMDDHHMMSS + null terminator
     bool valid;
@@ -39,6 +65,31 @@ bool Flash_ReadData(uint32_t address, uint8_t* data, uint32_t length);
 bool Flash_GetCurrentVersion(firmware_version_t* version);
 bool Flash_CheckSpaceAvailable(uint32_t required_size);
 bool Flash_ProgramFirmwareData(uint32_t offset, const uint8_t* data, uint32_t length);
+/* Sector Flash_ProgramFirmwareData writes to: FLASH_SECTOR_DOWNLOAD unless
+   an A/B build picks the idle slot (6 or 7), or direct provisioning
+   writes to 7. */
+bool Flash_SelectDownloadSector(uint32_t sector);
+uint32_t Flash_GetDownloadSector(void);
+/* Base address of sector 6 or 7. */
+uint32_t Flash_SectorAddress(uint32_t sector);
+/* Blank-check the download sector once per selection. allow_erase_ahead:
+   if it holds data, Flash_EraseWhileSequencing may erase it before the
+   size of the next download is known. */
+flash_dl_state_t Flash_PrepareDownloadSector(bool allow_erase_ahead);
+/* Erase ahead, if allowed above, while playing these pin changes and holds
+   (a module power-up) from SRAM with interrupts masked: the F401 has one
+   flash bank, and every fetch from it, vector fetches included, stalls
+   until an erase ends. Returns after the last hold and the erase, with the
+   HAL tick caught up and the erase settled by the EOP interrupt
+   (Flash_IRQHandler); *erase_cycles is its DWT time. false, with nothing
+   done, if there is nothing to erase ahead. */
+bool Flash_EraseWhileSequencing(const flash_pin_step_t *steps, uint32_t count, uint32_t *erase_cycles);
+/* Make the download sector blank: waits for a background erase, skips a
+   sector already blank, erases otherwise. */
+bool Flash_EraseDownloadSector(void);
+flash_dl_state_t Flash_GetDownloadSectorState(void);
+/* FLASH_IRQn: end of a background erase. */
+void Flash_IRQHandler(void);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,55 @@
+/**
+  ******************************************************************************
+  * @file    low_power.h
+  * @brief   Stop mode for the long idle waits (BLE advertising): wake-up on
+  *          a falling edge of a UART receive line through its EXTI line, or
+  *          on the RTC wake-up timer, both as events (WFE), so no interrupt
+  *          handlers are involved.
+  *
+  *          The RTC is only used as the application left it: enabled and
+  *          clocked from LSE or LSI (LSI is switched back on, since LSION
+  *          does not survive a reset). The backup domain is never written,
+  *          so a board whose application has not set up the RTC, or runs
+  *          it from HSE (stopped in Stop mode), gets WFI instead. The
+  *          wake-up timer is borrowed and left disabled.
+  ******************************************************************************
+  */
+
+#ifndef LOW_POWER_H
+#define LOW_POWER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "main.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Longest single Stop: the wake-up timer at RTCCLK/16 counts 16 bits. */
+#define LOW_POWER_STOP_MAX_MS   30000
+
+/* Stop until a falling edge on rx_port/rx_pin (the start bit of the next
+   byte for huart) or max_ms on the RTC, whichever is first.
+
+   On wake the core runs on HSI: huart is switched to an HSI baud rate at
+   once so it keeps receiving, the HSE/PLL configuration found on entry is
+   restored, then the original baud rate. The bytes that arrive during the
+   wake-up itself, usually the first, are lost.
+
+   SysTick and the DWT cycle counter are stopped in Stop; the time slept,
+   read from the RTC calendar, is added to the HAL tick and the boot
+   timeline (BootTiming_AddSleep) on either wake-up. Should the
+   calendar not resynchronise, a timer wake-up adds max_ms and an edge
+   wake-up nothing.
+
+   true if anything but the timer ended the wait; false on the timer, and
+   after one WFI when the RTC cannot be used. */
+bool LowPower_StopUntilRx(GPIO_TypeDef *rx_port, uint16_t rx_pin,
+                          UART_HandleTypeDef *huart, uint32_t max_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOW_POWER_H */
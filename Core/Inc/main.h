@@ -94,9 +94,132 @@ void Error_Handler(void);
 #if STEPHANO_USE_UART1
 extern UART_HandleTypeDef huart1;
 #define STEPHANO_UART_PTR  (&huart1)
+#define STEPHANO_FLOW_RTS_GPIO_Port  EXT_MODEM_RTS_GPIO_Port
+#define STEPHANO_FLOW_RTS_Pin        EXT_MODEM_RTS_Pin
+#define STEPHANO_RX_WAKE_GPIO_Port   EXT_MODEM_RX_GPIO_Port
+#define STEPHANO_RX_WAKE_Pin         EXT_MODEM_RX_Pin
 #else
 extern UART_HandleTypeDef huart2;
 #define STEPHANO_UART_PTR  (&huart2)
+#define STEPHANO_FLOW_RTS_GPIO_Port  STEPHANO_RTS_GPIO_Port
+#define STEPHANO_FLOW_RTS_Pin        STEPHANO_RTS_Pin
+#define STEPHANO_RX_WAKE_GPIO_Port   STEPHANO_RX_GPIO_Port
+#define STEPHANO_RX_WAKE_Pin         STEPHANO_RX_Pin
+#endif
+
+/* Hardware flow control on the Stephano-I link: 1 = RTS/CTS (default), 0 = none.
+   CTS is handled by the USART; RTS is driven as a GPIO from the receive ring
+   watermarks so the module holds data while flash erases/programs stall us.
+   Override from build: -DBOOTLOADER_USE_HARDWARE_FLOW_CONTROL=0. */
+#ifndef BOOTLOADER_USE_HARDWARE_FLOW_CONTROL
+#define BOOTLOADER_USE_HARDWARE_FLOW_CONTROL 1
+#endif
+
+/* Advertising wait: 1 = while the module advertises, the MCU sits in Stop
+   mode and wakes on the first edge on the module's TX line (the +BLECONN
+   URC) or on the RTC wake-up timer (default), 0 = run and WFI between
+   SysTick interrupts. Stop needs the RTC the application set up; without
+   it the wait is WFI as with 0 (low_power.h).
+   Override from build: -DBOOTLOADER_ADV_STOP_MODE=0. */
+#ifndef BOOTLOADER_ADV_STOP_MODE
+#define BOOTLOADER_ADV_STOP_MODE 1
+#endif
+
+/* GATT transport: 1 = offer GATT write/notify next to SPP passthrough (default),
+   0 = SPP only. The PC picks GATT by enabling notifications right after connecting.
+   Override from build: -DBOOTLOADER_ENABLE_GATT_TRANSPORT=0. */
+#ifndef BOOTLOADER_ENABLE_GATT_TRANSPORT
+#define BOOTLOADER_ENABLE_GATT_TRANSPORT 1
+#endif
+
+/* Wi-Fi download: 1 = join the site AP and connect to the update server over
+   TCP first, falling back to BLE if that fails; 0 = BLE only (default).
+   AP and server come from the parameter store (transport_wifi.h).
+   Override from build: -DBOOTLOADER_ENABLE_WIFI=1. */
+#ifndef BOOTLOADER_ENABLE_WIFI
+#define BOOTLOADER_ENABLE_WIFI 0
+#endif
+
+/* Cellular download: 1 = fetch the application over HTTP Range requests
+   through the N58 modem on USART1 before trying Wi-Fi/BLE, 0 = off (default).
+   With nothing to boot it always downloads; on an update check requested
+   by the application, only if the server's version differs.
+   Server and image are set in cellular_update.h, the APN in modem_n58.h.
+   USART1 is then the modem's, so the debug prints to it are turned off.
+   Override from build: -DBOOTLOADER_ENABLE_CELLULAR=1. */
+#ifndef BOOTLOADER_ENABLE_CELLULAR
+#define BOOTLOADER_ENABLE_CELLULAR 0
+#endif
+
+/* Wired update, for the bench and the factory: 1 = at boot, a strap on PA8
+   or the magic sequence on USART1 skips the normal boot and runs the
+   download over USART1 at high baud, 0 = off (default). Settings are in
+   transport_uart.h. USART1 is then the wire, so the debug prints to it
+   are turned off, and every boot listens for the sequence.
+   Override from build: -DBOOTLOADER_ENABLE_WIRED=1. */
+#ifndef BOOTLOADER_ENABLE_WIRED
+#define BOOTLOADER_ENABLE_WIRED 0
+#endif
+
+#if BOOTLOADER_ENABLE_WIRED && STEPHANO_USE_UART1
+#error "BOOTLOADER_ENABLE_WIRED needs USART1 for the wire: build with STEPHANO_USE_UART1=0"
+#endif
+#if BOOTLOADER_ENABLE_WIRED
+#undef BOOTLOADER_DEBUG_ENABLE
+#define BOOTLOADER_DEBUG_ENABLE 0
+#endif
+
+/* A/B application slots: 1 = sectors 6 and 7 are both application slots;
+   an update is written to the slot not running, committed by flipping its
+   metadata to the ready state and booted in place, with no copy by the
+   first stage. Images must be linked for the slot they go to (metadata
+   dest_address = slot base); "WSM APP <ver> SLOT <sector>" tells the PC
+   which one. 0 = sector 6 download, sector 7 current (default).
+   Override from build: -DBOOTLOADER_AB_SLOTS=1. */
+#ifndef BOOTLOADER_AB_SLOTS
+#define BOOTLOADER_AB_SLOTS 0
+#endif
+
+/* A/B only: boots a newly committed image gets before it must confirm
+   itself through bl_services confirm_image; unconfirmed after that many,
+   the bootloader goes back to the previous slot. 1..4 (one validation byte
+   each); 0 commits straight to ready with no way back.
+   Override from build: -DBOOTLOADER_TRIAL_ATTEMPTS=0. */
+#ifndef BOOTLOADER_TRIAL_ATTEMPTS
+#define BOOTLOADER_TRIAL_ATTEMPTS 3
+#endif
+#if BOOTLOADER_TRIAL_ATTEMPTS > 4
+#error "BOOTLOADER_TRIAL_ATTEMPTS is at most 4"
+#endif
+
+/* Single-slot builds: 1 = when Bootloader_Run finds nothing to boot in
+   sector 7 (fresh board, corrupted application), the application download
+   goes straight into sector 7, is verified there and flipped to ready,
+   with no staging in sector 6 and no copy by the first stage. Bootloader
+   downloads still go to sector 6. A/B builds always install in place.
+   Override from build: -DBOOTLOADER_DIRECT_PROVISION=0. */
+#ifndef BOOTLOADER_DIRECT_PROVISION
+#define BOOTLOADER_DIRECT_PROVISION 1
+#endif
+
+/* Update check the application asked for (boot_shared.h mailbox): its
+   image is known good, so instead of waiting for a PC forever the
+   bootloader advertises this long and ends a session the PC has sent
+   nothing in for this long, then boots it again. In ms.
+   Override from build: -DBOOTLOADER_REQUEST_ADV_MS=120000. */
+#ifndef BOOTLOADER_REQUEST_ADV_MS
+#define BOOTLOADER_REQUEST_ADV_MS 60000
+#endif
+#ifndef BOOTLOADER_REQUEST_IDLE_MS
+#define BOOTLOADER_REQUEST_IDLE_MS 30000
+#endif
+
+#if BOOTLOADER_ENABLE_CELLULAR
+#if STEPHANO_USE_UART1
+#error "BOOTLOADER_ENABLE_CELLULAR needs USART1 for the modem: build with STEPHANO_USE_UART1=0"
+#endif
+#undef BOOTLOADER_DEBUG_ENABLE
+#define BOOTLOADER_DEBUG_ENABLE 0
 #endif
 /* USER CODE END Private defines */
 
@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * @file    modem.h
+  * @brief   Cellular modem operations used by the cellular update path:
+  *          power, network attach and a single TCP socket. The N58 driver
+  *          implements them over USART1; a bench build can substitute its
+  *          own table (e.g. talking to Scripts/n58_emulator.py).
+  ******************************************************************************
+  */
+
+#ifndef MODEM_H
+#define MODEM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    const char *name;
+
+    /* Power the modem up and wait until it answers AT. On failure returns
+       false with *error set. */
+    bool (*power_on)(const char **error);
+
+    /* Wait for network registration and bring up the data context. */
+    bool (*attach)(const char **error);
+
+    /* Open the TCP socket to host:port. */
+    bool (*tcp_open)(const char *host, uint16_t port, const char **error);
+
+    /* Send len bytes; false if the modem rejected them or the socket closed. */
+    bool (*tcp_send)(const uint8_t *data, uint32_t len);
+
+    /* Copy up to len received bytes into dst, waiting up to timeout_ms for
+       the first one. Returns 0 on timeout or once the peer has closed and
+       everything received has been read. */
+    uint32_t (*tcp_recv)(uint8_t *dst, uint32_t len, uint32_t timeout_ms);
+
+    void (*tcp_close)(void);
+    void (*power_off)(void);
+} modem_ops_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODEM_H */
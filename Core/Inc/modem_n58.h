@@ -0,0 +1,35 @@
+/**
+  ******************************************************************************
+  * @file    modem_n58.h
+  * @brief   Neoway N58 (3G/LTE) modem on the EXT_MODEM port (USART1, n_3GON):
+  *          AT set-up, PPP context and the built-in TCP stack
+  *          (AT+TCPSETUP / AT+TCPSEND / +TCPRECV).
+  ******************************************************************************
+  */
+
+#ifndef MODEM_N58_H
+#define MODEM_N58_H
+
+#include "modem.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Access point name for the data context. Override from build, e.g.
+   -DBOOTLOADER_CELL_APN=\"m2m.carrier\". */
+#ifndef BOOTLOADER_CELL_APN
+#define BOOTLOADER_CELL_APN  "internet"
+#endif
+
+const modem_ops_t *ModemN58_Get(void);
+
+/* Hand the received byte to the driver and re-arm the receive
+   (call from HAL_UART_RxCpltCallback for USART1). */
+void ModemN58_UartRxCplt(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MODEM_N58_H */
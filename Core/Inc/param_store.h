@@ -0,0 +1,83 @@
+/**
+  ******************************************************************************
+  * @file    param_store.h
+  * @brief   Append-only key/value store for WELL_ID and the configuration
+  *          parameters, in flash sectors 2 and 3.
+  *
+  *          One sector is active at a time; a change appends a record (a
+  *          few word programs) and the latest record for a key wins. When
+  *          the active sector is full, the live records are copied to the
+  *          other one, which then takes over; that is the only erase.
+  *          Each record carries a CRC-32, programmed last, so a record torn
+  *          by a reset is never read back. Lookups go through a RAM index
+  *          built by ParamStore_Init().
+  *
+  *          The first ParamStore_Init() on a board that still has the old
+  *          fixed WELL_ID block at the start of sector 3 moves it into the
+  *          store. The block keeps its 8 bytes there (the store in sector 3
+  *          starts behind it) and is rewritten whenever WELL_ID changes or
+  *          sector 3 is erased, for applications that still read it.
+  *          A sector is only erased if it is blank, a store sector, or
+  *          sector 3 with the old block; anything else is left alone and
+  *          the write fails.
+  ******************************************************************************
+  */
+
+#ifndef PARAM_STORE_H
+#define PARAM_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Keys are stored in flash: never renumber, only add. Numbers are
+   little-endian uint32 unless noted. Parameters from the design doc. */
+#define PARAM_WELL_ID               0x0001u   /* uint16 */
+#define PARAM_ROD_IDLE_TIME         0x0010u   /* s */
+#define PARAM_BLE_REPORT_TIME       0x0011u   /* s */
+#define PARAM_HTTPS_SERVER_URL      0x0012u   /* string */
+#define PARAM_HTTPS_ENDPOINT        0x0013u   /* string */
+#define PARAM_N58_REPORT_TIME       0x0014u   /* s */
+#define PARAM_MICRO_REPORT_TIME     0x0015u   /* s, Micro Server */
+#define PARAM_FLOW_CALIBRATION      0x0020u   /* opaque, format to be agreed */
+#define PARAM_SUMMARY_DESTINATION   0x0021u   /* string: "B", "HW", "-" ... */
+#define PARAM_DETAIL_DESTINATION    0x0022u   /* string, as above */
+#define PARAM_DEBUG_DESTINATION     0x0023u   /* string, as above */
+#define PARAM_SESSION_TIMEOUT       0x0024u   /* s */
+#define PARAM_WIFI_SSID             0x0025u   /* string, Wi-Fi download AP */
+#define PARAM_WIFI_PASSWORD         0x0026u   /* string, absent for an open AP */
+#define PARAM_WIFI_SERVER           0x0027u   /* string, update server host */
+#define PARAM_WIFI_PORT             0x0028u   /* TCP port */
+
+#define PARAM_VALUE_MAX             128   /* bytes per value */
+#define PARAM_STORE_MAX_KEYS        32    /* distinct keys in the RAM index */
+
+/* Scan the store and build the index; migrate the legacy WELL_ID block.
+   Called once at boot; the other calls do it on first use otherwise. */
+void ParamStore_Init(void);
+
+/* Copy up to size bytes of the value for key into value; *len (if not
+   NULL) gets the stored length. false if the key has no value. */
+bool ParamStore_Get(uint16_t key, void *value, uint32_t size, uint32_t *len);
+
+/* Store len (1..PARAM_VALUE_MAX) bytes for key. Writing the value already
+   stored costs nothing. false on a flash error, or when key would be the
+   (PARAM_STORE_MAX_KEYS + 1)th distinct key. */
+bool ParamStore_Set(uint16_t key, const void *value, uint32_t len);
+
+/* As ParamStore_Get, scanning flash instead of the index: touches no RAM,
+   for bl_services. Returns the stored length, or -1. */
+int32_t ParamStore_Read(uint16_t key, void *value, uint32_t size);
+
+/* CRC-32 as zlib's crc32(): start with crc = 0, chain over pieces. The
+   records use it; so does the parameter sync digest. */
+uint32_t ParamStore_Crc32(uint32_t crc, const void *data, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PARAM_STORE_H */
@@ -0,0 +1,60 @@
+/**
+  ******************************************************************************
+  * @file    param_sync.h
+  * @brief   Configuration parameter phase of the download protocol: names,
+  *          text form and digest of the parameters in param_store.h.
+  *
+  *          After "WSM APP OK", and after the last packet of a download,
+  *          the WSM sends "WSM PARAMS <digest>", the CRC-32 (as zlib's
+  *          crc32) of the lines "PARAMS LIST" would send, each ended by
+  *          "\n". The PC answers:
+  *
+  *            PARAMS OK      it has nothing to change: the WSM sends DONE.
+  *            PARAMS LIST    the WSM sends NAME=VALUE for every parameter
+  *                           that has a value, then PARAMS END. The
+  *                           Wi-Fi password is write-only: it is listed
+  *                           as WIFI_PASSWORD=* but digested as stored.
+  *            NAME=VALUE     a parameter that differs; the WSM answers OK,
+  *                           or ERROR="<reason>" and keeps the old value.
+  *            PARAMS END     all changes sent: the WSM sends DONE.
+  *
+  *          After DONE the WSM boots, or resets to install the download.
+  *          With no line from the PC for 10 s it does the same without
+  *          waiting for PARAMS END.
+  *
+  *          So an unchanged well costs one round trip, and a PC that knows
+  *          the well sends only what differs. WELL_ID is not in the list:
+  *          "WSM ID" sets it.
+  ******************************************************************************
+  */
+
+#ifndef PARAM_SYNC_H
+#define PARAM_SYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Longest "NAME=VALUE" line, terminator included. */
+#define PARAM_SYNC_LINE_MAX  160
+
+/* CRC-32 of the PARAMS LIST lines. */
+uint32_t ParamSync_Digest(void);
+
+/* Emit NAME=VALUE for each parameter with a value (NAME=* for the
+   write-only ones), then "PARAMS END". */
+void ParamSync_List(void (*emit)(const char *line));
+
+/* Handle a NAME=VALUE line from the PC: store it and write "OK" or
+   ERROR="<reason>" to reply. false if line is not an assignment. */
+bool ParamSync_Apply(const char *line, char *reply, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PARAM_SYNC_H */
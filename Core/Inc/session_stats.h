@@ -0,0 +1,95 @@
+/**
+  ******************************************************************************
+  * @file    session_stats.h
+  * @brief   Per-session download statistics, reported to the PC at session
+  *          end and appended to a small flash ring (sector 1).
+  *
+  *          Sector 1 is only used if it is blank or already holds the ring:
+  *          the first stage must fit in sector 0, and if it (or anything
+  *          else) ever spills into sector 1 the ring leaves it alone.
+  ******************************************************************************
+  */
+
+#ifndef SESSION_STATS_H
+#define SESSION_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    SESSION_KIND_NONE = 0,   /* no image transferred (e.g. "WSM APP OK") */
+    SESSION_KIND_BL   = 1,
+    SESSION_KIND_APP  = 2
+} session_kind_t;
+
+/* Link the session's data travelled over. */
+typedef enum {
+    SESSION_TRANSPORT_SPP  = 0,   /* BLE SPP passthrough */
+    SESSION_TRANSPORT_GATT = 1,   /* BLE GATT write / notify */
+    SESSION_TRANSPORT_WIFI = 2,   /* TCP over Wi-Fi station */
+    SESSION_TRANSPORT_UART = 3    /* wired, USART1 */
+} session_transport_t;
+
+typedef struct {
+    uint32_t bytes_received;     /* payload bytes programmed to flash */
+    uint32_t packets;            /* data packets acknowledged */
+    uint32_t retransmits;        /* duplicate packets (a lost "DATA OK");
+                                    the session ends on one */
+    uint32_t ring_overruns;      /* bytes dropped by the receive ring */
+    uint32_t flash_program_us;
+    uint32_t flash_erase_us;
+    uint32_t at_retries;
+    uint32_t transfer_ms;        /* "DL READY" to last packet */
+    uint32_t throughput_bps;     /* bytes per second over transfer_ms */
+    uint32_t transport;          /* session_transport_t */
+} session_stats_t;
+
+/* Reset all counters at the start of a session. */
+void SessionStats_Begin(void);
+
+/* Stamp the start of the data transfer ("DL READY" sent). */
+void SessionStats_TransferStart(void);
+
+void SessionStats_AddPacket(uint32_t bytes);
+void SessionStats_AddRetransmit(void);
+void SessionStats_SetOverruns(uint32_t overruns);
+void SessionStats_AddFlashProgram(uint32_t cycles);
+void SessionStats_AddFlashErase(uint32_t cycles);
+void SessionStats_SetAtRetries(uint32_t retries);
+void SessionStats_SetTransport(session_transport_t transport);
+
+/* Close the transfer window and compute duration and throughput. */
+void SessionStats_Finish(void);
+
+const session_stats_t *SessionStats_Get(void);
+
+/* "WSM STATS BYTES=... PACKETS=..." line for the PC. */
+void SessionStats_Format(char *buf, size_t len);
+
+/* Append this session to the flash ring. Erases the sector only when the
+   ring is full, so a 16 KB sector absorbs 256 sessions per erase. false,
+   writing nothing, if sector 1 holds anything but the ring. */
+bool SessionStats_Persist(uint16_t well_id, session_kind_t kind, bool success);
+
+/* Failed session: keep the record in no-init RAM across the reset that
+   follows, instead of programming flash on the failure path. */
+void SessionStats_Defer(uint16_t well_id, session_kind_t kind);
+
+/* Append a record left by SessionStats_Defer() before the last reset, as
+   failed, and drop it. Call once at boot. */
+void SessionStats_PersistDeferred(void);
+
+/* Emit "STATS <seq> <well_id> <kind> <result> ..." lines for every stored
+   session, oldest first, followed by "STATS END". */
+void SessionStats_ReportLog(void (*emit)(const char *line));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SESSION_STATS_H */
@@ -0,0 +1,53 @@
+/**
+  ******************************************************************************
+  * @file    spsc_ring.h
+  * @brief   Lock-free single-producer/single-consumer byte ring.
+  *          The producer (UART ISR) only writes head, the consumer (main
+  *          loop) only writes tail; both indices run free and are masked
+  *          with (size - 1), so size must be a power of two.
+  *          No HAL dependency, so the ring also builds on a host.
+  ******************************************************************************
+  */
+
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint8_t *buffer;
+    uint32_t mask;                /* size - 1 */
+    volatile uint32_t head;       /* next write position, producer only */
+    volatile uint32_t tail;       /* next read position, consumer only */
+    volatile uint32_t overflows;  /* bytes dropped because the ring was full */
+} spsc_ring_t;
+
+/* Attach a buffer. Returns false if size is not a non-zero power of two.
+   Only call while the producer is stopped. */
+bool SpscRing_Init(spsc_ring_t *ring, uint8_t *buffer, uint32_t size);
+
+/* Producer side. Returns false (and counts an overflow) if the ring is full. */
+bool SpscRing_Put(spsc_ring_t *ring, uint8_t b);
+
+/* Either side. */
+uint32_t SpscRing_Count(const spsc_ring_t *ring);
+uint32_t SpscRing_Free(const spsc_ring_t *ring);
+uint32_t SpscRing_Size(const spsc_ring_t *ring);
+uint32_t SpscRing_Overflows(const spsc_ring_t *ring);
+
+/* Consumer side. */
+bool SpscRing_Get(spsc_ring_t *ring, uint8_t *b);
+uint32_t SpscRing_Read(spsc_ring_t *ring, uint8_t *dst, uint32_t len);
+uint32_t SpscRing_Peek(const spsc_ring_t *ring, uint8_t *dst, uint32_t len);
+uint32_t SpscRing_Skip(spsc_ring_t *ring, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPSC_RING_H */
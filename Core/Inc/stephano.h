@@ -0,0 +1,81 @@
+/**
+  ******************************************************************************
+  * @file    stephano.h
+  * @brief   Stephano-I module bring-up and UART receive path shared by the
+  *          transports that run over it (BLE, Wi-Fi): power/reset sequence,
+  *          base AT set-up, and the interrupt-fed receive ring with RTS
+  *          flow control.
+  ******************************************************************************
+  */
+
+#ifndef STEPHANO_H
+#define STEPHANO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spsc_ring.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define STEPHANO_AT_SETUP_RETRIES  2
+
+/* Start the power-cycle and reset sequence without waiting: the holds
+   advance from SysTick (Stephano_PowerUpTick) and "ready" is picked out of
+   the interrupt receive, so the module boots while the bootloader scans
+   and hashes. Called at reset. */
+void Stephano_PowerUpBegin(void);
+
+/* Advance the power-up sequence; call from the SysTick interrupt. */
+void Stephano_PowerUpTick(void);
+
+/* Drop an unfinished power-up before handing over to the application:
+   n_STEPHANO_ON low (powered) and n_STEPHANO_RST high, the levels
+   MX_GPIO_Init leaves and the application found before the sequence
+   started at reset. The module may have been power-cycled on the way and
+   still be booting. No effect once Stephano_Start() has taken the module. */
+void Stephano_PowerUpCancel(void);
+
+/* Finish the power-up (begun here if Stephano_PowerUpBegin was not called,
+   or for a second start), wait for "ready", restore defaults and set the
+   UART (with RTS/CTS when BOOTLOADER_USE_HARDWARE_FLOW_CONTROL). Also
+   empties the receive ring. On failure returns false with *error set. */
+bool Stephano_Start(const char **error);
+
+/* Module power as last driven, and whether Stephano_Start() has completed
+   since it was powered (for the handoff to the application). */
+bool Stephano_IsPowered(void);
+bool Stephano_IsConfigured(void);
+
+/* Route received bytes through filter instead of straight into the ring
+   (e.g. the GATT +WRITE parser, which puts payload bytes itself).
+   NULL restores raw passthrough. */
+void Stephano_SetRxFilter(void (*filter)(uint8_t b));
+
+/* Start / stop the interrupt-driven receive into the ring. AT commands use
+   blocking receive, so stop before and restart after them. */
+void Stephano_RxStart(void);
+void Stephano_RxStop(void);
+
+spsc_ring_t *Stephano_RxRing(void);
+
+/* Consumer side: take bytes out of the ring and release RTS once it has
+   drained below the low watermark. */
+uint32_t Stephano_Read(uint8_t *dst, uint32_t len);
+
+/* Send raw bytes to the module. */
+bool Stephano_Write(const uint8_t *data, uint32_t len);
+
+/* Add received byte to the ring (through the filter, if set). */
+void Stephano_RxByte(uint8_t b);
+
+/* Hand the byte the interrupt receive just completed to Stephano_RxByte()
+   and re-arm the receive (call from HAL_UART_RxCpltCallback). */
+void Stephano_UartRxCplt(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STEPHANO_H */
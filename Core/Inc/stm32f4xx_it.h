@@ -58,6 +58,7 @@ void SysTick_Handler(void);
 void USART2_IRQHandler(void);
 /* USER CODE BEGIN EFP */
 void USART1_IRQHandler(void);
+void FLASH_IRQHandler(void);
 /* USER CODE END EFP */
 
 #ifdef __cplusplus
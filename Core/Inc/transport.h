@@ -0,0 +1,62 @@
+/**
+  ******************************************************************************
+  * @file    transport.h
+  * @brief   Byte-stream link between the WSM download protocol and the PC.
+  *          The protocol engine (bootloader_download.c) only talks to a
+  *          transport_t; each link (BLE via Stephano-I, loopback, ...) lives
+  *          in its own transport_<name>.c and exports a getter for its table.
+  ******************************************************************************
+  */
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Counters every transport keeps; link-specific detail goes through link_info. */
+typedef struct {
+    uint32_t rx_window;      /* bytes the link buffers for us, advertised as credits */
+    uint32_t rx_overruns;    /* received bytes dropped because the buffer was full */
+    uint32_t bytes_in;       /* bytes handed to the engine by read() */
+    uint32_t bytes_out;      /* bytes accepted by write() */
+} transport_stats_t;
+
+typedef struct {
+    const char *name;
+
+    /* Bring the link up and block until the PC is connected. On failure
+       returns false with *error set to a short reason for the dying gasp. */
+    bool (*open)(const char **error);
+
+    /* Bytes ready to read without blocking. */
+    uint32_t (*available)(void);
+
+    /* Copy up to len received bytes; returns the number copied (may be 0). */
+    uint32_t (*read)(uint8_t *dst, uint32_t len);
+
+    /* Send len bytes to the PC; blocks until they are handed to the link. */
+    bool (*write)(const uint8_t *data, uint32_t len);
+
+    /* Stop receiving; the link may be reopened with open(). */
+    void (*close)(void);
+
+    /* Identity of the WSM on this link (e.g. BLE MAC), sent as "WSM MAC". */
+    const char *(*address)(void);
+
+    void (*get_stats)(transport_stats_t *stats);
+
+    /* "KEY=value ..." description of the link for "WSM LINK". */
+    void (*link_info)(char *buf, size_t len);
+} transport_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRANSPORT_H */
@@ -0,0 +1,36 @@
+/**
+  ******************************************************************************
+  * @file    transport_ble.h
+  * @brief   BLE transport via the Stephano-I module: power-up, AT set-up,
+  *          advertising, and SPP passthrough or GATT write/notify data path.
+  ******************************************************************************
+  */
+
+#ifndef TRANSPORT_BLE_H
+#define TRANSPORT_BLE_H
+
+#include "transport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const transport_t *TransportBle_Get(void);
+
+/* BLE MAC read from the module at the last open, in the order it prints
+   (most significant first). false if it has not been read. */
+bool TransportBle_GetMac(uint8_t mac[6]);
+
+/* A central is connected and the data path is up (open succeeded, no
+   close since). */
+bool TransportBle_Connected(void);
+
+/* How long the next open advertises before it fails with "No BLE
+   connection"; 0 = until a central connects (the default). */
+void TransportBle_SetAdvertisingTimeout(uint32_t ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRANSPORT_BLE_H */
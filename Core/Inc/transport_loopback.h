@@ -0,0 +1,38 @@
+/**
+  ******************************************************************************
+  * @file    transport_loopback.h
+  * @brief   In-memory transport: the "PC" is a caller on the same machine
+  *          that feeds bytes in and drains the WSM's replies. No HAL
+  *          dependency, so it also builds on a host to drive the download
+  *          engine against a scripted server.
+  ******************************************************************************
+  */
+
+#ifndef TRANSPORT_LOOPBACK_H
+#define TRANSPORT_LOOPBACK_H
+
+#include <stdint.h>
+#include "transport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* host_service, if not NULL, is called whenever the engine finds the input
+   empty or the output full, so a single-threaded harness can play the PC
+   side from it. With a second thread or ISR as the PC, pass NULL. */
+void TransportLoopback_Init(void (*host_service)(void));
+
+const transport_t *TransportLoopback_Get(void);
+
+/* PC side: queue bytes for the WSM; returns how many fitted. */
+uint32_t TransportLoopback_HostWrite(const uint8_t *data, uint32_t len);
+
+/* PC side: take up to len bytes the WSM sent. */
+uint32_t TransportLoopback_HostRead(uint8_t *dst, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRANSPORT_LOOPBACK_H */
@@ -0,0 +1,56 @@
+/**
+  ******************************************************************************
+  * @file    transport_uart.h
+  * @brief   Wired transport on USART1 (EXT_MODEM port) for bench and factory
+  *          updates: the WSM protocol runs straight over the UART at high
+  *          baud, without the Stephano-I module.
+  ******************************************************************************
+  */
+
+#ifndef TRANSPORT_UART_H
+#define TRANSPORT_UART_H
+
+#include "transport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Link speed once wired mode is entered. The magic sequence is always sent
+   at the 115200 baud USART1 comes up with. Override from build, e.g.
+   -DBOOTLOADER_WIRED_BAUD=1500000. */
+#ifndef BOOTLOADER_WIRED_BAUD
+#define BOOTLOADER_WIRED_BAUD            921600
+#endif
+
+/* How long to listen for the magic sequence at boot; 0 = strap only. */
+#ifndef BOOTLOADER_WIRED_MAGIC_WINDOW_MS
+#define BOOTLOADER_WIRED_MAGIC_WINDOW_MS 20
+#endif
+
+/* Sent by the PC (repeatedly, while the board resets) to request wired mode. */
+#define WIRED_MAGIC                      "WSM WIRED\r\n"
+
+/* Strap: pulled low at boot to request wired mode (spare pin, pulled up). */
+#define WIRED_STRAP_GPIO_Port            GPIOA
+#define WIRED_STRAP_Pin                  GPIO_PIN_8
+
+/* Check the strap and listen for the magic sequence. On a request,
+   answers "WSM WIRED <baud>" at 115200 and returns true; the caller then
+   runs the download over TransportUart_Get() instead of booting. */
+bool TransportUart_Requested(void);
+
+const transport_t *TransportUart_Get(void);
+
+/* True while the transport owns USART1's receive interrupt. */
+bool TransportUart_Active(void);
+
+/* Hand the received byte to the ring and re-arm the receive
+   (call from HAL_UART_RxCpltCallback for USART1). */
+void TransportUart_UartRxCplt(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRANSPORT_UART_H */
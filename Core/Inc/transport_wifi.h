@@ -0,0 +1,43 @@
+/**
+  ******************************************************************************
+  * @file    transport_wifi.h
+  * @brief   Wi-Fi station transport via the Stephano-I module: joins the
+  *          site access point and runs the WSM protocol over a TCP
+  *          connection to the update server (UART passthrough mode).
+  ******************************************************************************
+  */
+
+#ifndef TRANSPORT_WIFI_H
+#define TRANSPORT_WIFI_H
+
+#include "transport.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Access point and update server: the WIFI_SSID, WIFI_PASSWORD,
+   WIFI_SERVER and WIFI_PORT parameters (param_store.h), set by the PC in
+   the parameter phase of a BLE session. These are the defaults for the
+   ones not set. Override from build, e.g.
+   -DBOOTLOADER_WIFI_SSID=\"site-ap\" -DBOOTLOADER_WIFI_SERVER=\"10.0.0.5\". */
+#ifndef BOOTLOADER_WIFI_SSID
+#define BOOTLOADER_WIFI_SSID      "wsm-update"
+#endif
+#ifndef BOOTLOADER_WIFI_PASSWORD
+#define BOOTLOADER_WIFI_PASSWORD  ""
+#endif
+#ifndef BOOTLOADER_WIFI_SERVER
+#define BOOTLOADER_WIFI_SERVER    "192.168.4.1"
+#endif
+#ifndef BOOTLOADER_WIFI_PORT
+#define BOOTLOADER_WIFI_PORT      5000
+#endif
+
+const transport_t *TransportWifi_Get(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRANSPORT_WIFI_H */
@@ -12,7 +12,9 @@
 #include <string.h>
 #include <stdio.h>
 
+#ifndef BOOTLOADER_DEBUG_ENABLE
 #define BOOTLOADER_DEBUG_ENABLE 1
+#endif
 #include "stm32f4xx_hal_uart.h"
 extern UART_HandleTypeDef huart1;
 
@@ -20,6 +22,7 @@ extern UART_HandleTypeDef huart1;
 
 static char at_response_buffer[AT_MAX_RESPONSE_LEN];
 static volatile uint16_t at_response_len = 0;
+static uint32_t at_retry_count = 0;
 
 // Note: HAL_UART_RxCpltCallback is implemented in firmware_update.c
 // AT commands use blocking receive to avoid conflicts
@@ -112,6 +115,25 @@ at_status_t AT_SendCommand(const char* command, char* response, uint16_t respons
     }
 }
 
+/* Send a command and retry up to 'retries' more times until it answers OK.
+   Retries are counted for the session statistics. */
+at_status_t AT_SendCommandRetry(const char* command, char* response, uint16_t response_len, uint32_t timeout_ms, uint8_t retries)
+{
+    at_status_t status = AT_SendCommand(command, response, response_len, timeout_ms, true);
+
+    while (status != AT_OK && retries > 0) {
+        retries--;
+        at_retry_count++;
+        status = AT_SendCommand(command, response, response_len, timeout_ms, true);
+    }
+    return status;
+}
+
+uint32_t AT_GetRetryCount(void)
+{
+    return at_retry_count;
+}
+
 at_status_t AT_ReceiveMessage(char* response, uint16_t response_len, uint32_t timeout_ms)
 {
     HAL_StatusTypeDef status;
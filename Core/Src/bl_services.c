@@ -0,0 +1,173 @@
+/**
+  ******************************************************************************
+  * @file    bl_services.c
+  * @brief   Function table exported to the application at
+  *          BL_SERVICES_ADDRESS, and the register-level flash entries
+  *          behind it.
+  ******************************************************************************
+  */
+
+#include "bl_services.h"
+#include "bootloader_logic.h"
+#include "app_metadata.h"
+#include "param_store.h"
+#include "main.h"
+#include <string.h>
+
+#define FLASH_SR_ERRORS  (FLASH_SR_OPERR | FLASH_SR_WRPERR | FLASH_SR_PGAERR \
+                        | FLASH_SR_PGPERR | FLASH_SR_PGSERR | FLASH_SR_RDERR)
+
+/* Sector start addresses for the STM32F401RE; the last entry is the end. */
+static const uint32_t SECTOR_START[9] = {
+    0x08000000, 0x08004000, 0x08008000, 0x0800C000,
+    0x08010000, 0x08020000, 0x08040000, 0x08060000, 0x08080000
+};
+
+/* The first stage (sector 0), the session statistics ring (1), the
+   parameter store (2, 3) and this bootloader (4): only the bootloader
+   writes them, through its own code. */
+static bool sector_protected(uint32_t sector)
+{
+    return sector <= 4;
+}
+
+/* Not HAL_FLASHEx_Erase / HAL_FLASH_Program: they keep state in pFlash and
+   time out on uwTick, both in bootloader RAM that the application owns. */
+static bool flash_wait(void)
+{
+    uint32_t sr;
+
+    while (FLASH->SR & FLASH_SR_BSY)
+        ;
+    sr = FLASH->SR & FLASH_SR_ERRORS;
+    FLASH->SR = sr | FLASH_SR_EOP;
+    return sr == 0;
+}
+
+/* Unlock and drop error flags left by an earlier operation. */
+static void flash_unlock(void)
+{
+    if (FLASH->CR & FLASH_CR_LOCK) {
+        FLASH->KEYR = 0x45670123u;
+        FLASH->KEYR = 0xCDEF89ABu;
+    }
+    while (FLASH->SR & FLASH_SR_BSY)
+        ;
+    FLASH->SR = FLASH_SR_ERRORS | FLASH_SR_EOP;
+}
+
+/* Leaves the interrupt enables alone: they belong to the application. */
+static void flash_lock(void)
+{
+    FLASH->CR &= ~(FLASH_CR_PG | FLASH_CR_SER | FLASH_CR_SNB);
+    FLASH->CR |= FLASH_CR_LOCK;
+}
+
+/* Stale erased lines may sit in the data cache after an erase. */
+static void flash_flush_dcache(void)
+{
+    if (FLASH->ACR & FLASH_ACR_DCEN) {
+        FLASH->ACR &= ~FLASH_ACR_DCEN;
+        FLASH->ACR |= FLASH_ACR_DCRST;
+        FLASH->ACR &= ~FLASH_ACR_DCRST;
+        FLASH->ACR |= FLASH_ACR_DCEN;
+    }
+}
+
+static bool svc_flash_erase_sector(uint32_t sector)
+{
+    bool ok;
+
+    if (sector > 7 || sector_protected(sector))
+        return false;
+
+    flash_unlock();
+    FLASH->CR &= ~(FLASH_CR_PSIZE | FLASH_CR_SNB);
+    FLASH->CR |= FLASH_CR_PSIZE_1 | FLASH_CR_SER | (sector << FLASH_CR_SNB_Pos);
+    FLASH->CR |= FLASH_CR_STRT;
+    ok = flash_wait();
+    flash_lock();
+    flash_flush_dcache();
+    return ok;
+}
+
+static bool svc_flash_program(uint32_t address, const uint8_t *data, uint32_t length)
+{
+    uint32_t sector, end = address + length;
+    bool ok = true;
+
+    if (address % 4 != 0 || address < SECTOR_START[0] || end > SECTOR_START[8] || end < address)
+        return false;
+    for (sector = 0; sector < 8; ++sector)
+        if (sector_protected(sector) && address < SECTOR_START[sector + 1]
+            && end > SECTOR_START[sector])
+            return false;
+
+    flash_unlock();
+    FLASH->CR &= ~FLASH_CR_PSIZE;
+    FLASH->CR |= FLASH_CR_PSIZE_1 | FLASH_CR_PG;
+    while (ok && address < end) {
+        uint32_t word = *(const uint32_t *)address;
+        uint32_t n = (end - address < 4) ? end - address : 4;
+
+        /* data need not be aligned; a short tail keeps the bytes already
+           in flash, as Flash_WriteData does. */
+        memcpy(&word, data, n);
+        *(volatile uint32_t *)address = word;
+        ok = flash_wait();
+        address += 4;
+        data += n;
+    }
+    flash_lock();
+    return ok;
+}
+
+/* Trial -> ready for the image running from SCB->VTOR, then retire the
+   slot it replaces (BOOTLOADER_TRIAL_ATTEMPTS in main.h). */
+static bool svc_confirm_image(void)
+{
+#if BOOTLOADER_AB_SLOTS
+    static const uint8_t WORD_ZERO[4] = { 0x00, 0x00, 0x00, 0x00 };
+    uint32_t base = SCB->VTOR;
+    uint32_t other = (base == SECTOR_START[6]) ? SECTOR_START[7] : SECTOR_START[6];
+    uint32_t size = SECTOR_START[7] - SECTOR_START[6];
+    const uint8_t *meta, *old;
+    const uint8_t *state;
+
+    if (base != SECTOR_START[6] && base != SECTOR_START[7])
+        return false;
+    meta = Bootloader_FindMetadata(base, size);
+    if (meta == NULL)
+        return false;
+    state = meta + APP_METADATA_OFFSET_VALIDATION + 4;
+    if (memcmp(state, WORD_ZERO, 4) == 0)
+        return true;
+    if (state[0] != 0x00 || state[1] != 0x00 || state[2] != 0x00 || state[3] != 0xFF)
+        return false;
+    if (!svc_flash_program((uint32_t)state, WORD_ZERO, 4))
+        return false;
+
+    old = Bootloader_FindMetadata(other, size);
+    if (old != NULL && memcmp(old + APP_METADATA_OFFSET_VALIDATION + 4, WORD_ZERO, 4) == 0)
+        (void)svc_flash_program((uint32_t)old + APP_METADATA_OFFSET_INVALIDATION + 4, WORD_ZERO, 4);
+    return true;
+#else
+    /* Single slot: every image the bootloader runs is already final. */
+    return true;
+#endif
+}
+
+__attribute__((section(".bl_services"), used))
+const bl_services_t bl_services = {
+    .magic = BL_SERVICES_MAGIC,
+    .version = BL_SERVICES_VERSION,
+    .size = sizeof(bl_services_t),
+    .sha256_init = SHA256_Init,
+    .sha256_update = SHA256_Update,
+    .sha256_final = SHA256_Final,
+    .flash_erase_sector = svc_flash_erase_sector,
+    .flash_program = svc_flash_program,
+    .metadata_find = Bootloader_FindMetadata,
+    .confirm_image = svc_confirm_image,
+    .param_read = ParamStore_Read,
+};
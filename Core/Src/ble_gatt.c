@@ -0,0 +1,199 @@
+/**
+  ******************************************************************************
+  * @file    ble_gatt.c
+  * @brief   GATT transport over the Stephano-I AT interface.
+  ******************************************************************************
+  */
+
+#include "ble_gatt.h"
+#include "main.h"
+#include <stdio.h>
+#include <string.h>
+
+#define GATT_RESPONSE_TIMEOUT_MS 500
+#define GATT_DEFAULT_MTU         23
+#define GATT_URC_FIELDS          5   /* conn, srv, char, desc, len */
+
+/* +WRITE:<conn_index>,<srv_index>,<char_index>,[<desc_index>],<len>,<value>
+   The value is raw binary of exactly <len> bytes, so it is counted rather
+   than scanned for a line ending. */
+typedef enum {
+    GATT_RX_IDLE,
+    GATT_RX_FIELDS,
+    GATT_RX_VALUE
+} gatt_rx_state_t;
+
+static const char write_urc[] = "+WRITE:";
+
+static spsc_ring_t *gatt_ring;
+static gatt_rx_state_t rx_state = GATT_RX_IDLE;
+static uint8_t prefix_pos;
+static uint8_t field_idx;
+static uint32_t field_val[GATT_URC_FIELDS];
+static bool field_set[GATT_URC_FIELDS];
+static uint32_t value_left;
+static bool value_keep;
+static uint32_t idle_tail;             /* last four bytes outside URC values */
+static volatile bool prompt_seen;
+static volatile bool ok_seen;
+static volatile bool error_seen;
+static volatile bool subscribed;
+static volatile bool spp_activity;
+static char *volatile cmd_resp;        /* BleGatt_Command reply buffer, NULL when idle */
+static uint32_t cmd_resp_size;
+static volatile uint32_t cmd_resp_len;
+
+void BleGatt_Init(spsc_ring_t *ring)
+{
+    gatt_ring = ring;
+    rx_state = GATT_RX_IDLE;
+    prefix_pos = 0;
+    idle_tail = 0;
+    prompt_seen = false;
+    ok_seen = false;
+    error_seen = false;
+    subscribed = false;
+    spp_activity = false;
+    cmd_resp = NULL;
+}
+
+/* Header complete: decide what to do with the value that follows. */
+static void start_value(void)
+{
+    bool is_desc = field_set[3];
+
+    value_left = field_val[4];
+    value_keep = !is_desc
+        && field_val[1] == BLE_GATT_SRV_INDEX
+        && field_val[2] == BLE_GATT_RX_CHAR_INDEX;
+
+    /* A CCCD write on our TX characteristic: the PC wants notifications. */
+    if (is_desc && field_val[1] == BLE_GATT_SRV_INDEX && field_val[2] == BLE_GATT_TX_CHAR_INDEX)
+        subscribed = true;
+    else if (field_val[1] == BLE_GATT_SRV_INDEX && field_val[2] != BLE_GATT_RX_CHAR_INDEX
+             && field_val[2] != BLE_GATT_TX_CHAR_INDEX)
+        spp_activity = true;
+
+    rx_state = (value_left > 0) ? GATT_RX_VALUE : GATT_RX_IDLE;
+}
+
+void BleGatt_RxByte(uint8_t b)
+{
+    switch (rx_state) {
+    case GATT_RX_IDLE:
+        idle_tail = (idle_tail << 8) | b;
+        if (idle_tail == 0x4F4B0D0AU)  /* "OK\r\n" */
+            ok_seen = true;
+        else if (idle_tail == 0x4F520D0AU)  /* "ERROR\r\n" */
+            error_seen = true;
+        if (cmd_resp != NULL && cmd_resp_len < cmd_resp_size - 1U)
+            cmd_resp[cmd_resp_len++] = (char)b;
+        if (b == (uint8_t)write_urc[prefix_pos]) {
+            if (++prefix_pos == sizeof(write_urc) - 1) {
+                prefix_pos = 0;
+                field_idx = 0;
+                memset(field_val, 0, sizeof(field_val));
+                memset(field_set, 0, sizeof(field_set));
+                rx_state = GATT_RX_FIELDS;
+            }
+        } else {
+            prefix_pos = (b == (uint8_t)write_urc[0]) ? 1 : 0;
+            if (b == '>')
+                prompt_seen = true;
+        }
+        break;
+
+    case GATT_RX_FIELDS:
+        if (b >= '0' && b <= '9') {
+            field_val[field_idx] = field_val[field_idx] * 10U + (uint32_t)(b - '0');
+            field_set[field_idx] = true;
+        } else if (b == ',') {
+            if (++field_idx == GATT_URC_FIELDS)
+                start_value();
+        } else {
+            rx_state = GATT_RX_IDLE;   /* malformed, resynchronise */
+        }
+        break;
+
+    case GATT_RX_VALUE:
+        if (value_keep)
+            (void)SpscRing_Put(gatt_ring, b);
+        if (--value_left == 0)
+            rx_state = GATT_RX_IDLE;
+        break;
+    }
+}
+
+bool BleGatt_Subscribed(void)
+{
+    return subscribed;
+}
+
+bool BleGatt_SppActivity(void)
+{
+    return spp_activity;
+}
+
+static bool wait_flag(volatile bool *flag)
+{
+    uint32_t start = HAL_GetTick();
+
+    while (!*flag) {
+        if (HAL_GetTick() - start > GATT_RESPONSE_TIMEOUT_MS)
+            return false;
+    }
+    return true;
+}
+
+bool BleGatt_Command(const char *cmd, char *resp, uint32_t size, uint32_t timeout_ms)
+{
+    uint32_t start;
+
+    ok_seen = false;
+    error_seen = false;
+    cmd_resp_len = 0;
+    cmd_resp_size = size;
+    cmd_resp = (resp != NULL && size > 0) ? resp : NULL;
+    if (HAL_UART_Transmit(STEPHANO_UART_PTR, (uint8_t *)cmd, (uint16_t)strlen(cmd), 500) != HAL_OK
+        || HAL_UART_Transmit(STEPHANO_UART_PTR, (uint8_t *)"\r\n", 2, 500) != HAL_OK) {
+        cmd_resp = NULL;
+        return false;
+    }
+    start = HAL_GetTick();
+    while (!ok_seen && !error_seen && HAL_GetTick() - start <= timeout_ms)
+        ;
+    cmd_resp = NULL;
+    if (resp != NULL && size > 0)
+        resp[cmd_resp_len] = '\0';
+    return ok_seen;
+}
+
+bool BleGatt_Notify(const uint8_t *data, uint32_t len, uint16_t mtu)
+{
+    uint32_t chunk_max = ((mtu > 3) ? mtu : GATT_DEFAULT_MTU) - 3U;
+    char cmd[48];
+
+    while (len > 0) {
+        uint32_t n = (len < chunk_max) ? len : chunk_max;
+        int cmd_len = snprintf(cmd, sizeof(cmd), "AT+BLEGATTSNTFY=0,%u,%u,%lu\r\n",
+                               (unsigned int)BLE_GATT_SRV_INDEX, (unsigned int)BLE_GATT_TX_CHAR_INDEX,
+                               (unsigned long)n);
+
+        prompt_seen = false;
+        if (HAL_UART_Transmit(STEPHANO_UART_PTR, (uint8_t *)cmd, (uint16_t)cmd_len, 500) != HAL_OK)
+            return false;
+        if (!wait_flag(&prompt_seen))
+            return false;
+
+        /* The module answers OK once the notification is queued; wait for it
+           so the next AT+BLEGATTSNTFY is not rejected as busy. */
+        ok_seen = false;
+        if (HAL_UART_Transmit(STEPHANO_UART_PTR, (uint8_t *)data, (uint16_t)n, 1000) != HAL_OK)
+            return false;
+        if (!wait_flag(&ok_seen))
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
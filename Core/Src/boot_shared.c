@@ -0,0 +1,86 @@
+/**
+  ******************************************************************************
+  * @file    boot_shared.c
+  * @brief   Bootloader side of the application/bootloader shared RAM.
+  ******************************************************************************
+  */
+
+#include "boot_shared.h"
+#include "app_metadata.h"
+#include "boot_timing.h"
+#include "bootloader_download.h"
+#include "stephano.h"
+#include "transport_ble.h"
+#include "main.h"
+#include <string.h>
+
+_Static_assert(sizeof(boot_shared_t) <= BOOT_SHARED_SIZE, "boot_shared_t outgrew BOOT_SHARED_SIZE");
+_Static_assert(offsetof(boot_handoff_t, check) % 4 == 0, "boot_handoff_t check must be word aligned");
+
+boot_request_t BootShared_TakeRequest(void)
+{
+    volatile boot_mailbox_t *mb = &BOOT_SHARED->mailbox;
+    uint32_t csr = RCC->CSR;
+    boot_request_t request = BOOT_REQUEST_NONE;
+
+    /* Read only: the flags stay set for the application, which may read
+       RCC->CSR itself and clear them when it likes. A copy goes in the
+       mailbox too, where it is valid on every boot, handoff or not. */
+    mb->reset_flags = csr;
+
+    if ((csr & RCC_CSR_SFTRSTF) && mb->magic == BOOT_MAILBOX_MAGIC
+        && mb->check == ~(mb->magic ^ mb->request))
+        request = (boot_request_t)mb->request;
+
+    mb->magic = 0;
+    mb->request = BOOT_REQUEST_NONE;
+
+    /* Whatever the last jump handed over is stale now. */
+    BOOT_SHARED->handoff.magic = 0;
+    return request;
+}
+
+void BootShared_WriteHandoff(uint32_t image_address, const uint8_t *meta)
+{
+    /* Built in a local copy: the region is volatile and the check is over
+       the finished block. */
+    boot_handoff_t h;
+    const boot_timing_record_t *records;
+    uint32_t count, first, i;
+
+    memset(&h, 0, sizeof(h));
+    h.magic = BOOT_HANDOFF_MAGIC;
+    h.version = BOOT_HANDOFF_VERSION;
+    h.size = sizeof(boot_handoff_t);
+    h.image_address = image_address;
+    memcpy(&h.image_size, meta + APP_METADATA_OFFSET_SIZE, 4);
+    memcpy(h.image_sha256, meta + APP_METADATA_OFFSET_SHA256, sizeof(h.image_sha256));
+    h.reset_flags = BOOT_SHARED->mailbox.reset_flags;
+
+    if (Bootloader_GetWellId(&h.well_id))
+        h.flags |= BOOT_HANDOFF_WELL_ID_VALID;
+    if (TransportBle_GetMac(h.ble_mac))
+        h.flags |= BOOT_HANDOFF_BLE_MAC_VALID;
+    if (Stephano_IsPowered())
+        h.flags |= BOOT_HANDOFF_STEPHANO_POWERED;
+    if (Stephano_IsConfigured())
+        h.flags |= BOOT_HANDOFF_STEPHANO_CONFIGURED;
+    if (TransportBle_Connected())
+        h.flags |= BOOT_HANDOFF_BLE_CONNECTED;
+    if (meta[APP_METADATA_OFFSET_VALIDATION + 4] == 0x00
+        && meta[APP_METADATA_OFFSET_VALIDATION + 7] == 0xFF)
+        h.flags |= BOOT_HANDOFF_TRIAL;
+
+    count = BootTiming_GetRecords(false, &records);
+    first = (count > BOOT_HANDOFF_TIMING_MAX) ? count - BOOT_HANDOFF_TIMING_MAX : 0;
+    for (i = first; i < count; ++i) {
+        h.timing[i - first].phase = records[i].phase;
+        h.timing[i - first].time_us = (records[i].time_us > 0xFFFFFFFFu)
+                                      ? 0xFFFFFFFFu : (uint32_t)records[i].time_us;
+    }
+    h.timing_count = count - first;
+    h.check = BootShared_HandoffCheck(&h);
+
+    for (i = 0; i < sizeof(h) / 4; ++i)
+        ((volatile uint32_t *)&BOOT_SHARED->handoff)[i] = ((const uint32_t *)&h)[i];
+}
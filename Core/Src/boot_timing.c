@@ -0,0 +1,213 @@
+/**
+  ******************************************************************************
+  * @file    boot_timing.c
+  * @brief   Boot and session phase timestamps in a no-init RAM table.
+  ******************************************************************************
+  */
+
+#include "boot_timing.h"
+#include "main.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BOOT_TIMING_MAGIC     0x54494D32  /* "TIM2": 64-bit time_us layout */
+
+/* Gaps longer than this are taken from the HAL tick: CYCCNT wraps after
+   ~51 s at 84 MHz, the tick does not. */
+#define CYCLE_SPAN_LIMIT_MS   30000
+
+typedef struct {
+    uint32_t count;
+    uint32_t dropped;
+    boot_timing_record_t records[BOOT_TIMING_MAX_RECORDS];
+} boot_timing_bank_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t current;          /* index of this boot's bank */
+    uint32_t last_cycles;
+    uint32_t last_tick;
+    uint64_t elapsed_us;
+    boot_timing_bank_t bank[2];
+} boot_timing_table_t;
+
+/* Not zeroed by the startup code; validated by magic in BootTiming_Init(). */
+__attribute__((section(".noinit")))
+static boot_timing_table_t timing;
+
+static const char *const PHASE_NAMES[BOOT_PHASE_COUNT] = {
+    "RESET",
+    "HAL_INIT",
+    "SCAN_DOWNLOAD",
+    "VERIFY_DOWNLOAD",
+    "SCAN_CURRENT",
+    "VERIFY_CURRENT",
+    "JUMP",
+    "STEPHANO_POWER_OFF",
+    "STEPHANO_POWER_ON",
+    "STEPHANO_RESET",
+    "STEPHANO_WAIT_READY",
+    "AT_RESTORE",
+    "AT_UART_CUR",
+    "AT_BLEINIT",
+    "AT_BLEADDR",
+    "AT_GATTS_CREATE",
+    "AT_GATTS_START",
+    "AT_BLENAME",
+    "AT_ADVDATA",
+    "ADVERTISING",
+    "BLE_CONNECTED",
+    "BLE_LINK_TUNE",
+    "SPP_READY",
+    "HANDSHAKE",
+    "WSM_BL",
+    "WSM_APP",
+    "PARAMS",
+    "DL_ERASE",
+    "DL_TRANSFER",
+    "DL_COMPLETE",
+    "SESSION_END",
+};
+
+void BootTiming_Init(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    if (timing.magic == BOOT_TIMING_MAGIC && timing.current <= 1 &&
+        timing.bank[timing.current].count <= BOOT_TIMING_MAX_RECORDS) {
+        timing.current ^= 1;
+    } else {
+        memset(&timing, 0, sizeof(timing));
+        timing.magic = BOOT_TIMING_MAGIC;
+    }
+    timing.bank[timing.current].count = 0;
+    timing.bank[timing.current].dropped = 0;
+    timing.last_cycles = 0;
+    timing.last_tick = 0;
+    timing.elapsed_us = 0;
+
+    BootTiming_Mark(BOOT_PHASE_RESET);
+}
+
+uint32_t BootTiming_Cycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+uint32_t BootTiming_CyclesToUs(uint32_t cycles)
+{
+    uint32_t mhz = SystemCoreClock / 1000000U;
+    return (mhz != 0) ? cycles / mhz : 0;
+}
+
+/* Fold the time since the last mark or resync into elapsed_us, at the
+   clock in force since then. Interrupts off. */
+static void accumulate(uint32_t cycles, uint32_t tick)
+{
+    if (tick - timing.last_tick > CYCLE_SPAN_LIMIT_MS)
+        timing.elapsed_us += (uint64_t)(tick - timing.last_tick) * 1000U;
+    else
+        timing.elapsed_us += BootTiming_CyclesToUs(cycles - timing.last_cycles);
+    timing.last_cycles = cycles;
+    timing.last_tick = tick;
+}
+
+void BootTiming_Resync(void)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    accumulate(DWT->CYCCNT, HAL_GetTick());
+    __set_PRIMASK(primask);
+}
+
+void BootTiming_AddSleep(uint32_t ms)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    /* CYCCNT stood still; move last_tick on with the tick so the next
+       fold neither counts the sleep twice nor takes the tick path. */
+    __disable_irq();
+    timing.elapsed_us += (uint64_t)ms * 1000U;
+    timing.last_tick += ms;
+    __set_PRIMASK(primask);
+}
+
+void BootTiming_Mark(boot_phase_t phase)
+{
+    boot_timing_bank_t *bank = &timing.bank[timing.current & 1];
+    uint32_t primask = __get_PRIMASK();
+    uint32_t cycles, tick;
+
+    /* Also marked from SysTick (Stephano power-up sequence). */
+    __disable_irq();
+    cycles = DWT->CYCCNT;
+    tick = HAL_GetTick();
+    accumulate(cycles, tick);
+
+    if (bank->count >= BOOT_TIMING_MAX_RECORDS) {
+        bank->dropped++;
+    } else {
+        bank->records[bank->count].phase = (uint16_t)phase;
+        bank->records[bank->count].reserved = 0;
+        bank->records[bank->count].tick_ms = tick;
+        bank->records[bank->count].cycles = cycles;
+        bank->records[bank->count].time_us = timing.elapsed_us;
+        bank->count++;
+    }
+    __set_PRIMASK(primask);
+}
+
+uint32_t BootTiming_GetRecords(bool previous, const boot_timing_record_t **records)
+{
+    const boot_timing_bank_t *bank = &timing.bank[(timing.current ^ (previous ? 1 : 0)) & 1];
+    uint32_t count = bank->count;
+
+    if (count > BOOT_TIMING_MAX_RECORDS)
+        count = 0;
+    if (records != NULL)
+        *records = bank->records;
+    return count;
+}
+
+const char *BootTiming_PhaseName(uint16_t phase)
+{
+    return (phase < BOOT_PHASE_COUNT) ? PHASE_NAMES[phase] : "UNKNOWN";
+}
+
+/* Decimal uint64 without printf's %llu, which newlib-nano lacks. */
+static void format_us(char *buf, size_t size, uint64_t us)
+{
+    uint32_t s = (uint32_t)(us / 1000000U);
+
+    if (s != 0)
+        snprintf(buf, size, "%lu%06lu", (unsigned long)s, (unsigned long)(us % 1000000U));
+    else
+        snprintf(buf, size, "%lu", (unsigned long)us);
+}
+
+void BootTiming_Report(void (*emit)(const char *line))
+{
+    static const char *const BOOT_LABEL[2] = { "this", "prev" };
+    char line[80];
+    char us[24];
+    int b;
+
+    if (emit == NULL) return;
+
+    for (b = 1; b >= 0; b--) {
+        const boot_timing_record_t *rec;
+        uint32_t count = BootTiming_GetRecords(b == 1, &rec);
+        uint32_t i;
+        for (i = 0; i < count; i++) {
+            format_us(us, sizeof(us), rec[i].time_us);
+            snprintf(line, sizeof(line), "TIMING %s %lu %s %s %lu",
+                     BOOT_LABEL[b], (unsigned long)i, BootTiming_PhaseName(rec[i].phase),
+                     us, (unsigned long)rec[i].tick_ms);
+            emit(line);
+        }
+    }
+    emit("TIMING END");
+}
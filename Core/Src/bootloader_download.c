@@ -1,41 +1,48 @@
 /**
   ******************************************************************************
   * @file    bootloader_download.c
-  * @brief   BLE download via Stephano-I: WSM↔PC protocol (plain ASCII).
+  * @brief   Download engine: WSM↔PC protocol (plain ASCII) over a transport_t.
   ******************************************************************************
   */
 
 #include "bootloader_download.h"
+#include "bootloader_logic.h"
 #include "app_metadata.h"
 #include "flash_ops.h"
 #include "at_command.h"
 #include "main.h"
 #include "sha256.h"
+#include "boot_timing.h"
+#include "session_stats.h"
+#include "param_store.h"
+#include "param_sync.h"
+#include "events.h"
+#include "transport_ble.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#ifndef BOOTLOADER_DEBUG_ENABLE
 #define BOOTLOADER_DEBUG_ENABLE 1
+#endif
 
-#define DOWNLOAD_BUFFER_SIZE  4096
-#define LINE_BUFFER_SIZE      128
+/* Application-level credits, opt-in: a PC that sends "WSM CREDITS" gets
+   "CREDITS <window>" (the transport's receive buffer) and, from the next
+   "DL READY" on, consumed bytes back in "CREDIT <n>" lines once at least
+   CREDIT_GRANT_THRESHOLD have accumulated. Without it the exchange is the
+   plain one: "DL READY", then "DATA OK" per packet. */
+#define CREDIT_GRANT_THRESHOLD  1024
+#define LINE_BUFFER_SIZE      PARAM_SYNC_LINE_MAX   /* a NAME=VALUE line */
+/* The parameter phase ends on its own this long after the last line from
+   the PC: a PC that does not know it never answers "WSM PARAMS". */
+#define PARAMS_TIMEOUT_MS     10000
 #define APP_VERSION_NONE      "0.0.0"
 
-/* WELL_ID storage in sector 1 (0x08004000) */
-#define STORED_PARAMS_FLASH_SECTOR FLASH_SECTOR_3
-#define WELL_ID_STORAGE_ADDR  0x0800C000
-#define WELL_ID_MAGIC         0x57454C4C  /* "WELL" */
-
 #include "stm32f4xx_hal_uart.h"
 extern UART_HandleTypeDef huart1;
 
 typedef enum {
-    DL_STATE_STEPHANO_POWER,
-    DL_STATE_WAIT_READY,
-    DL_STATE_AT_RESTORE,
-    DL_STATE_AT_CFG,
-    DL_STATE_WE_SPP_SETUP,
-    DL_STATE_WAIT_CONNECT,
+    DL_STATE_OPEN_LINK,
 	DL_STATE_CONNECTED,
     DL_STATE_SEND_WSM_ID,
     DL_STATE_WAIT_ID_RESP,
@@ -47,34 +54,34 @@ typedef enum {
     DL_STATE_SEND_WSM_APP,
     DL_STATE_WAIT_APP_RESP,
     DL_STATE_APP_DOWNLOAD,
+    DL_STATE_SEND_PARAMS,
+    DL_STATE_WAIT_PARAMS,
     DL_STATE_ERROR
 } dl_state_t;
 
-static dl_state_t dl_state = DL_STATE_STEPHANO_POWER;
-static uint8_t rx_buffer[DOWNLOAD_BUFFER_SIZE];
-static uint16_t rx_head = 0;
-static uint16_t rx_count = 0;
+static dl_state_t dl_state = DL_STATE_OPEN_LINK;
+static const transport_t *dl_link = NULL; /* set by Bootloader_SetTransport, BLE by default */
+static uint32_t rx_consumed = 0;          /* bytes read from the link this session */
+static uint32_t credit_granted = 0;       /* rx_consumed last credited to the PC */
+static bool credits_enabled = false;      /* the PC sent "WSM CREDITS" */
 static uint8_t line_buffer[LINE_BUFFER_SIZE];
 static uint16_t line_len = 0;
 static uint32_t download_size = 0;
 static uint32_t download_received = 0;
 static uint16_t expected_packet = 0;
 static bool downloading_bootloader = false;
+static bool download_complete = false;    /* the image is in, parameters next */
+static uint32_t params_since = 0;         /* last PC line of the parameter phase */
 
-static uint8_t uart_rx_byte;
-
-#define MAC_BUF_SIZE 20
-static char mac_buf[MAC_BUF_SIZE] = "00:00:00:00:00:00";
 static uint16_t well_id = 0;
 static bool have_stored_well_id = false;
+static uint32_t idle_timeout_ms = 0;      /* Bootloader_SetIdleTimeout, 0 = none */
+static uint32_t idle_mark = 0;            /* rx_consumed at idle_since */
+static uint32_t idle_since = 0;
 
 static void dying_gasp(const char *msg);
-static void Stephano_PowerOn(void);
-static void Stephano_Reset(void);
-static bool wait_for_ready(uint32_t timeout_ms);
 static void get_bootloader_version(char *buf, size_t len);
 static void get_app_version(char *buf, size_t len);
-static void get_mac_from_module(void);
 static void read_stored_well_id(void);
 static void save_well_id(uint16_t id);
 static void handle_id_response(const char *line);
@@ -82,7 +89,10 @@ static void handle_wsm_id_response(const char *line);
 static bool parse_line(const char *line);
 static void handle_bl_response(const char *line);
 static void handle_app_response(const char *line);
+static void handle_params_response(const char *line);
 static void process_rx_data(void);
+static void end_session(bool success);
+static bool installs_in_place(void);
 
 static void dying_gasp(const char *msg)
 {
@@ -97,52 +107,19 @@ static void dying_gasp(const char *msg)
   }
 #endif
 
-    HAL_UART_Transmit(STEPHANO_UART_PTR, (uint8_t *)buf, (uint16_t)n, 1000);
+    if (dl_state > DL_STATE_OPEN_LINK && dl_state != DL_STATE_ERROR)
+        end_session(false);
+    if (dl_link != NULL)
+        (void)dl_link->write((const uint8_t *)buf, (uint32_t)n);
     HAL_Delay(100);
+    /* A bounded session goes back to the image it was asked from; the
+       reset is for when that does not verify. */
+    if (idle_timeout_ms != 0)
+        Bootloader_BootCurrent();
     __disable_irq();
     NVIC_SystemReset();
 }
 
-static void Stephano_PowerOn(void)
-{
-    HAL_GPIO_WritePin(n_STEPHANO_ON_GPIO_Port, n_STEPHANO_ON_Pin, GPIO_PIN_RESET);
-    HAL_Delay(500);
-}
-
-static void Stephano_PowerOff(void)
-{
-    HAL_GPIO_WritePin(n_STEPHANO_ON_GPIO_Port, n_STEPHANO_ON_Pin, GPIO_PIN_SET);
-    HAL_Delay(500);
-}
-
-static void Stephano_Reset(void)
-{
-    HAL_GPIO_WritePin(n_STEPHANO_RST_GPIO_Port, n_STEPHANO_RST_Pin, GPIO_PIN_RESET);
-    HAL_Delay(500);
-    HAL_GPIO_WritePin(n_STEPHANO_RST_GPIO_Port, n_STEPHANO_RST_Pin, GPIO_PIN_SET);
-}
-
-static bool wait_for_ready(uint32_t timeout_ms)
-{
-    uint8_t buf[40];
-    memset(buf, 0, 40);
-
-    for (int attempt = 0; attempt < 10; ++ attempt)
-    {
-    	HAL_UART_Receive(STEPHANO_UART_PTR, buf, 7, timeout_ms);
-#if BOOTLOADER_DEBUG_ENABLE
-    	{
-    		char dbg_msg[128];
-    		int len = snprintf(dbg_msg, sizeof(dbg_msg), "%s -> '%s'\r\n", __FUNCTION__, (char*) buf);
-    		HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
-    	}
-#endif
-    	if (strstr((char*) buf, "ready") != NULL) return true;
-    }
-
-    return false;
-}
-
 static void get_bootloader_version(char *buf, size_t len)
 {
     const uint8_t *meta = (const uint8_t *)_app_metadata_start;
@@ -168,7 +145,7 @@ static const uint8_t *find_metadata_in_sector(uint32_t sector_addr, uint32_t sec
 
 static void get_app_version(char *buf, size_t len)
 {
-    const uint8_t *meta = find_metadata_in_sector(FLASH_SECTOR_7_ADDRESS, FLASH_SECTOR_SIZE_6_7);
+    const uint8_t *meta = find_metadata_in_sector(Flash_SectorAddress(Bootloader_ActiveSlot()), FLASH_SECTOR_SIZE_6_7);
     if (meta != NULL) {
         size_t i;
         for (i = 0; i < 8 && meta[APP_METADATA_OFFSET_VERSION + i] != 0; i++)
@@ -180,43 +157,13 @@ static void get_app_version(char *buf, size_t len)
     }
 }
 
-/* Extract MAC from AT+BLEADDR? response (Stephano-I BLE address). */
-static void get_mac_from_module(void)
-{
-    char resp[AT_MAX_RESPONSE_LEN];
-    if (AT_SendCommand("AT+BLEADDR?", resp, sizeof(resp), 3000, true) != AT_OK) {
-        strncpy(mac_buf, "00:00:00:00:00:00", MAC_BUF_SIZE - 1);
-        mac_buf[MAC_BUF_SIZE - 1] = '\0';
-        return;
-    }
-    /* +BLEADDR:xx:xx:xx:xx:xx:xx or +BLEADDR:"xx:xx:xx:xx:xx:xx" */
-    const char *p = strstr(resp, "+BLEADDR:");
-    if (p != NULL) {
-        p += 9; /* skip "+BLEADDR:" */
-        if (*p == '"') p++; /* skip optional quote */
-    } else {
-        p = resp;
-    }
-    while (*p && !((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F'))) p++;
-    size_t i = 0;
-    while (*p && ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F') || (*p == ':')) && i < MAC_BUF_SIZE - 1) {
-        mac_buf[i++] = *p++;
-    }
-    mac_buf[i] = '\0';
-    if (i == 0) {
-        strncpy(mac_buf, "00:00:00:00:00:00", MAC_BUF_SIZE - 1);
-        mac_buf[MAC_BUF_SIZE - 1] = '\0';
-    }
-}
-
 static void read_stored_well_id(void)
 {
-    uint32_t magic;
-    uint8_t buf[6];
-    Flash_ReadData(WELL_ID_STORAGE_ADDR, buf, 6);
-    magic = (uint32_t)buf[0] | ((uint32_t)buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
-    if (magic == WELL_ID_MAGIC) {
-        well_id = (uint16_t)buf[4] | ((uint16_t)buf[5] << 8);
+    uint16_t id;
+    uint32_t len;
+
+    if (ParamStore_Get(PARAM_WELL_ID, &id, sizeof(id), &len) && len == sizeof(id)) {
+        well_id = id;
         have_stored_well_id = true;
     } else {
         well_id = 0;
@@ -224,42 +171,22 @@ static void read_stored_well_id(void)
     }
 }
 
+/* An unchanged ID costs no flash write. */
 static void save_well_id(uint16_t id)
 {
-    uint8_t buf[8];
-    buf[0] = (uint8_t)(WELL_ID_MAGIC);
-    buf[1] = (uint8_t)(WELL_ID_MAGIC >> 8);
-    buf[2] = (uint8_t)(WELL_ID_MAGIC >> 16);
-    buf[3] = (uint8_t)(WELL_ID_MAGIC >> 24);
-    buf[4] = (uint8_t)(id);
-    buf[5] = (uint8_t)(id >> 8);
-    buf[6] = 0xFF;
-    buf[7] = 0xFF;
-    if (!Flash_EraseSector(STORED_PARAMS_FLASH_SECTOR))
+    if (!ParamStore_Set(PARAM_WELL_ID, &id, sizeof(id)))
         return;
-    Flash_WriteData(WELL_ID_STORAGE_ADDR, buf, 8);
     well_id = id;
     have_stored_well_id = true;
 }
 
-/* Add byte to rx buffer (from UART callback). */
-void Bootloader_RxByte(uint8_t b)
-{
-    if (rx_count < DOWNLOAD_BUFFER_SIZE) {
-        uint16_t wi = (rx_head + rx_count) % DOWNLOAD_BUFFER_SIZE;
-        rx_buffer[wi] = b;
-        rx_count++;
-    }
-}
-
 /* Extract a complete line (up to \r\n) into line_buffer. Returns true if line complete. */
 static bool extract_line(void)
 {
-    while (rx_count > 0) {
-        uint8_t b = rx_buffer[rx_head];
-        rx_head = (rx_head + 1) % DOWNLOAD_BUFFER_SIZE;
-        rx_count--;
+    uint8_t b;
 
+    while (dl_link->read(&b, 1) == 1) {
+        rx_consumed++;
         if (b == '\n') {
             line_buffer[line_len] = '\0';
             line_len = 0;
@@ -276,36 +203,93 @@ static bool extract_line(void)
     return false;
 }
 
-/* Send string to PC. */
+/* Send string to PC. The line and its CRLF go out in one piece so that
+   packet links (GATT, TCP) carry them in a single write. */
 static void send_line(const char *s)
 {
+    char buf[256];
     size_t len = strlen(s);
-    HAL_UART_Transmit(STEPHANO_UART_PTR, (uint8_t *)s, (uint16_t)len, 2000);
-    HAL_UART_Transmit(STEPHANO_UART_PTR, (uint8_t *)"\r\n", 2, 500);
+
+    if (len > sizeof(buf) - 2)
+        len = sizeof(buf) - 2;
+    memcpy(buf, s, len);
+    buf[len++] = '\r';
+    buf[len++] = '\n';
+    (void)dl_link->write((const uint8_t *)buf, (uint32_t)len);
 }
 
-/* When remote connects, Stephano sends +BLECONN URC. Respond with AT+BLECONN:0,<MAC>,
-   then AT+BLESPPCFG and AT+BLESPP per StephanoI_ATcommands.pdf page 5 steps 6-11. */
-static void handle_ble_conn_urc(const char *line)
+/* Report this session's statistics to the PC and append them to the
+   on-device ring. Called once, right before the session's reset. */
+static void end_session(bool success)
 {
-    if (dl_state != DL_STATE_WAIT_CONNECT || strstr(line, "+BLECONN") == NULL)
-        return;
+    char buf[240];
+    transport_stats_t link_stats;
+    session_kind_t kind = SESSION_KIND_NONE;
+
+    if (downloading_bootloader)
+        kind = SESSION_KIND_BL;
+    else if (dl_state == DL_STATE_APP_DOWNLOAD || download_complete)
+        kind = SESSION_KIND_APP;
+
+    SessionStats_SetAtRetries(AT_GetRetryCount());
+    dl_link->get_stats(&link_stats);
+    SessionStats_SetOverruns(link_stats.rx_overruns);
+    SessionStats_Finish();
+    SessionStats_Format(buf, sizeof(buf));
+    send_line(buf);
+    /* A failed session ends in dying_gasp(), often over a flash error:
+       leave the flash alone there and write the record next boot. */
+    if (success)
+        (void)SessionStats_Persist(well_id, kind, true);
+    else
+        SessionStats_Defer(well_id, kind);
+}
 
-    HAL_UART_AbortReceive_IT(STEPHANO_UART_PTR);
+/* "WSM CREDITS": the PC can handle "CREDIT" lines; tell it the window. */
+static void credit_enable(void)
+{
+    transport_stats_t link_stats;
+    char buf[24];
 
-    char bleconn_cmd[64];
-    snprintf(bleconn_cmd, sizeof(bleconn_cmd), "AT+BLECONN:0,%s", mac_buf);
-    if (AT_SendCommand(bleconn_cmd, NULL, 0, 2000, true) != AT_OK)
-        dying_gasp("AT+BLECONN failed");
+    dl_link->get_stats(&link_stats);
+    credits_enabled = true;
+    snprintf(buf, sizeof(buf), "CREDITS %lu", (unsigned long)link_stats.rx_window);
+    send_line(buf);
+}
 
-    if (AT_SendCommand("AT+BLESPPCFG=1,1,2,1,1,0", NULL, 0, 2000, true) != AT_OK)
-        dying_gasp("AT+BLESPPCFG failed");
+/* At "DL READY": everything consumed from now on is returned. */
+static void credit_start(void)
+{
+    credit_granted = rx_consumed;
+}
 
-    if (AT_SendCommand("AT+BLESPP", NULL, 0, 2000, true) != AT_OK)
-        dying_gasp("AT+BLESPP failed");
+/* Return consumed buffer space to the PC. Every byte it sends (header lines
+   and payload) costs one credit. */
+static void credit_update(void)
+{
+    uint32_t consumed;
+    char buf[24];
 
-    HAL_UART_Receive_IT(STEPHANO_UART_PTR, &uart_rx_byte, 1);
-    dl_state = have_stored_well_id ? DL_STATE_SEND_WSM_ID : DL_STATE_SEND_WSM_MAC;
+    if (!credits_enabled)
+        return;
+    if (dl_state != DL_STATE_BL_DOWNLOAD && dl_state != DL_STATE_APP_DOWNLOAD)
+        return;
+    consumed = rx_consumed - credit_granted;
+    if (consumed < CREDIT_GRANT_THRESHOLD)
+        return;
+    snprintf(buf, sizeof(buf), "CREDIT %lu", (unsigned long)consumed);
+    send_line(buf);
+    credit_granted += consumed;
+}
+
+/* "WSM LINK <transport-specific KEY=value ...>" */
+static void report_link(void)
+{
+    char buf[160];
+    size_t n = (size_t)snprintf(buf, sizeof(buf), "WSM LINK ");
+
+    dl_link->link_info(buf + n, sizeof(buf) - n);
+    send_line(buf);
 }
 
 static void handle_id_response(const char *line)
@@ -324,8 +308,7 @@ static void handle_wsm_id_response(const char *line)
     if (dl_state == DL_STATE_WAIT_WSM_ID && strncmp(line, "WSM ID ", 7) == 0) {
         unsigned int id_val;
         if (sscanf(line + 7, "%u", &id_val) == 1 && id_val <= 0xFFFF) {
-            well_id = (uint16_t)id_val;
-            save_well_id(well_id);
+            save_well_id((uint16_t)id_val);
             dl_state = DL_STATE_SEND_WSM_BL;
         }
     }
@@ -333,14 +316,28 @@ static void handle_wsm_id_response(const char *line)
 
 static bool parse_line(const char *line)
 {
-    if (dl_state == DL_STATE_WAIT_CONNECT) {
-        handle_ble_conn_urc(line);
+    if (strcmp(line, "WSM TIMING") == 0) {
+        BootTiming_Report(send_line);
+        return true;
+    }
+    if (strcmp(line, "WSM CREDITS") == 0) {
+        credit_enable();
+        return true;
+    }
+    if (strcmp(line, "WSM STATS") == 0) {
+        SessionStats_ReportLog(send_line);
+        return true;
+    }
+    if (strcmp(line, "WSM LINK") == 0) {
+        report_link();
         return true;
     }
     if (dl_state == DL_STATE_WAIT_ID_RESP)
         handle_id_response(line);
     else if (dl_state == DL_STATE_WAIT_WSM_ID)
         handle_wsm_id_response(line);
+    else if (dl_state == DL_STATE_WAIT_PARAMS)
+        handle_params_response(line);
     else if (downloading_bootloader)
         handle_bl_response(line);
     else if (dl_state == DL_STATE_APP_DOWNLOAD)
@@ -359,7 +356,7 @@ static void handle_bl_response(const char *line)
             dl_state = DL_STATE_SEND_WSM_APP;
             return;
         }
-        if (strcmp(line, "WSM BL ") == 0) {
+        if (strncmp(line, "WSM BL ", 7) == 0) {
             unsigned int size_val = 0;
             char new_ver[16] = {0};
             int n = sscanf(line + 7, "%15s %u", new_ver, &size_val);
@@ -368,11 +365,27 @@ static void handle_bl_response(const char *line)
                     send_line("BL DL ERROR");
                     dying_gasp("New bootloader too large");
                 }
-                if (!Flash_EraseSector(FLASH_SECTOR_DOWNLOAD)) {
+#if BOOTLOADER_AB_SLOTS
+                /* The first stage installs bootloaders from sector 6 only. */
+                if (Flash_GetDownloadSector() != FLASH_SECTOR_DOWNLOAD) {
+                    send_line("BL DL ERROR");
+                    dying_gasp("Sector 6 holds the running application");
+                }
+#else
+                /* Direct provisioning may have pointed downloads at sector 7. */
+                Flash_SelectDownloadSector(FLASH_SECTOR_DOWNLOAD);
+#endif
+                BootTiming_Mark(BOOT_PHASE_DL_ERASE);
+                uint32_t erase_start = BootTiming_Cycles();
+                if (!Flash_EraseDownloadSector()) {
                     send_line("BL DL ERROR");
                     dying_gasp("Failed to erase sector 6");
                 }
+                SessionStats_AddFlashErase(BootTiming_Cycles() - erase_start);
+                credit_start();
                 send_line("BL DL READY");
+                BootTiming_Mark(BOOT_PHASE_DL_TRANSFER);
+                SessionStats_TransferStart();
                 download_size = size_val;
                 download_received = 0;
                 expected_packet = 0;
@@ -389,12 +402,11 @@ static void handle_app_response(const char *line)
 {
     if (dl_state == DL_STATE_WAIT_APP_RESP) {
         if (strcmp(line, "WSM APP OK") == 0) {
-            /* Done - reboot to let stage-1 run */
-            HAL_Delay(100);
-            NVIC_SystemReset();
+            /* Nothing to install: the configuration parameters are next. */
+            dl_state = DL_STATE_SEND_PARAMS;
             return;
         }
-        if (strcmp(line, "WSM APP ") == 0) {
+        if (strncmp(line, "WSM APP ", 8) == 0) {
             unsigned int size_val = 0;
             char new_ver[16] = {0};
             int n = sscanf(line + 8, "%15s %u", new_ver, &size_val);
@@ -403,11 +415,17 @@ static void handle_app_response(const char *line)
                     send_line("APP DL ERROR");
                     dying_gasp("New application too large");
                 }
-                if (!Flash_EraseSector(FLASH_SECTOR_DOWNLOAD)) {
+                BootTiming_Mark(BOOT_PHASE_DL_ERASE);
+                uint32_t erase_start = BootTiming_Cycles();
+                if (!Flash_EraseDownloadSector()) {
                     send_line("APP DL ERROR");
-                    dying_gasp("Failed to erase sector 6");
+                    dying_gasp("Failed to erase download sector");
                 }
+                SessionStats_AddFlashErase(BootTiming_Cycles() - erase_start);
+                credit_start();
                 send_line("APP DL READY");
+                BootTiming_Mark(BOOT_PHASE_DL_TRANSFER);
+                SessionStats_TransferStart();
                 download_size = size_val;
                 download_received = 0;
                 expected_packet = 0;
@@ -420,21 +438,67 @@ static void handle_app_response(const char *line)
 
 }
 
+/* DONE, then on to an image: a download that is not installed in place
+   goes to the first stage through a reset. Anything else hands over to
+   the current application with the radio still up and reboots only if it
+   does not verify. */
+static void finish_session(void)
+{
+    BootTiming_Mark(BOOT_PHASE_SESSION_END);
+    end_session(true);
+    send_line("DONE");
+    HAL_Delay(100);
+    if (!download_complete || installs_in_place())
+        Bootloader_BootCurrent();
+    NVIC_SystemReset();
+}
+
+/* Parameter phase (param_sync.h), after "WSM APP OK" or a finished
+   download. The PC either confirms the digest or sends what differs;
+   DONE closes the session either way. */
+static void handle_params_response(const char *line)
+{
+    char reply[48];
+
+    params_since = HAL_GetTick();
+    if (strcmp(line, "PARAMS OK") == 0 || strcmp(line, "PARAMS END") == 0) {
+        finish_session();
+        return;
+    }
+    if (strcmp(line, "PARAMS LIST") == 0) {
+        ParamSync_List(send_line);
+        return;
+    }
+    if (ParamSync_Apply(line, reply, sizeof(reply)))
+        send_line(reply);
+}
+
 /* Process BL DATA / APP DATA binary payload. The line "BL DATA N SIZE" has been
-   consumed; remaining bytes in rx_buffer are the payload. We need to accumulate
+   consumed; remaining bytes on the link are the payload. We need to accumulate
    until we have the full payload for the current packet. For simplicity we handle
    one packet per line: the protocol sends "BL DATA N SIZE\r\n" then SIZE bytes.
    So we need a state: waiting for payload, payload_size, payload_received. */
 static uint32_t pending_payload_size = 0;
 static uint32_t pending_payload_received = 0;
 
+/* The application image was written where it runs (A/B slot, or sector 7
+   under direct provisioning): it is committed here, not by the first stage. */
+static bool installs_in_place(void)
+{
+    return !downloading_bootloader
+        && (BOOTLOADER_AB_SLOTS || Flash_GetDownloadSector() == FLASH_SECTOR_CURRENT);
+}
+
 #define FLASH_CHUNK 256
 static uint8_t flash_chunk_buf[FLASH_CHUNK];
 static uint16_t flash_chunk_len = 0;
 
 static void flush_flash_chunk(void)
 {
+    uint32_t program_start;
+
     if (flash_chunk_len == 0) return;
+    program_start = BootTiming_Cycles();
     if (!Flash_ProgramFirmwareData(download_received, flash_chunk_buf, flash_chunk_len)) {
         if (downloading_bootloader)
             send_line("BL DATA ERROR");
@@ -442,6 +506,7 @@ static void flush_flash_chunk(void)
             send_line("APP DATA ERROR");
         dying_gasp("Flash program failed");
     }
+    SessionStats_AddFlashProgram(BootTiming_Cycles() - program_start);
     download_received += flash_chunk_len;
     flash_chunk_len = 0;
 }
@@ -450,13 +515,16 @@ static void process_binary_payload(void)
 {
     if (pending_payload_size == 0) return;
 
-    while (rx_count > 0 && pending_payload_received < pending_payload_size) {
-        uint8_t b = rx_buffer[rx_head];
-        rx_head = (rx_head + 1) % DOWNLOAD_BUFFER_SIZE;
-        rx_count--;
+    while (dl_link->available() > 0 && pending_payload_received < pending_payload_size) {
+        uint32_t want = pending_payload_size - pending_payload_received;
 
-        flash_chunk_buf[flash_chunk_len++] = b;
-        pending_payload_received++;
+        /* Bulk copy straight into the flash chunk buffer. */
+        if (want > (uint32_t)(FLASH_CHUNK - flash_chunk_len))
+            want = FLASH_CHUNK - flash_chunk_len;
+        want = dl_link->read(&flash_chunk_buf[flash_chunk_len], want);
+        rx_consumed += want;
+        flash_chunk_len += (uint16_t)want;
+        pending_payload_received += want;
 
         if (flash_chunk_len >= FLASH_CHUNK) {
             flush_flash_chunk();
@@ -464,16 +532,27 @@ static void process_binary_payload(void)
 
         if (pending_payload_received >= pending_payload_size) {
             flush_flash_chunk();
+            /* Commit before the last OK and before any reset: the first
+               stage must never find an uncommitted slot image. */
+            if (installs_in_place() && download_received >= download_size
+                && !Bootloader_CommitDownload(Flash_GetDownloadSector())) {
+                send_line("APP DATA ERROR");
+                dying_gasp("Image does not verify for its slot");
+            }
             if (downloading_bootloader)
                 send_line("BL DATA OK");
             else
                 send_line("APP DATA OK");
+            SessionStats_AddPacket(pending_payload_size);
             expected_packet++;
             pending_payload_size = 0;
             pending_payload_received = 0;
             if (download_received >= download_size) {
-                HAL_Delay(100);
-                NVIC_SystemReset();
+                /* Committed above if it runs in place; the reset or the
+                   jump waits for the parameter phase. */
+                BootTiming_Mark(BOOT_PHASE_DL_COMPLETE);
+                download_complete = true;
+                dl_state = DL_STATE_SEND_PARAMS;
             }
             return;
         }
@@ -487,6 +566,8 @@ static void parse_data_line(const char *line)
         unsigned int n_val, size_val;
         if (sscanf(line + 8, "%u %u", &n_val, &size_val) == 2) {
             if (n_val != expected_packet) {
+                if (expected_packet > 0 && n_val + 1 == expected_packet)
+                    SessionStats_AddRetransmit();
                 send_line("BL DATA ERROR");
                 dying_gasp("Unexpected packet number");
                 return;
@@ -498,6 +579,8 @@ static void parse_data_line(const char *line)
         unsigned int n_val, size_val;
         if (sscanf(line + 9, "%u %u", &n_val, &size_val) == 2) {
             if (n_val != expected_packet) {
+                if (expected_packet > 0 && n_val + 1 == expected_packet)
+                    SessionStats_AddRetransmit();
                 send_line("APP DATA ERROR");
                 dying_gasp("Unexpected packet number");
                 return;
@@ -522,167 +605,79 @@ static void process_rx_data(void)
         }
         parse_line(line);
     }
+    credit_update();
 }
 
-void Bootloader_ConnectToServer(void)
+bool Bootloader_GetWellId(uint16_t *id)
 {
-	char response_bufr[AT_MAX_RESPONSE_LEN] = { 0 };
-    rx_head = 0;
-    rx_count = 0;
-    line_len = 0;
-    pending_payload_size = 0;
-    pending_payload_received = 0;
-    dl_state = DL_STATE_STEPHANO_POWER;
-
-#if BOOTLOADER_DEBUG_ENABLE
-  {
-    char dbg_msg[128];
-    int len = sprintf(dbg_msg, "%s begin\r\n", __FUNCTION__);
-    HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
-  }
-#endif
-
-    /* Drive CTS low before talking to Stephano */
-/*
-    GPIO_InitTypeDef GPIO_InitStruct = {0};
-
-    GPIO_InitStruct.Pin = STEPHANO_CTS_Pin;
-    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
-    GPIO_InitStruct.Pull = GPIO_NOPULL;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
-    HAL_GPIO_Init(STEPHANO_CTS_GPIO_Port, &GPIO_InitStruct);
-    HAL_GPIO_WritePin(STEPHANO_CTS_GPIO_Port, STEPHANO_CTS_Pin, GPIO_PIN_RESET);
-    HAL_Delay(10);
-    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
-    GPIO_InitStruct.Alternate = GPIO_AF7_USART2;
-    HAL_GPIO_Init(STEPHANO_CTS_GPIO_Port, &GPIO_InitStruct);
-*/
+    read_stored_well_id();
+    *id = well_id;
+    return have_stored_well_id;
+}
 
-#if BOOTLOADER_DEBUG_ENABLE
-  {
-    char dbg_msg[128];
-    int len = sprintf(dbg_msg, "%s Stephano_PowerOff\r\n", __FUNCTION__);
-    HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
-  }
-#endif
-  Stephano_PowerOff();
+void Bootloader_SetTransport(const transport_t *transport)
+{
+    dl_link = transport;
+}
 
-  #if BOOTLOADER_DEBUG_ENABLE
-  {
-    char dbg_msg[128];
-    int len = sprintf(dbg_msg, "%s Stephano_PowerOn\r\n", __FUNCTION__);
-    HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
-  }
-#endif
-  Stephano_PowerOn();
+void Bootloader_SetIdleTimeout(uint32_t ms)
+{
+    idle_timeout_ms = ms;
+}
 
-#if BOOTLOADER_DEBUG_ENABLE
-  {
-    char dbg_msg[128];
-    int len = sprintf(dbg_msg, "%s Stephano_Reset\r\n", __FUNCTION__);
-    HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
-  }
-#endif
-    Stephano_Reset();
+void Bootloader_ConnectToServer(void)
+{
+    const char *error = "Link open failed";
 
-    __HAL_UART_DISABLE(STEPHANO_UART_PTR);
-    __HAL_UART_HWCONTROL_CTS_DISABLE(STEPHANO_UART_PTR);
-    __HAL_UART_ENABLE(STEPHANO_UART_PTR);
+    if (dl_link == NULL)
+        dl_link = TransportBle_Get();
+    rx_consumed = 0;
+    credit_granted = 0;
+    credits_enabled = false;
+    line_len = 0;
+    pending_payload_size = 0;
+    pending_payload_received = 0;
+    downloading_bootloader = false;
+    download_complete = false;
+    dl_state = DL_STATE_OPEN_LINK;
+    SessionStats_Begin();
 
 #if BOOTLOADER_DEBUG_ENABLE
   {
     char dbg_msg[128];
-    int len = sprintf(dbg_msg, "%s wait_for_ready\r\n", __FUNCTION__);
+    int len = sprintf(dbg_msg, "%s begin (%s)\r\n", __FUNCTION__, dl_link->name);
     HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
   }
 #endif
 
-    if (!wait_for_ready(10000))
-        dying_gasp("Stephano Ready timeout");
-
-    if (AT_SendCommand("AT+RESTORE", NULL, 0, 1000, true) != AT_OK)
-        dying_gasp("AT+RESTORE failed");
-
-    if (AT_SendCommand("AT+UART_CUR=115200,8,1,0,1", NULL, 0, 1000, true) != AT_OK)
-        dying_gasp("AT+UART_CUR failed");
-
     read_stored_well_id();
+    Flash_SelectDownloadSector(Bootloader_DownloadSlot());
+    /* Blank-check now; a sector holding data is erased ahead while the
+       radio powers up, so "DL READY" follows the announce at once. */
+    Flash_PrepareDownloadSector(!Bootloader_DownloadSlotInUse());
 
-#if BOOTLOADER_USE_HARDWARE_FLOW_CONTROL
-    __HAL_UART_DISABLE(STEPHANO_UART_PTR);
-    __HAL_UART_HWCONTROL_CTS_ENABLE(STEPHANO_UART_PTR);
-    __HAL_UART_ENABLE(STEPHANO_UART_PTR);
-#endif
-
-    if (AT_SendCommand("AT+BLEINIT=2", NULL, 0, 1000, true) != AT_OK)
-        dying_gasp("AT+BLEINIT=2 failed");
-
-    /* Get Stephano-I BLE MAC address for AT+BLECONN response when remote connects. */
-    get_mac_from_module();
+    if (!dl_link->open(&error)) {
+        if (dl_link == TransportBle_Get())
+            dying_gasp(error);
 
-    if (AT_SendCommand("AT+BLEGATTSSRVCRE", NULL, 0, 1000, true) != AT_OK)
-        dying_gasp("AT+BLEGATTSSRVCRE failed");
-
-/*
-     Configure the SPP Parameters
-    if (AT_SendCommand("AT+BLESPPCFG=1,1,3,1,3", NULL, 0, 2000, true) != AT_OK)
-        dying_gasp("AT+BLEGATTSSRVCRE failed");
-     Entry 1: <srv_index>, <gzip_en>, <tx_char_index>, <rx_char_index>
-     Note: The exact indices depend on the internal GATT table.
-       On Stephano-I, 1,1,3,1,3 is the standard for the built-in SAPP profile
-*/
-
-    if (AT_SendCommand("AT+BLEGATTSSRVSTART", NULL, 0, 1000, true) != AT_OK)
-        dying_gasp("AT+BLEGATTSSRVSTART failed");
-
-    if (AT_SendCommand("AT+BLENAME=\"Stephano-I\"", NULL, 0, 1000, true) != AT_OK)
-        dying_gasp("AT+BLENAME=\"Stephano-I\" failed");
-
-    if (AT_SendCommand("AT+BLEADVDATA=\"0201060B095374657068616E6F2D49\"", NULL, 0, 1000, true) != AT_OK)
-        dying_gasp("AT+BLEADVDATA=\"0201060B095374657068616E6F2D49\" failed");
-
-    if (AT_SendCommand("AT+BLEADVSTART", response_bufr, sizeof(response_bufr) - 1, 60000, true) != AT_OK)
-        dying_gasp("AT+BLEADVSTART failed");
-
-    /* Wait up to 60 seconds for +BLECONN:0,"<MAC>" from Stephano on UART2.
-       Receive bytes via blocking HAL_UART_Receive; build line buffer until \n. */
-    dl_state = DL_STATE_WAIT_CONNECT;
-    {
+        /* Any other link is an optional fast path: BLE is always there. */
 #if BOOTLOADER_DEBUG_ENABLE
-		{
-			char dbg_msg[128];
-			int len = sprintf(dbg_msg, "%s Looking for +BLECONN\r\n", __FUNCTION__);
-			HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
-		}
+      {
+        char dbg_msg[128];
+        int len = snprintf(dbg_msg, sizeof(dbg_msg), "%s %s: %s, falling back to BLE\r\n", __FUNCTION__, dl_link->name, error);
+        HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
+      }
 #endif
-
-		if(strstr(response_bufr, "+BLECONN"))
-		{
-			/* Respond with AT+BLECONN:0,<MAC> and enter SPP mode */
-			if (AT_SendCommand("AT+BLESPPCFG=1,1,2,1,1,0", NULL, 0, 2000, true) != AT_OK)
-				dying_gasp("AT+BLESPPCFG failed");
-			if (AT_SendCommand("AT+BLESPP", NULL, 0, 2000, true) != AT_OK)
-				dying_gasp("AT+BLESPP failed");
-
-			dl_state = DL_STATE_CONNECTED;
-		}
+        dl_link->close();
+        dl_link = TransportBle_Get();
+        error = "Link open failed";
+        if (!dl_link->open(&error))
+            dying_gasp(error);
     }
 
-    /* Start interrupt-driven receive for subsequent SPP traffic */
-    HAL_UART_Receive_IT(STEPHANO_UART_PTR, &uart_rx_byte, 1);
-}
-
-/* Called from HAL when UART receive completes; add byte and restart receive. */
-void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
-{
-#if STEPHANO_USE_UART1
-    if (huart->Instance == USART1) {
-#else
-    if (huart->Instance == USART2) {
-#endif
-        Bootloader_RxByte(uart_rx_byte);
-        HAL_UART_Receive_IT(STEPHANO_UART_PTR, &uart_rx_byte, 1);
-    }
+    dl_state = DL_STATE_CONNECTED;
+    idle_mark = rx_consumed;
+    idle_since = HAL_GetTick();
 }
 
 void Bootloader_Download_Process(void)
@@ -697,6 +692,9 @@ void Bootloader_Download_Process(void)
 				HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
 			}
 	#endif
+			/* Unsolicited, so the PC logs the link it got even if it never
+			   asks: the BLE tuning result is only known now. */
+			report_link();
 			if (have_stored_well_id)
 			{
 				dl_state = DL_STATE_SEND_WSM_ID;
@@ -716,6 +714,7 @@ void Bootloader_Download_Process(void)
 			}
 	#endif
 			char buf[64];
+			BootTiming_Mark(BOOT_PHASE_HANDSHAKE);
 			snprintf(buf, sizeof(buf), "WSM ID %u", well_id);
 			send_line(buf);
 			dl_state = DL_STATE_WAIT_ID_RESP;
@@ -726,12 +725,13 @@ void Bootloader_Download_Process(void)
 	#if BOOTLOADER_DEBUG_ENABLE
 			{
 				char dbg_msg[128];
-				int len = sprintf(dbg_msg, "%s send WSM MAC %s\r\n", __FUNCTION__, mac_buf);
+				int len = sprintf(dbg_msg, "%s send WSM MAC %s\r\n", __FUNCTION__, dl_link->address());
 				HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
 			}
 	#endif
 			char buf[64];
-			snprintf(buf, sizeof(buf), "WSM MAC %s", mac_buf);
+			BootTiming_Mark(BOOT_PHASE_HANDSHAKE);
+			snprintf(buf, sizeof(buf), "WSM MAC %s", dl_link->address());
 			send_line(buf);
 			dl_state = DL_STATE_WAIT_WSM_ID;
 	//        return;
@@ -740,6 +740,7 @@ void Bootloader_Download_Process(void)
 		if (dl_state == DL_STATE_SEND_WSM_BL) {
 			char ver[16];
 			char buf[64];
+			BootTiming_Mark(BOOT_PHASE_WSM_BL);
 			get_bootloader_version(ver, sizeof(ver));
 	#if BOOTLOADER_DEBUG_ENABLE
 			{
@@ -757,6 +758,7 @@ void Bootloader_Download_Process(void)
 		if (dl_state == DL_STATE_SEND_WSM_APP) {
 			char ver[16];
 			char buf[64];
+			BootTiming_Mark(BOOT_PHASE_WSM_APP);
 			get_app_version(ver, sizeof(ver));
 	#if BOOTLOADER_DEBUG_ENABLE
 			{
@@ -765,12 +767,45 @@ void Bootloader_Download_Process(void)
 				HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
 			}
 	#endif
+#if BOOTLOADER_AB_SLOTS
+			/* The PC sends the image linked for this sector. */
+			snprintf(buf, sizeof(buf), "WSM APP %s SLOT %lu", ver, (unsigned long)Flash_GetDownloadSector());
+#else
 			snprintf(buf, sizeof(buf), "WSM APP %s", ver);
+#endif
 			send_line(buf);
 			dl_state = DL_STATE_WAIT_APP_RESP;
 	//        return;
 		}
 
+		if (dl_state == DL_STATE_SEND_PARAMS) {
+			char buf[32];
+			BootTiming_Mark(BOOT_PHASE_PARAMS);
+			snprintf(buf, sizeof(buf), "WSM PARAMS %08lX", (unsigned long)ParamSync_Digest());
+	#if BOOTLOADER_DEBUG_ENABLE
+			{
+				char dbg_msg[128];
+				int len = sprintf(dbg_msg, "%s send %s\r\n", __FUNCTION__, buf);
+				HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
+			}
+	#endif
+			send_line(buf);
+			params_since = HAL_GetTick();
+			dl_state = DL_STATE_WAIT_PARAMS;
+		}
+
 		process_rx_data();
+		if (rx_consumed != idle_mark) {
+			idle_mark = rx_consumed;
+			idle_since = HAL_GetTick();
+		} else if (idle_timeout_ms != 0 && HAL_GetTick() - idle_since >= idle_timeout_ms) {
+			dying_gasp("Session idle timeout");
+		}
+		if (dl_state == DL_STATE_WAIT_PARAMS && HAL_GetTick() - params_since >= PARAMS_TIMEOUT_MS)
+			finish_session();
+		/* Nothing left to service: sleep until the link or the flash
+		   posts, or the next tick for the timeouts. */
+		if (dl_link->available() == 0)
+			(void)Events_Wait(EVENT_RX | EVENT_FLASH);
 	}
 }
@@ -10,6 +10,10 @@
 #include "flash_ops.h"
 #include "bootloader_download.h"
 #include "sha256.h"
+#include "boot_timing.h"
+#include "clock_profile.h"
+#include "boot_shared.h"
+#include "stephano.h"
 #include "main.h"
 #include <string.h>
 
@@ -90,56 +94,416 @@ static const uint8_t *search_sector_metadata(uint32_t sector_addr, uint32_t sect
     return NULL;
 }
 
-/* Jump to application: set MSP, disable interrupts, jump to reset handler. */
-static void jump_to_application(uint32_t app_addr)
+const uint8_t *Bootloader_FindMetadata(uint32_t sector_addr, uint32_t sector_size)
+{
+    const uint8_t *meta = search_sector_metadata(sector_addr, sector_size);
+    uint32_t size;
+
+    if (meta == NULL)
+        return NULL;
+    size = get_metadata_size(meta);
+    if (size < APP_METADATA_SIZE || size > sector_size ||
+        (uint32_t)meta != sector_addr + size - APP_METADATA_SIZE)
+        return NULL;
+    return meta;
+}
+
+static const uint8_t WORD_ZERO[4] = { 0x00, 0x00, 0x00, 0x00 };
+
+static uint32_t get_dest_address(const uint8_t *meta)
+{
+    return meta[APP_METADATA_OFFSET_DEST_ADDRESS] |
+           (meta[APP_METADATA_OFFSET_DEST_ADDRESS + 1] << 8) |
+           (meta[APP_METADATA_OFFSET_DEST_ADDRESS + 2] << 16) |
+           ((uint32_t)meta[APP_METADATA_OFFSET_DEST_ADDRESS + 3] << 24);
+}
+
+/* SHA256 with the committed validation and clean invalidation in place of
+   the stored ones, so the digest bootloader_postbuild.sh writes holds in
+   every state the slot goes through. */
+static bool verify_slot(uint32_t sector, const uint8_t *meta)
+{
+    uint8_t computed[SHA256_DIGEST_SIZE];
+    sha256_ctx_t ctx;
+    uint32_t base = Flash_SectorAddress(sector);
+
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, (const uint8_t *)base, (uint32_t)meta - base + APP_METADATA_OFFSET_VALIDATION);
+    SHA256_Update(&ctx, VALIDATION_READY, 8);
+    SHA256_Update(&ctx, INVALIDATION, 8);
+    SHA256_Final(&ctx, computed);
+
+    return memcmp(computed, meta + APP_METADATA_OFFSET_SHA256, SHA256_DIGEST_SIZE) == 0;
+}
+
+#if BOOTLOADER_AB_SLOTS
+/* A/B slots: sectors 6 and 7 each hold an image linked for that sector.
+   An update goes to the idle slot and, once verified, is committed on
+   trial (or straight to ready with BOOTLOADER_TRIAL_ATTEMPTS 0). A trial
+   image is preferred while it has boots left; the application confirms it
+   (bl_services.h) and the old slot is retired then. Out of boots, it is
+   retired instead and the previous slot runs again. Both ready only after
+   a power loss between two writes: higher version wins, then sector 7.
+
+   Slot states, by validation[0..7] / invalidation[0..7]:
+     download  FF FF FF FF FF FF FF FF / 00 00 00 00 FF FF FF FF
+     trial     aa aa aa aa 00 00 00 FF / 00 00 00 00 FF FF FF FF
+     ready     aa aa aa aa 00 00 00 00 / 00 00 00 00 FF FF FF FF
+     retired   any                     / 00 00 00 00 00 00 00 00
+   aa: FF, or 00 once that trial boot was used. */
+static const uint8_t WORD_TRIAL[4] = { 0x00, 0x00, 0x00, 0xFF };
+static const uint32_t TRIAL_ATTEMPTS = BOOTLOADER_TRIAL_ATTEMPTS;
+
+static uint32_t other_slot(uint32_t sector)
+{
+    return (sector == FLASH_SECTOR_CURRENT) ? FLASH_SECTOR_DOWNLOAD : FLASH_SECTOR_CURRENT;
+}
+
+/* Metadata of an image linked to run from this slot, or NULL. */
+static const uint8_t *slot_metadata(uint32_t sector)
+{
+    uint32_t base = Flash_SectorAddress(sector);
+    const uint8_t *meta = Bootloader_FindMetadata(base, FLASH_SECTOR_SIZE_6_7);
+
+    if (meta == NULL || get_dest_address(meta) != base)
+        return NULL;
+    return meta;
+}
+
+static bool slot_not_retired(const uint8_t *meta)
+{
+    return memcmp(meta + APP_METADATA_OFFSET_INVALIDATION, INVALIDATION, 8) == 0;
+}
+
+static bool slot_is_ready(const uint8_t *meta)
+{
+    return memcmp(meta + APP_METADATA_OFFSET_VALIDATION + 4, WORD_ZERO, 4) == 0
+        && slot_not_retired(meta);
+}
+
+static bool slot_is_trial(const uint8_t *meta)
+{
+    return memcmp(meta + APP_METADATA_OFFSET_VALIDATION + 4, WORD_TRIAL, 4) == 0
+        && slot_not_retired(meta);
+}
+
+/* Trial boots used so far: one validation byte cleared per boot. */
+static uint32_t trial_boots_used(const uint8_t *meta)
+{
+    uint32_t i, used = 0;
+
+    for (i = 0; i < 4; ++i)
+        if (meta[APP_METADATA_OFFSET_VALIDATION + i] != 0xFF)
+            used++;
+    return used;
+}
+
+static bool slot_is_bootable(const uint8_t *meta)
+{
+    return meta != NULL && (slot_is_ready(meta)
+        || (slot_is_trial(meta) && trial_boots_used(meta) < TRIAL_ATTEMPTS));
+}
+
+static void slot_retire(const uint8_t *meta)
+{
+    (void)Flash_WriteData((uint32_t)meta + APP_METADATA_OFFSET_INVALIDATION + 4, WORD_ZERO, 4);
+}
+
+/* Spend one trial boot: clear the next validation byte of the first word. */
+static bool slot_use_trial_boot(const uint8_t *meta)
+{
+    uint8_t word[4];
+
+    memcpy(word, meta + APP_METADATA_OFFSET_VALIDATION, 4);
+    word[trial_boots_used(meta)] = 0x00;
+    return Flash_WriteData((uint32_t)meta + APP_METADATA_OFFSET_VALIDATION, word, 4);
+}
+
+/* Dotted decimal versions ("1.10.0" > "1.9.2"), up to the 8-byte field. */
+static int compare_versions(const uint8_t *a, const uint8_t *b)
+{
+    uint32_t i = 0, j = 0;
+
+    while (i < 8 || j < 8) {
+        uint32_t va = 0, vb = 0;
+
+        while (i < 8 && a[i] >= '0' && a[i] <= '9')
+            va = va * 10 + (a[i++] - '0');
+        while (j < 8 && b[j] >= '0' && b[j] <= '9')
+            vb = vb * 10 + (b[j++] - '0');
+        if (va != vb)
+            return (va > vb) ? 1 : -1;
+        if ((i >= 8 || a[i] != '.') && (j >= 8 || b[j] != '.'))
+            return 0;
+        if (i < 8 && a[i] == '.')
+            i++;
+        if (j < 8 && b[j] == '.')
+            j++;
+    }
+    return 0;
+}
+
+/* Slot to boot first: a trial image with boots left, else a ready image
+   (the newer, then sector 7). 0 if neither slot holds one. Metadata only;
+   the caller verifies. */
+static uint32_t preferred_slot(void)
+{
+    const uint8_t *meta6 = slot_metadata(FLASH_SECTOR_DOWNLOAD);
+    const uint8_t *meta7 = slot_metadata(FLASH_SECTOR_CURRENT);
+    bool boot6 = slot_is_bootable(meta6);
+    bool boot7 = slot_is_bootable(meta7);
+
+    if (boot6 && boot7) {
+        if (slot_is_trial(meta6) != slot_is_trial(meta7))
+            return slot_is_trial(meta6) ? FLASH_SECTOR_DOWNLOAD : FLASH_SECTOR_CURRENT;
+        return (compare_versions(meta6 + APP_METADATA_OFFSET_VERSION,
+                                 meta7 + APP_METADATA_OFFSET_VERSION) > 0)
+               ? FLASH_SECTOR_DOWNLOAD : FLASH_SECTOR_CURRENT;
+    }
+    if (boot6)
+        return FLASH_SECTOR_DOWNLOAD;
+    if (boot7)
+        return FLASH_SECTOR_CURRENT;
+    return 0;
+}
+
+/* A trial image that used all its boots without being confirmed, or that
+   no longer verifies, is retired: the previous slot takes over. */
+static void retire_failed_trial(const uint8_t *meta, bool verified)
+{
+    if (slot_is_trial(meta) && (!verified || trial_boots_used(meta) >= TRIAL_ATTEMPTS))
+        slot_retire(meta);
+}
+
+uint32_t Bootloader_ActiveSlot(void)
+{
+    uint32_t sector = preferred_slot();
+
+    return (sector != 0) ? sector : FLASH_SECTOR_CURRENT;
+}
+
+uint32_t Bootloader_DownloadSlot(void)
+{
+    return (preferred_slot() == FLASH_SECTOR_DOWNLOAD) ? FLASH_SECTOR_CURRENT : FLASH_SECTOR_DOWNLOAD;
+}
+
+bool Bootloader_DownloadSlotInUse(void)
+{
+    const uint8_t *meta = slot_metadata(Bootloader_DownloadSlot());
+
+    return meta != NULL && (slot_is_ready(meta) || slot_is_trial(meta));
+}
+
+bool Bootloader_CommitDownload(uint32_t sector)
+{
+    const uint8_t *meta = slot_metadata(sector);
+#if BOOTLOADER_TRIAL_ATTEMPTS == 0
+    const uint8_t *old;
+#endif
+
+    if (meta == NULL || !is_validation_download(meta))
+        return false;
+    BootTiming_Mark(BOOT_PHASE_VERIFY_DOWNLOAD);
+    if (!verify_slot(sector, meta))
+        return false;
+
+#if BOOTLOADER_TRIAL_ATTEMPTS > 0
+    /* Validation FF FF FF FF FF FF FF FF -> FF FF FF FF 00 00 00 FF. The old
+       slot stays ready to fall back to until the application confirms. */
+    return Flash_WriteData((uint32_t)meta + APP_METADATA_OFFSET_VALIDATION + 4, WORD_TRIAL, 4);
+#else
+    /* Validation FF FF FF FF FF FF FF FF -> FF FF FF FF 00 00 00 00. This
+       write is the commit; retiring the old slot after it is cleanup. */
+    if (!Flash_WriteData((uint32_t)meta + APP_METADATA_OFFSET_VALIDATION + 4, WORD_ZERO, 4))
+        return false;
+    old = slot_metadata(other_slot(sector));
+    if (old != NULL && slot_is_ready(old))
+        slot_retire(old);
+    return true;
+#endif
+}
+#else
+#if BOOTLOADER_DIRECT_PROVISION
+/* Set by Bootloader_Run when sector 7 had nothing to boot. */
+static bool current_missing;
+#endif
+
+uint32_t Bootloader_ActiveSlot(void)
+{
+    return FLASH_SECTOR_CURRENT;
+}
+
+uint32_t Bootloader_DownloadSlot(void)
+{
+#if BOOTLOADER_DIRECT_PROVISION
+    /* Nothing in sector 7 to protect: download straight into it. */
+    if (current_missing)
+        return FLASH_SECTOR_CURRENT;
+#endif
+    return FLASH_SECTOR_DOWNLOAD;
+}
+
+/* Sector 6 only ever stages: the first stage has installed what it held. */
+bool Bootloader_DownloadSlotInUse(void)
+{
+    return false;
+}
+
+/* Direct provisioning: the download-state image in sector 7 is verified in
+   place and flipped to ready, with no staging copy by the first stage. */
+bool Bootloader_CommitDownload(uint32_t sector)
+{
+    uint32_t sector7_addr = FLASH_SECTOR_7_ADDRESS;
+    const uint8_t *meta;
+
+    if (sector != FLASH_SECTOR_CURRENT)
+        return false;
+    meta = Bootloader_FindMetadata(sector7_addr, FLASH_SECTOR_SIZE_6_7);
+    if (meta == NULL || get_dest_address(meta) != sector7_addr || !is_validation_download(meta))
+        return false;
+    BootTiming_Mark(BOOT_PHASE_VERIFY_DOWNLOAD);
+    if (!verify_slot(sector, meta))
+        return false;
+    /* Validation FF FF FF FF FF FF FF FF -> FF FF FF FF 00 00 00 00. */
+    return Flash_WriteData((uint32_t)meta + APP_METADATA_OFFSET_VALIDATION + 4, WORD_ZERO, 4);
+}
+#endif /* BOOTLOADER_AB_SLOTS */
+
+/* Leave the core as close to reset state as the application expects:
+   SysTick stopped, every NVIC line disabled and unpended, no UART interrupt
+   sources armed (the Stephano UART keeps running if the radio is handed
+   over), vector table at the image. */
+static void quiesce_for_handoff(uint32_t app_addr)
+{
+    uint32_t i;
+
+    __disable_irq();
+    SysTick->CTRL = 0;
+    SCB->ICSR = SCB_ICSR_PENDSTCLR_Msk;
+
+    USART1->CR1 &= ~(USART_CR1_PEIE | USART_CR1_TXEIE | USART_CR1_TCIE | USART_CR1_RXNEIE | USART_CR1_IDLEIE);
+    USART1->CR3 &= ~USART_CR3_EIE;
+    USART2->CR1 &= ~(USART_CR1_PEIE | USART_CR1_TXEIE | USART_CR1_TCIE | USART_CR1_RXNEIE | USART_CR1_IDLEIE);
+    USART2->CR3 &= ~USART_CR3_EIE;
+
+    for (i = 0; i < sizeof(NVIC->ICER) / sizeof(NVIC->ICER[0]); ++i) {
+        NVIC->ICER[i] = 0xFFFFFFFFu;
+        NVIC->ICPR[i] = 0xFFFFFFFFu;
+    }
+
+    SCB->VTOR = app_addr;
+    __DSB();
+    __ISB();
+}
+
+/* Jump to application: hand over, quiesce, set MSP, jump to reset handler.
+   PRIMASK is cleared again as after a reset; nothing is left to fire. */
+static void jump_to_application(uint32_t app_addr, const uint8_t *meta)
 {
     uint32_t msp = *(volatile uint32_t *)app_addr;
     uint32_t reset_handler = *(volatile uint32_t *)(app_addr + 4);
 
-    __disable_irq();
+    BootTiming_Mark(BOOT_PHASE_JUMP);
+    Stephano_PowerUpCancel();
+    /* The application's SystemClock_Config() expects this one. */
+    (void)ClockProfile_Set(CLOCK_PROFILE_BASE);
+    BootShared_WriteHandoff(app_addr, meta);
+    quiesce_for_handoff(app_addr);
     __set_MSP(msp);
+    __enable_irq();
     ((void (*)(void))reset_handler)();
 }
 
+#if BOOTLOADER_AB_SLOTS
+void Bootloader_BootCurrent(void)
+{
+    uint32_t first, sector;
+    const uint8_t *meta;
+    bool verified;
+
+    /* An unconfirmed trial image out of boots is dropped before choosing. */
+    for (sector = FLASH_SECTOR_DOWNLOAD; sector <= FLASH_SECTOR_CURRENT; ++sector) {
+        meta = slot_metadata(sector);
+        if (meta != NULL)
+            retire_failed_trial(meta, true);
+    }
+
+    first = preferred_slot();
+    if (first == 0)
+        return;
+    sector = first;
+    BootTiming_Mark(BOOT_PHASE_SCAN_CURRENT);
+    /* The preferred slot, then the other one if it can boot too. */
+    do {
+        meta = slot_metadata(sector);
+        if (slot_is_bootable(meta)) {
+            BootTiming_Mark(BOOT_PHASE_VERIFY_CURRENT);
+            verified = verify_slot(sector, meta);
+            retire_failed_trial(meta, verified);
+            if (verified && (!slot_is_trial(meta) || slot_use_trial_boot(meta)))
+                jump_to_application(Flash_SectorAddress(sector), meta);
+        }
+        sector = other_slot(sector);
+    } while (sector != first);
+}
+#else
+void Bootloader_BootCurrent(void)
+{
+    const uint8_t *meta;
+    uint32_t sector7_addr = FLASH_SECTOR_7_ADDRESS;
+
+    BootTiming_Mark(BOOT_PHASE_SCAN_CURRENT);
+    meta = Bootloader_FindMetadata(sector7_addr, FLASH_SECTOR_SIZE_6_7);
+    if (meta == NULL || !is_validation_ready(meta))
+        return;
+    BootTiming_Mark(BOOT_PHASE_VERIFY_CURRENT);
+    if (verify_sha256_sector7_ready(sector7_addr, get_metadata_size(meta),
+                                    meta + APP_METADATA_OFFSET_SHA256))
+        jump_to_application(sector7_addr, meta);
+}
+#endif
+
 void Bootloader_Run(void)
 {
     const uint8_t *meta;
     uint32_t size;
     const uint8_t *digest_ptr;
     uint32_t sector6_addr = FLASH_SECTOR_6_ADDRESS;
-    uint32_t sector7_addr = FLASH_SECTOR_7_ADDRESS;
     uint32_t sector_size = FLASH_SECTOR_SIZE_6_7;
 
     /* 1. Search sector 6 for app in download state (validation all 0xFF) */
-    meta = search_sector_metadata(sector6_addr, sector_size);
+    BootTiming_Mark(BOOT_PHASE_SCAN_DOWNLOAD);
+#if BOOTLOADER_AB_SLOTS
+    /* A slot image the session could not commit (e.g. power lost between
+       the last packet and the flip) is committed here and booted in place.
+       What is left for the first stage is a bootloader image in sector 6. */
+    (void)Bootloader_CommitDownload(FLASH_SECTOR_DOWNLOAD);
+    (void)Bootloader_CommitDownload(FLASH_SECTOR_CURRENT);
+#endif
+    meta = Bootloader_FindMetadata(sector6_addr, sector_size);
+#if BOOTLOADER_AB_SLOTS
+    if (meta != NULL && get_dest_address(meta) == sector6_addr)
+        meta = NULL;
+#endif
     if (meta != NULL) {
         size = get_metadata_size(meta);
-        if (size >= APP_METADATA_SIZE && size <= sector_size &&
-            (uint32_t)meta == sector6_addr + size - APP_METADATA_SIZE) {
-            if (is_validation_download(meta)) {
-                digest_ptr = meta + APP_METADATA_OFFSET_SHA256;
-                if (verify_sha256_sector6_download(sector6_addr, size, digest_ptr)) {
-                    NVIC_SystemReset();
-                    return;
-                }
+        if (is_validation_download(meta)) {
+            digest_ptr = meta + APP_METADATA_OFFSET_SHA256;
+            BootTiming_Mark(BOOT_PHASE_VERIFY_DOWNLOAD);
+            if (verify_sha256_sector6_download(sector6_addr, size, digest_ptr)) {
+                NVIC_SystemReset();
+                return;
             }
         }
     }
 
-    /* 2. Search sector 7 for app in ready state */
-    meta = search_sector_metadata(sector7_addr, sector_size);
-    if (meta != NULL) {
-        size = get_metadata_size(meta);
-        if (size >= APP_METADATA_SIZE && size <= sector_size &&
-            (uint32_t)meta == sector7_addr + size - APP_METADATA_SIZE) {
-            if (is_validation_ready(meta)) {
-                digest_ptr = meta + APP_METADATA_OFFSET_SHA256;
-                if (verify_sha256_sector7_ready(sector7_addr, size, digest_ptr)) {
-                    uint32_t app_addr = sector7_addr;
-                    jump_to_application(app_addr);
-                    return;
-                }
-            }
-        }
-    }
+    /* 2. Search sector 7 (A/B: either slot) for app in ready state; jump if it verifies */
+#if !BOOTLOADER_AB_SLOTS && BOOTLOADER_DIRECT_PROVISION
+    /* Downloaded straight into sector 7 but not flipped before a reset. */
+    (void)Bootloader_CommitDownload(FLASH_SECTOR_CURRENT);
+#endif
+    Bootloader_BootCurrent();
+#if !BOOTLOADER_AB_SLOTS && BOOTLOADER_DIRECT_PROVISION
+    current_missing = true;
+#endif
 }
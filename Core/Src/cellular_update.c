@@ -0,0 +1,446 @@
+/**
+  ******************************************************************************
+  * @file    cellular_update.c
+  * @brief   HTTP Range-request download of the application image over a
+  *          cellular modem's TCP socket, programmed range by range into the
+  *          download sector.
+  ******************************************************************************
+  */
+
+#include "cellular_update.h"
+#include "app_metadata.h"
+#include "clock_profile.h"
+#include "flash_ops.h"
+#include "bootloader_logic.h"
+#include "main.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#define CELL_RESUME_MAGIC        0x43454C4Cu   /* "CELL" */
+#define CELL_RECV_TIMEOUT_MS     15000
+#define CELL_MAX_FAILURES        5             /* consecutive, without progress */
+#define CELL_CHUNK               256           /* flash programming granule */
+#define CELL_LINE_SIZE           160
+
+/* Download progress, kept across software resets. The image is identified
+   by its size and ETag, and is only good for the sector it went to;
+   offset is always a multiple of CELL_CHUNK. */
+typedef struct {
+    uint32_t magic;
+    uint32_t sector;
+    uint32_t total;
+    uint32_t etag_hash;
+    uint32_t offset;
+    uint32_t check;
+} cell_resume_t;
+
+/* Not zeroed by the startup code; validated by resume_valid(). */
+__attribute__((section(".noinit")))
+static cell_resume_t resume;
+
+/* What the last response said about the image. */
+typedef struct {
+    int status;
+    uint32_t range_start;
+    uint32_t range_end;
+    uint32_t total;
+    uint32_t etag_hash;
+    bool keep_alive;
+} http_response_t;
+
+static const modem_ops_t *modem;
+static bool connected;
+static uint8_t rx_buf[512];
+static uint32_t rx_pos, rx_len;
+static uint8_t chunk_buf[CELL_CHUNK];
+
+static uint32_t resume_check(void)
+{
+    return resume.magic ^ resume.sector ^ resume.total ^ resume.etag_hash ^ resume.offset ^ 0xA5A5A5A5u;
+}
+
+static bool resume_valid(void)
+{
+    return resume.magic == CELL_RESUME_MAGIC && resume.check == resume_check()
+        && resume.sector == Flash_GetDownloadSector()
+        && resume.offset <= resume.total && resume.total <= FLASH_SECTOR_SIZE_6_7
+        && resume.offset % CELL_CHUNK == 0;
+}
+
+static void resume_save(uint32_t total, uint32_t etag_hash, uint32_t offset)
+{
+    resume.magic = CELL_RESUME_MAGIC;
+    resume.sector = Flash_GetDownloadSector();
+    resume.total = total;
+    resume.etag_hash = etag_hash;
+    resume.offset = offset;
+    resume.check = resume_check();
+}
+
+static void resume_clear(void)
+{
+    resume.magic = 0;
+}
+
+/* FNV-1a; the ETag only needs to be compared, not kept. */
+static uint32_t hash_str(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s) {
+        h ^= (uint8_t)*s++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void link_close(void)
+{
+    if (connected)
+        modem->tcp_close();
+    connected = false;
+    rx_pos = rx_len = 0;
+}
+
+static bool link_open(void)
+{
+    const char *error = NULL;
+
+    if (connected)
+        return true;
+    rx_pos = rx_len = 0;
+    connected = modem->tcp_open(BOOTLOADER_CELL_HOST, BOOTLOADER_CELL_PORT, &error);
+    return connected;
+}
+
+/* Buffered reads from the socket. */
+static bool link_getc(uint8_t *c)
+{
+    if (rx_pos == rx_len) {
+        rx_len = modem->tcp_recv(rx_buf, sizeof(rx_buf), CELL_RECV_TIMEOUT_MS);
+        rx_pos = 0;
+        if (rx_len == 0)
+            return false;
+    }
+    *c = rx_buf[rx_pos++];
+    return true;
+}
+
+static uint32_t link_read(uint8_t *dst, uint32_t len)
+{
+    uint32_t n;
+
+    if (rx_pos == rx_len) {
+        rx_len = modem->tcp_recv(rx_buf, sizeof(rx_buf), CELL_RECV_TIMEOUT_MS);
+        rx_pos = 0;
+    }
+    n = rx_len - rx_pos;
+    if (n > len)
+        n = len;
+    memcpy(dst, &rx_buf[rx_pos], n);
+    rx_pos += n;
+    return n;
+}
+
+/* One header line without its CRLF (over-long lines are truncated). */
+static bool read_line(char *line, size_t len)
+{
+    size_t n = 0;
+    uint8_t c;
+
+    for (;;) {
+        if (!link_getc(&c))
+            return false;
+        if (c == '\n')
+            break;
+        if (c != '\r' && n < len - 1)
+            line[n++] = (char)c;
+    }
+    line[n] = '\0';
+    return true;
+}
+
+static bool header_is(const char *line, const char *name)
+{
+    size_t n = strlen(name);
+
+    return strncasecmp(line, name, n) == 0 && line[n] == ':';
+}
+
+/* GET with "Range: bytes=<range>". */
+static bool request(const char *range)
+{
+    char req[256];
+    char slot_query[16] = "";
+    int len;
+
+#if BOOTLOADER_AB_SLOTS
+    /* The image linked for the slot it is written to. */
+    snprintf(slot_query, sizeof(slot_query), "?slot=%lu", (unsigned long)Flash_GetDownloadSector());
+#endif
+    len = snprintf(req, sizeof(req),
+                   "GET %s%s HTTP/1.1\r\n"
+                   "Host: %s\r\n"
+                   "Range: bytes=%s\r\n"
+                   "Connection: keep-alive\r\n"
+                   "\r\n",
+                   BOOTLOADER_CELL_PATH, slot_query, BOOTLOADER_CELL_HOST, range);
+
+    return len > 0 && (size_t)len < sizeof(req) && modem->tcp_send((const uint8_t *)req, (uint32_t)len);
+}
+
+static bool request_range(uint32_t start, uint32_t end)
+{
+    char range[24];
+
+    snprintf(range, sizeof(range), "%lu-%lu", (unsigned long)start, (unsigned long)end);
+    return request(range);
+}
+
+/* Status line and headers of a range response. */
+static bool read_response(http_response_t *rsp)
+{
+    char line[CELL_LINE_SIZE];
+    const char *p;
+
+    memset(rsp, 0, sizeof(*rsp));
+    rsp->keep_alive = true;
+
+    if (!read_line(line, sizeof(line)) || strncmp(line, "HTTP/1.", 7) != 0)
+        return false;
+    if ((p = strchr(line, ' ')) == NULL)
+        return false;
+    rsp->status = atoi(p + 1);
+
+    for (;;) {
+        if (!read_line(line, sizeof(line)))
+            return false;
+        if (line[0] == '\0')
+            return true;
+        if (header_is(line, "Content-Range")) {
+            unsigned long a, b, total;
+            if ((p = strstr(line, "bytes")) == NULL
+                || sscanf(p + 5, " %lu-%lu/%lu", &a, &b, &total) != 3)
+                return false;
+            rsp->range_start = a;
+            rsp->range_end = b;
+            rsp->total = total;
+        } else if (header_is(line, "ETag")) {
+            rsp->etag_hash = hash_str(line + 5);
+        } else if (header_is(line, "Connection")) {
+            rsp->keep_alive = strstr(line, "close") == NULL;
+        }
+    }
+}
+
+/* Program the range body; progress is saved after each chunk so a drop
+   mid-range only loses the chunk in flight. Returns true once the whole
+   range is in flash. */
+static bool program_range(const http_response_t *rsp, uint32_t *offset)
+{
+    uint32_t end = rsp->range_end + 1;
+    uint32_t fill = 0;
+
+    while (*offset + fill < end) {
+        uint32_t want = end - (*offset + fill);
+        uint32_t n;
+
+        if (want > CELL_CHUNK - fill)
+            want = CELL_CHUNK - fill;
+        n = link_read(&chunk_buf[fill], want);
+        if (n == 0)
+            return false;
+        fill += n;
+        if (fill == CELL_CHUNK || *offset + fill == end) {
+            if (!Flash_ProgramFirmwareData(*offset, chunk_buf, fill))
+                return false;
+            *offset += fill;
+            fill = 0;
+            resume_save(rsp->total, rsp->etag_hash, *offset);
+        }
+    }
+    return true;
+}
+
+/* Version field of the metadata block that ends the server's image: its
+   last APP_METADATA_SIZE bytes, asked for as a suffix range. */
+static bool server_version(uint8_t version[8])
+{
+    static const uint8_t MAGIC[8] = APP_METADATA_MAGIC;
+    uint8_t meta[APP_METADATA_SIZE];
+    http_response_t rsp;
+    char range[8];
+    uint32_t got = 0, size;
+
+    snprintf(range, sizeof(range), "-%u", (unsigned int)APP_METADATA_SIZE);
+    if (!link_open() || !request(range) || !read_response(&rsp)) {
+        link_close();
+        return false;
+    }
+    if (rsp.status != 206 || rsp.total == 0 || rsp.total > FLASH_SECTOR_SIZE_6_7
+        || rsp.range_end + 1 != rsp.total || rsp.range_end + 1 - rsp.range_start != APP_METADATA_SIZE) {
+        link_close();
+        return false;
+    }
+    while (got < APP_METADATA_SIZE) {
+        uint32_t n = link_read(&meta[got], APP_METADATA_SIZE - got);
+
+        if (n == 0) {
+            link_close();
+            return false;
+        }
+        got += n;
+    }
+    if (!rsp.keep_alive)
+        link_close();
+
+    memcpy(&size, &meta[APP_METADATA_OFFSET_SIZE], sizeof(size));
+    if (memcmp(&meta[APP_METADATA_OFFSET_MAGIC], MAGIC, sizeof(MAGIC)) != 0 || size != rsp.total)
+        return false;
+    memcpy(version, &meta[APP_METADATA_OFFSET_VERSION], 8);
+    return true;
+}
+
+/* A download worth starting: one of this image is half done, or the
+   server's version is not the installed one. No answer means no. */
+static bool update_available(void)
+{
+    const uint8_t *installed;
+    uint8_t version[8];
+
+    if (resume_valid() && resume.offset > 0)
+        return true;
+    if (!server_version(version))
+        return false;
+    installed = Bootloader_FindMetadata(Flash_SectorAddress(Bootloader_ActiveSlot()), FLASH_SECTOR_SIZE_6_7);
+    return installed == NULL
+        || memcmp(&installed[APP_METADATA_OFFSET_VERSION], version, sizeof(version)) != 0;
+}
+
+static bool start_fresh(uint32_t *offset)
+{
+    resume_clear();
+    *offset = 0;
+    return Flash_EraseDownloadSector();
+}
+
+/* Fetch ranges until the image is complete. Returns false after
+   CELL_MAX_FAILURES attempts in a row without progress. */
+static bool download(void)
+{
+    http_response_t rsp;
+    uint32_t offset = 0;
+    uint32_t total = 0;
+    uint32_t failures = 0;
+    bool resuming = resume_valid() && resume.offset > 0;
+
+    if (resuming) {
+        offset = resume.offset;
+        total = resume.total;
+    } else if (!start_fresh(&offset)) {
+        return false;
+    }
+
+    while (total == 0 || offset < total) {
+        uint32_t before = offset;
+
+        if (failures >= CELL_MAX_FAILURES)
+            return false;
+
+        if (!link_open() || !request_range(offset, offset + CELL_RANGE_SIZE - 1)
+            || !read_response(&rsp)) {
+            link_close();
+            failures++;
+            continue;
+        }
+
+        /* Anything but the range we asked for means we cannot go on from
+           here: start over, or give up if the server ignores Range. */
+        if (rsp.status != 206 || rsp.range_start != offset || rsp.total == 0
+            || rsp.total > FLASH_SECTOR_SIZE_6_7) {
+            link_close();
+            if (rsp.status == 200 || rsp.total > FLASH_SECTOR_SIZE_6_7)
+                return false;
+            failures++;
+            continue;
+        }
+
+        /* The server's image changed since the progress was saved. */
+        if (resuming && (rsp.total != resume.total || rsp.etag_hash != resume.etag_hash)) {
+            link_close();
+            resuming = false;
+            total = 0;
+            if (!start_fresh(&offset))
+                return false;
+            continue;
+        }
+
+        total = rsp.total;
+        resuming = true;
+        resume_save(total, rsp.etag_hash, offset);
+
+        if (!program_range(&rsp, &offset) || !rsp.keep_alive)
+            link_close();
+
+        failures = (offset > before) ? 0 : failures + 1;
+    }
+    return true;
+}
+
+static void run(const modem_ops_t *ops, bool only_if_changed)
+{
+    const char *error = NULL;
+    clock_profile_t profile;
+    bool up;
+
+    modem = ops;
+    connected = false;
+    Flash_SelectDownloadSector(Bootloader_DownloadSlot());
+
+    /* Modem boot and network registration are tens of seconds of waiting:
+       run them on the low clock. */
+    profile = ClockProfile_Set(CLOCK_PROFILE_LOW);
+    up = modem->power_on(&error) && modem->attach(&error);
+    (void)ClockProfile_Set(profile);
+    if (!up) {
+        modem->power_off();
+        return;
+    }
+
+    if ((only_if_changed && !update_available()) || !download()) {
+        link_close();
+        modem->power_off();
+        return;
+    }
+
+    link_close();
+    modem->power_off();
+    resume_clear();
+
+    /* Written where it runs (A/B slot, or sector 7 under direct
+       provisioning): commit before the reset, then run it in place. */
+    if (BOOTLOADER_AB_SLOTS || Flash_GetDownloadSector() == FLASH_SECTOR_CURRENT) {
+        if (!Bootloader_CommitDownload(Flash_GetDownloadSector()))
+            return;
+        Bootloader_BootCurrent();
+    }
+    /* Image is in sector 6: the first stage verifies and installs it. */
+    NVIC_SystemReset();
+}
+
+void CellularUpdate_Run(const modem_ops_t *ops)
+{
+    run(ops, false);
+}
+
+void CellularUpdate_Check(const modem_ops_t *ops)
+{
+    run(ops, true);
+}
+
+void CellularUpdate_Forget(void)
+{
+    resume_clear();
+}
@@ -0,0 +1,156 @@
+/**
+  ******************************************************************************
+  * @file    clock_profile.c
+  * @brief   System clock profiles, switched at run time.
+  ******************************************************************************
+  */
+
+#include "clock_profile.h"
+#include "main.h"
+#include "boot_timing.h"
+
+#include "stm32f4xx_hal_uart.h"
+extern UART_HandleTypeDef huart1;
+extern UART_HandleTypeDef huart2;
+
+#define CLOCK_READY_SPINS  1000000u
+
+/* All from the 24 MHz HSE with PLLM = 12 (2 MHz VCO input); APB1 /2 and
+   APB2 /1 throughout, so APB1 stays within 42 MHz. Wait states for
+   2.7-3.6 V. */
+typedef struct {
+    uint32_t sysclk_hz;
+    uint32_t plln;            /* 0: PLL off, SYSCLK = HSE */
+    uint32_t pllp;
+    uint32_t pllq;
+    uint32_t latency;
+    uint32_t prefetch;
+} clock_profile_cfg_t;
+
+static const clock_profile_cfg_t PROFILES[] = {
+    [CLOCK_PROFILE_BASE] = { 72000000,  72, 2, 4, FLASH_LATENCY_2, 1 },
+    [CLOCK_PROFILE_FAST] = { 84000000, 168, 4, 7, FLASH_LATENCY_2, 1 },
+    /* Prefetch only costs power at zero wait states. */
+    [CLOCK_PROFILE_LOW]  = { HSE_VALUE,  0, 0, 0, FLASH_LATENCY_0, 0 },
+};
+
+static clock_profile_t current = CLOCK_PROFILE_BASE;
+
+static void wait_flag(volatile uint32_t *reg, uint32_t mask, uint32_t value)
+{
+    uint32_t spins = CLOCK_READY_SPINS;
+
+    while ((*reg & mask) != value)
+        if (--spins == 0)
+            Error_Handler();
+}
+
+/* Let the last byte of a blocking transmit leave at the old rate. */
+static void uart_drain(USART_TypeDef *usart)
+{
+    uint32_t spins = CLOCK_READY_SPINS;
+
+    if (!(usart->CR1 & USART_CR1_UE) || !(usart->CR1 & USART_CR1_TE))
+        return;
+    while (!(usart->SR & USART_SR_TC) && --spins != 0)
+        ;
+}
+
+/* As UART_SetConfig, BRR only: HAL_UART_Init would drop a receive in progress. */
+static void uart_rebaud(UART_HandleTypeDef *huart)
+{
+    uint32_t pclk;
+
+    if (!(huart->Instance->CR1 & USART_CR1_UE))
+        return;
+    if (huart->Instance == USART1 || huart->Instance == USART6)
+        pclk = HAL_RCC_GetPCLK2Freq();
+    else
+        pclk = HAL_RCC_GetPCLK1Freq();
+    if (huart->Init.OverSampling == UART_OVERSAMPLING_8)
+        huart->Instance->BRR = UART_BRR_SAMPLING8(pclk, huart->Init.BaudRate);
+    else
+        huart->Instance->BRR = UART_BRR_SAMPLING16(pclk, huart->Init.BaudRate);
+}
+
+static void set_latency(uint32_t latency)
+{
+    FLASH->ACR = (FLASH->ACR & ~FLASH_ACR_LATENCY) | latency;
+    wait_flag(&FLASH->ACR, FLASH_ACR_LATENCY, latency);
+}
+
+/* Move SYSCLK to sw at sysclk_hz. Wait states go up before a faster clock
+   and down after a slower one; the baud rates are redone with interrupts
+   off, right behind the switch. */
+static void switch_sysclk(uint32_t sw, uint32_t sysclk_hz, uint32_t latency)
+{
+    uint32_t primask;
+
+    if (latency > (FLASH->ACR & FLASH_ACR_LATENCY))
+        set_latency(latency);
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    /* The cycles so far were counted at the old clock. */
+    BootTiming_Resync();
+    RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | sw;
+    wait_flag(&RCC->CFGR, RCC_CFGR_SWS, sw << RCC_CFGR_SWS_Pos);
+    SystemCoreClock = sysclk_hz;
+    uart_rebaud(&huart1);
+    uart_rebaud(&huart2);
+    __set_PRIMASK(primask);
+
+    if (latency < (FLASH->ACR & FLASH_ACR_LATENCY))
+        set_latency(latency);
+    (void)HAL_InitTick(uwTickPrio);
+}
+
+clock_profile_t ClockProfile_Set(clock_profile_t profile)
+{
+    const clock_profile_cfg_t *cfg = &PROFILES[profile];
+    clock_profile_t previous = current;
+
+    if (profile == current)
+        return previous;
+
+    uart_drain(USART1);
+    uart_drain(USART2);
+
+    /* The PLL cannot be reprogrammed while it clocks the core: step down
+       to HSE first. HSE is on from SystemClock_Config() onwards. */
+    if ((RCC->CFGR & RCC_CFGR_SWS) == RCC_CFGR_SWS_PLL)
+        switch_sysclk(RCC_CFGR_SW_HSE, HSE_VALUE, FLASH_ACR_LATENCY & FLASH->ACR);
+    RCC->CR &= ~RCC_CR_PLLON;
+    wait_flag(&RCC->CR, RCC_CR_PLLRDY, 0);
+
+    if (cfg->plln != 0) {
+        RCC->PLLCFGR = (RCC->PLLCFGR & ~(RCC_PLLCFGR_PLLM | RCC_PLLCFGR_PLLN | RCC_PLLCFGR_PLLP
+                                         | RCC_PLLCFGR_PLLQ | RCC_PLLCFGR_PLLSRC))
+                     | (12u << RCC_PLLCFGR_PLLM_Pos)
+                     | (cfg->plln << RCC_PLLCFGR_PLLN_Pos)
+                     | ((cfg->pllp / 2 - 1) << RCC_PLLCFGR_PLLP_Pos)
+                     | (cfg->pllq << RCC_PLLCFGR_PLLQ_Pos)
+                     | RCC_PLLCFGR_PLLSRC_HSE;
+        RCC->CR |= RCC_CR_PLLON;
+        wait_flag(&RCC->CR, RCC_CR_PLLRDY, RCC_CR_PLLRDY);
+        switch_sysclk(RCC_CFGR_SW_PLL, cfg->sysclk_hz, cfg->latency);
+    } else if (cfg->latency != (FLASH->ACR & FLASH_ACR_LATENCY)) {
+        set_latency(cfg->latency);
+    }
+
+    /* ART accelerator: caches always on, prefetch per profile. */
+    if (cfg->prefetch)
+        __HAL_FLASH_PREFETCH_BUFFER_ENABLE();
+    else
+        __HAL_FLASH_PREFETCH_BUFFER_DISABLE();
+    __HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+    __HAL_FLASH_DATA_CACHE_ENABLE();
+
+    current = profile;
+    return previous;
+}
+
+clock_profile_t ClockProfile_Get(void)
+{
+    return current;
+}
@@ -0,0 +1,41 @@
+/**
+  ******************************************************************************
+  * @file    events.c
+  * @brief   Event flags posted from interrupts, and the idle wait of the
+  *          main loop.
+  ******************************************************************************
+  */
+
+#include "events.h"
+#include "main.h"
+
+static volatile uint32_t pending;
+
+void Events_Post(uint32_t events)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    pending |= events;
+    __set_PRIMASK(primask);
+}
+
+uint32_t Events_Wait(uint32_t mask)
+{
+    uint32_t taken;
+
+    /* With PRIMASK set an interrupt still ends WFI but is only taken once
+       it is cleared, so a post between the check and the sleep is never
+       missed. */
+    __disable_irq();
+    if ((pending & mask) == 0) {
+        __DSB();
+        __WFI();
+        __enable_irq();
+        __disable_irq();
+    }
+    taken = pending & mask;
+    pending &= ~taken;
+    __enable_irq();
+    return taken;
+}
@@ -0,0 +1,282 @@
+/**
+  ******************************************************************************
+  * @file    factory_flasher.c
+  * @brief   RAM-resident factory flasher: USART1 line protocol, DMA receive
+  *          ring, sector erase, program with read-back verify, timing.
+  *          Compiled to nothing unless FACTORY_FLASHER is defined.
+  ******************************************************************************
+  */
+
+#ifdef FACTORY_FLASHER
+
+#include "factory_flasher.h"
+#include "flash_ops.h"
+#include "sha256.h"
+#include "boot_timing.h"
+#include "main.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Wire speed. The 84 MHz APB2 of CLOCK_PROFILE_FAST divides 3 Mbaud
+   exactly (BRR 1.75); override from build for
+   adapters that cannot keep up, e.g. -DFLASHER_BAUD=921600. */
+#ifndef FLASHER_BAUD
+#define FLASHER_BAUD          3000000
+#endif
+
+#define FLASHER_RX_SIZE       32768   /* DMA ring, power of two */
+#define FLASHER_RX_MARGIN     256     /* kept free so the ring never wraps onto unread data */
+#define FLASHER_LINE_SIZE     64
+#define FLASHER_RX_TIMEOUT_MS 5000
+
+#define FLASH_BASE_ADDRESS    0x08000000u
+#define FLASH_END_ADDRESS     0x08080000u
+
+#include "stm32f4xx_hal_uart.h"
+extern UART_HandleTypeDef huart1;
+
+/* USART1_RX: DMA2 stream 2, channel 4. The ring runs circular with no
+   interrupts; the write position is read back from NDTR. Received bytes keep
+   landing while flash is programmed, since the flasher runs from SRAM. */
+static uint8_t rx_ring[FLASHER_RX_SIZE];
+static uint32_t rx_tail;
+
+static uint8_t block[FLASHER_BLOCK_SIZE] __attribute__((aligned(4)));
+
+static uint32_t bytes_programmed;
+static uint32_t erase_us;
+static uint32_t program_us;
+static uint32_t verify_us;
+static uint32_t session_start;
+
+/* Sector start addresses for the STM32F401RE; the last entry is the end. */
+static const uint32_t SECTOR_START[9] = {
+    0x08000000, 0x08004000, 0x08008000, 0x0800C000,
+    0x08010000, 0x08020000, 0x08040000, 0x08060000, 0x08080000
+};
+
+static void rx_dma_start(void)
+{
+    __HAL_RCC_DMA2_CLK_ENABLE();
+
+    DMA2_Stream2->CR = 0;
+    while (DMA2_Stream2->CR & DMA_SxCR_EN)
+        ;
+    DMA2->LIFCR = DMA_LIFCR_CTCIF2 | DMA_LIFCR_CHTIF2 | DMA_LIFCR_CTEIF2
+                | DMA_LIFCR_CDMEIF2 | DMA_LIFCR_CFEIF2;
+    DMA2_Stream2->PAR = (uint32_t)&USART1->DR;
+    DMA2_Stream2->M0AR = (uint32_t)rx_ring;
+    DMA2_Stream2->NDTR = FLASHER_RX_SIZE;
+    DMA2_Stream2->FCR = 0;
+    DMA2_Stream2->CR = (4u << DMA_SxCR_CHSEL_Pos) | DMA_SxCR_PL_1
+                     | DMA_SxCR_MINC | DMA_SxCR_CIRC;
+    rx_tail = 0;
+
+    USART1->CR3 |= USART_CR3_DMAR;
+    DMA2_Stream2->CR |= DMA_SxCR_EN;
+}
+
+static uint32_t rx_count(void)
+{
+    uint32_t head = FLASHER_RX_SIZE - DMA2_Stream2->NDTR;
+
+    return (head - rx_tail) & (FLASHER_RX_SIZE - 1);
+}
+
+/* Copy len bytes out of the ring, waiting for them to arrive. */
+static bool rx_read(uint8_t *dst, uint32_t len)
+{
+    uint32_t start = HAL_GetTick();
+
+    while (len > 0) {
+        uint32_t n = rx_count();
+
+        if (n == 0) {
+            if (HAL_GetTick() - start > FLASHER_RX_TIMEOUT_MS)
+                return false;
+            continue;
+        }
+        if (n > len)
+            n = len;
+        if (n > FLASHER_RX_SIZE - rx_tail)
+            n = FLASHER_RX_SIZE - rx_tail;
+        memcpy(dst, &rx_ring[rx_tail], n);
+        rx_tail = (rx_tail + n) & (FLASHER_RX_SIZE - 1);
+        dst += n;
+        len -= n;
+        start = HAL_GetTick();
+    }
+    return true;
+}
+
+/* Next command line, without its line ending. Waits indefinitely. */
+static void read_line(char *line, size_t len)
+{
+    size_t n = 0;
+    uint8_t c;
+
+    for (;;) {
+        while (rx_count() == 0)
+            ;
+        c = rx_ring[rx_tail];
+        rx_tail = (rx_tail + 1) & (FLASHER_RX_SIZE - 1);
+        if (c == '\n')
+            break;
+        if (c != '\r' && n < len - 1)
+            line[n++] = (char)c;
+    }
+    line[n] = '\0';
+}
+
+static void send_line(const char *s)
+{
+    HAL_UART_Transmit(&huart1, (uint8_t *)s, (uint16_t)strlen(s), 1000);
+    HAL_UART_Transmit(&huart1, (uint8_t *)"\r\n", 2, 1000);
+}
+
+/* "<addr> <len>" with addr inside flash and the range not running past it. */
+static bool parse_range(const char *args, uint32_t *addr, uint32_t *len)
+{
+    char *end;
+
+    *addr = strtoul(args, &end, 0);
+    if (end == args)
+        return false;
+    *len = strtoul(end, &end, 0);
+    return *addr >= FLASH_BASE_ADDRESS && *addr < FLASH_END_ADDRESS
+        && *len <= FLASH_END_ADDRESS - *addr;
+}
+
+static void cmd_erase(const char *args)
+{
+    char reply[48];
+    uint32_t addr, len, sector, count = 0;
+    uint32_t start = BootTiming_Cycles();
+
+    if (!parse_range(args, &addr, &len) || len == 0) {
+        send_line("ERR range");
+        return;
+    }
+    /* Every sector the range touches. */
+    for (sector = 0; sector < 8; ++sector) {
+        if (SECTOR_START[sector + 1] <= addr || SECTOR_START[sector] >= addr + len)
+            continue;
+        if (!Flash_EraseSector(sector)) {
+            snprintf(reply, sizeof(reply), "ERR erase sector %lu", (unsigned long)sector);
+            send_line(reply);
+            return;
+        }
+        count++;
+    }
+    erase_us += BootTiming_CyclesToUs(BootTiming_Cycles() - start);
+    snprintf(reply, sizeof(reply), "ERASE OK %lu %lu", (unsigned long)count,
+             (unsigned long)(BootTiming_CyclesToUs(BootTiming_Cycles() - start) / 1000));
+    send_line(reply);
+}
+
+static void cmd_write(const char *args)
+{
+    char reply[48];
+    uint32_t addr, len, start;
+
+    if (!parse_range(args, &addr, &len) || len == 0 || len > FLASHER_BLOCK_SIZE || addr % 4 != 0) {
+        send_line("ERR range");
+        return;
+    }
+    /* Always take the payload off the wire, so the stream stays in step. */
+    if (!rx_read(block, len)) {
+        send_line("ERR timeout");
+        return;
+    }
+
+    start = BootTiming_Cycles();
+    if (!Flash_WriteData(addr, block, len)) {
+        snprintf(reply, sizeof(reply), "ERR program 0x%08lX", (unsigned long)addr);
+        send_line(reply);
+        return;
+    }
+    program_us += BootTiming_CyclesToUs(BootTiming_Cycles() - start);
+
+    start = BootTiming_Cycles();
+    if (memcmp((const void *)addr, block, len) != 0) {
+        snprintf(reply, sizeof(reply), "ERR verify 0x%08lX", (unsigned long)addr);
+        send_line(reply);
+        return;
+    }
+    verify_us += BootTiming_CyclesToUs(BootTiming_Cycles() - start);
+
+    bytes_programmed += len;
+    snprintf(reply, sizeof(reply), "WRITE OK 0x%08lX", (unsigned long)addr);
+    send_line(reply);
+}
+
+static void cmd_sha256(const char *args)
+{
+    sha256_ctx_t ctx;
+    uint8_t digest[32];
+    char reply[8 + 64 + 1];
+    uint32_t addr, len, i;
+
+    if (!parse_range(args, &addr, &len)) {
+        send_line("ERR range");
+        return;
+    }
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, (const uint8_t *)addr, len);
+    SHA256_Final(&ctx, digest);
+
+    strcpy(reply, "SHA256 ");
+    for (i = 0; i < 32; ++i)
+        snprintf(&reply[7 + i * 2], 3, "%02x", digest[i]);
+    send_line(reply);
+}
+
+static void cmd_timing(void)
+{
+    char reply[128];
+
+    snprintf(reply, sizeof(reply),
+             "TIMING BYTES=%lu ERASE_MS=%lu PROGRAM_MS=%lu VERIFY_MS=%lu TOTAL_MS=%lu",
+             (unsigned long)bytes_programmed, (unsigned long)(erase_us / 1000),
+             (unsigned long)(program_us / 1000), (unsigned long)(verify_us / 1000),
+             (unsigned long)(HAL_GetTick() - session_start));
+    send_line(reply);
+}
+
+void FactoryFlasher_Run(void)
+{
+    char line[FLASHER_LINE_SIZE];
+    char reply[32];
+
+    huart1.Init.BaudRate = FLASHER_BAUD;
+    HAL_UART_Init(&huart1);
+    rx_dma_start();
+    session_start = HAL_GetTick();
+
+    snprintf(reply, sizeof(reply), "FLASHER READY %lu",
+             (unsigned long)(FLASHER_RX_SIZE - FLASHER_RX_MARGIN));
+    send_line(reply);
+
+    for (;;) {
+        read_line(line, sizeof(line));
+        if (strcmp(line, "PING") == 0) {
+            send_line(reply);
+        } else if (strncmp(line, "ERASE ", 6) == 0) {
+            cmd_erase(line + 6);
+        } else if (strncmp(line, "WRITE ", 6) == 0) {
+            cmd_write(line + 6);
+        } else if (strncmp(line, "SHA256 ", 7) == 0) {
+            cmd_sha256(line + 7);
+        } else if (strcmp(line, "TIMING") == 0) {
+            cmd_timing();
+        } else if (strcmp(line, "RESET") == 0) {
+            send_line("RESET OK");
+            NVIC_SystemReset();
+        } else if (line[0] != '\0') {
+            send_line("ERR command");
+        }
+    }
+}
+
+#endif /* FACTORY_FLASHER */
@@ -8,6 +8,8 @@
 /* USER CODE END Header */
 
 #include "flash_ops.h"
+#include "cellular_update.h"
+#include "events.h"
 #include "stm32f4xx_hal_flash.h"
 #include "stm32f4xx_hal_flash_ex.h"
 #include <string.h>
@@ -33,12 +35,49 @@ typedef struct {
     uint8_t reserved[2];
 } version_header_t;
 
+#define FLASH_SR_ERRORS  (FLASH_SR_OPERR | FLASH_SR_WRPERR | FLASH_SR_PGAERR \
+                        | FLASH_SR_PGPERR | FLASH_SR_PGSERR | FLASH_SR_RDERR)
+
+static uint32_t download_sector = FLASH_SECTOR_DOWNLOAD;
+static volatile flash_dl_state_t download_state = FLASH_DL_UNKNOWN;
+static bool erase_ahead = false;
+
+/* Word-wise: stops at the first programmed word, so a dirty sector costs
+   next to nothing and a blank 128KB one a couple of milliseconds. */
+static bool sector_is_blank(uint32_t address, uint32_t size)
+{
+    const uint32_t *p = (const uint32_t *)address;
+    const uint32_t *end = (const uint32_t *)(address + size);
+
+    while (p < end)
+        if (*p++ != 0xFFFFFFFFu)
+            return false;
+    return true;
+}
+
+static bool in_download_sector(uint32_t address, uint32_t length)
+{
+    uint32_t base = Flash_SectorAddress(download_sector);
+
+    return address < base + FLASH_SECTOR_SIZE_6_7 && address + length > base;
+}
+
+/* Flash_IRQHandler has settled a background erase. */
+static void wait_background_erase(void)
+{
+    while (download_state == FLASH_DL_ERASING)
+        (void)Events_Wait(EVENT_FLASH);
+}
+
 bool Flash_EraseSector(uint32_t sector)
 {
     FLASH_EraseInitTypeDef EraseInitStruct;
     uint32_t SectorError = 0;
     
     if (sector > 7) return false;
+    /* Whatever a cellular download left in an application sector is gone. */
+    if (sector == FLASH_SECTOR_DOWNLOAD || sector == FLASH_SECTOR_CURRENT)
+        CellularUpdate_Forget();
     
     // Unlock Flash
     HAL_FLASH_Unlock();
@@ -56,6 +95,8 @@ bool Flash_EraseSector(uint32_t sector)
     }
     
     HAL_FLASH_Lock();
+    if (sector == download_sector)
+        download_state = FLASH_DL_BLANK;
     return true;
 }
 
@@ -70,6 +111,8 @@ bool Flash_WriteData(uint32_t address, const uint8_t* data, uint32_t length)
     // Address must be 4-byte aligned
     if (address % 4 != 0) return false;
     
+    if (length > 0 && in_download_sector(address, length))
+        download_state = FLASH_DL_DIRTY;
     HAL_FLASH_Unlock();
     
     // Write 32-bit words
@@ -144,13 +187,147 @@ bool Flash_CheckSpaceAvailable(uint32_t required_size)
 
 bool Flash_ProgramFirmwareData(uint32_t offset, const uint8_t* data, uint32_t length)
 {
-    uint32_t address = FLASH_SECTOR_6_ADDRESS + offset;
+    uint32_t address = Flash_SectorAddress(download_sector) + offset;
     
     // Ensure address is 4-byte aligned
     if (address % 4 != 0) return false;
     
-    // Ensure we don't exceed sector 6 boundaries
+    // Ensure we don't exceed the download sector's boundaries
     if ((offset + length) > FLASH_SECTOR_SIZE_6_7) return false;
     
     return Flash_WriteData(address, data, length);
 }
+
+bool Flash_SelectDownloadSector(uint32_t sector)
+{
+    if (sector != FLASH_SECTOR_DOWNLOAD && sector != FLASH_SECTOR_CURRENT)
+        return false;
+    if (sector != download_sector) {
+        wait_background_erase();
+        download_sector = sector;
+        download_state = FLASH_DL_UNKNOWN;
+        erase_ahead = false;
+    }
+    return true;
+}
+
+uint32_t Flash_GetDownloadSector(void)
+{
+    return download_sector;
+}
+
+uint32_t Flash_SectorAddress(uint32_t sector)
+{
+    return (sector == FLASH_SECTOR_CURRENT) ? FLASH_SECTOR_7_ADDRESS : FLASH_SECTOR_6_ADDRESS;
+}
+
+flash_dl_state_t Flash_PrepareDownloadSector(bool allow_erase_ahead)
+{
+    if (download_state == FLASH_DL_UNKNOWN)
+        download_state = sector_is_blank(Flash_SectorAddress(download_sector), FLASH_SECTOR_SIZE_6_7)
+                         ? FLASH_DL_BLANK : FLASH_DL_DIRTY;
+    erase_ahead = allow_erase_ahead && download_state == FLASH_DL_DIRTY;
+    return download_state;
+}
+
+/* Plays the steps from SRAM with the erase started: nothing here may touch
+   flash, literal pools included (they follow the code into .RamFunc).
+   Returns the cycles the erase took. */
+__RAM_FUNC __attribute__((noinline))
+static uint32_t play_steps_erasing(const flash_pin_step_t *steps, uint32_t count, uint32_t cycles_per_ms)
+{
+    uint32_t i, start, hold;
+    uint32_t erase_start = DWT->CYCCNT;
+    uint32_t erase_cycles = 0;
+
+    FLASH->CR |= FLASH_CR_STRT;
+    for (i = 0; i < count; ++i) {
+        if (steps[i].port != NULL)
+            steps[i].port->BSRR = (steps[i].state == GPIO_PIN_SET) ? steps[i].pin : (uint32_t)steps[i].pin << 16;
+        start = DWT->CYCCNT;
+        hold = steps[i].hold_ms * cycles_per_ms;
+        while (DWT->CYCCNT - start < hold)
+            if (erase_cycles == 0 && !(FLASH->SR & FLASH_SR_BSY))
+                erase_cycles = DWT->CYCCNT - erase_start;
+    }
+    while (FLASH->SR & FLASH_SR_BSY)
+        ;
+    if (erase_cycles == 0)
+        erase_cycles = DWT->CYCCNT - erase_start;
+    return erase_cycles;
+}
+
+bool Flash_EraseWhileSequencing(const flash_pin_step_t *steps, uint32_t count, uint32_t *erase_cycles)
+{
+    flash_pin_step_t local[FLASH_PIN_STEPS_MAX];
+    uint32_t cycles_per_ms = SystemCoreClock / 1000;
+    uint32_t start;
+
+    if (!erase_ahead || download_state != FLASH_DL_DIRTY || count > FLASH_PIN_STEPS_MAX)
+        return false;
+    erase_ahead = false;
+    CellularUpdate_Forget();
+    /* The caller's steps may be in flash. */
+    memcpy(local, steps, count * sizeof(local[0]));
+
+    HAL_FLASH_Unlock();
+    while (FLASH->SR & FLASH_SR_BSY)
+        ;
+    FLASH->SR = FLASH_SR_ERRORS | FLASH_SR_EOP;
+    FLASH->CR &= ~(FLASH_CR_PSIZE | FLASH_CR_SNB);
+    FLASH->CR |= FLASH_CR_PSIZE_1 | FLASH_CR_SER | (download_sector << FLASH_CR_SNB_Pos)
+               | FLASH_CR_EOPIE | FLASH_CR_ERRIE;
+    HAL_NVIC_SetPriority(FLASH_IRQn, 0, 0);
+    HAL_NVIC_ClearPendingIRQ(FLASH_IRQn);
+    HAL_NVIC_EnableIRQ(FLASH_IRQn);
+    download_state = FLASH_DL_ERASING;
+
+    start = DWT->CYCCNT;
+    __disable_irq();
+    *erase_cycles = play_steps_erasing(local, count, cycles_per_ms);
+    /* SysTick was masked throughout: give HAL_GetTick the time back. */
+    uwTick += (DWT->CYCCNT - start) / cycles_per_ms;
+    __enable_irq();
+    /* Flash_IRQHandler has run on EOP (or the error flags). */
+    wait_background_erase();
+    HAL_NVIC_DisableIRQ(FLASH_IRQn);
+    return true;
+}
+
+bool Flash_EraseDownloadSector(void)
+{
+    wait_background_erase();
+    if (Flash_PrepareDownloadSector(false) == FLASH_DL_BLANK)
+        return true;
+    return Flash_EraseSector(download_sector);
+}
+
+flash_dl_state_t Flash_GetDownloadSectorState(void)
+{
+    return download_state;
+}
+
+void Flash_IRQHandler(void)
+{
+    uint32_t sr = FLASH->SR;
+
+    FLASH->SR = sr & (FLASH_SR_ERRORS | FLASH_SR_EOP);
+    FLASH->CR &= ~(FLASH_CR_SER | FLASH_CR_SNB | FLASH_CR_EOPIE | FLASH_CR_ERRIE);
+    HAL_FLASH_Lock();
+
+    /* As HAL_FLASHEx_Erase: drop cache lines of the erased sector. */
+    if (FLASH->ACR & FLASH_ACR_ICEN) {
+        __HAL_FLASH_INSTRUCTION_CACHE_DISABLE();
+        __HAL_FLASH_INSTRUCTION_CACHE_RESET();
+        __HAL_FLASH_INSTRUCTION_CACHE_ENABLE();
+    }
+    if (FLASH->ACR & FLASH_ACR_DCEN) {
+        __HAL_FLASH_DATA_CACHE_DISABLE();
+        __HAL_FLASH_DATA_CACHE_RESET();
+        __HAL_FLASH_DATA_CACHE_ENABLE();
+    }
+
+    if (download_state == FLASH_DL_ERASING)
+        download_state = (sr & FLASH_SR_ERRORS) ? FLASH_DL_DIRTY : FLASH_DL_BLANK;
+    Events_Post(EVENT_FLASH);
+}
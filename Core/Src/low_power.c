@@ -0,0 +1,262 @@
+/**
+  ******************************************************************************
+  * @file    low_power.c
+  * @brief   Stop mode with wake-up on a UART receive line or the RTC
+  *          wake-up timer, and the clock restore after it.
+  ******************************************************************************
+  */
+
+#include "low_power.h"
+#include "boot_timing.h"
+#include "events.h"
+
+#define RTC_WAKEUP_EXTI_LINE  EXTI_IMR_MR22
+#define CLOCK_READY_SPINS     1000000u   /* HSE start-up is ~2 ms at most */
+#define RTC_FLAG_SPINS        100000u    /* WUTWF, RSF: two RTCCLK periods */
+
+static uint32_t rtc_hz;   /* RTCCLK, 0 until the RTC is claimed */
+
+/* Use the RTC as the application left it; see low_power.h. */
+static bool rtc_claim(void)
+{
+    uint32_t bdcr = RCC->BDCR;
+    uint32_t start;
+
+    if (rtc_hz != 0)
+        return true;
+    if (!(bdcr & RCC_BDCR_RTCEN))
+        return false;
+
+    if ((bdcr & RCC_BDCR_RTCSEL) == RCC_BDCR_RTCSEL_1) {
+        /* LSION does not survive a reset, RTCSEL does. */
+        RCC->CSR |= RCC_CSR_LSION;
+        start = HAL_GetTick();
+        while (!(RCC->CSR & RCC_CSR_LSIRDY))
+            if (HAL_GetTick() - start > 2)
+                return false;
+        rtc_hz = LSI_VALUE;
+    } else if ((bdcr & RCC_BDCR_RTCSEL) == RCC_BDCR_RTCSEL_0 && (bdcr & RCC_BDCR_LSERDY)) {
+        rtc_hz = LSE_VALUE;
+    } else {
+        return false;
+    }
+    /* The RTC registers are write protected without it. */
+    __HAL_RCC_PWR_CLK_ENABLE();
+    PWR->CR |= PWR_CR_DBP;
+    return true;
+}
+
+static bool rtc_wait_flag(uint32_t flag)
+{
+    uint32_t spins = RTC_FLAG_SPINS;
+
+    while (!(RTC->ISR & flag))
+        if (--spins == 0)
+            return false;
+    return true;
+}
+
+static void rtc_clear_flag(uint32_t flag)
+{
+    RTC->ISR = (~(flag | RTC_ISR_INIT) & 0x0000FFFFu) | (RTC->ISR & RTC_ISR_INIT);
+}
+
+static uint32_t bcd_field(uint32_t reg, uint32_t tens_mask, uint32_t tens_pos,
+                          uint32_t units_mask, uint32_t units_pos)
+{
+    return ((reg & tens_mask) >> tens_pos) * 10 + ((reg & units_mask) >> units_pos);
+}
+
+/* Calendar time of day in subsecond steps (RTCCLK / (PREDIV_A + 1)). The
+   shadow registers stop in Stop and after a reset: resynchronise first. */
+static bool rtc_read_steps(uint32_t *steps)
+{
+    uint32_t prediv_s = RTC->PRER & RTC_PRER_PREDIV_S;
+    uint32_t ssr, tr, hours, seconds;
+
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+    rtc_clear_flag(RTC_ISR_RSF);
+    RTC->WPR = 0xFF;
+    if (!rtc_wait_flag(RTC_ISR_RSF))
+        return false;
+    ssr = RTC->SSR;
+    tr = RTC->TR;
+    (void)RTC->DR;   /* reading SSR or TR locks the shadows until DR is read */
+
+    hours = bcd_field(tr, RTC_TR_HT, RTC_TR_HT_Pos, RTC_TR_HU, RTC_TR_HU_Pos);
+    if (RTC->CR & RTC_CR_FMT)
+        hours = hours % 12 + ((tr & RTC_TR_PM) ? 12 : 0);
+    seconds = hours * 3600
+            + bcd_field(tr, RTC_TR_MNT, RTC_TR_MNT_Pos, RTC_TR_MNU, RTC_TR_MNU_Pos) * 60
+            + bcd_field(tr, RTC_TR_ST, RTC_TR_ST_Pos, RTC_TR_SU, RTC_TR_SU_Pos);
+    *steps = seconds * (prediv_s + 1) + (prediv_s - ssr);
+    return true;
+}
+
+/* Milliseconds from one rtc_read_steps() to a later one, across midnight. */
+static uint32_t rtc_elapsed_ms(uint32_t from, uint32_t to)
+{
+    uint32_t prediv_s = RTC->PRER & RTC_PRER_PREDIV_S;
+    uint32_t prediv_a = (RTC->PRER & RTC_PRER_PREDIV_A) >> RTC_PRER_PREDIV_A_Pos;
+    uint32_t steps = (to >= from) ? to - from : to + (86400u * (prediv_s + 1) - from);
+
+    return (uint32_t)(((uint64_t)steps * 1000u * (prediv_a + 1)) / rtc_hz);
+}
+
+/* Wake-up timer at RTCCLK/16 (WUCKSEL = 0), routed to EXTI 22 as an event.
+   false if the timer did not become writable. */
+static bool rtc_arm(uint32_t ms)
+{
+    uint32_t ticks = (uint32_t)(((uint64_t)ms * (rtc_hz / 16)) / 1000);
+
+    if (ticks == 0)
+        ticks = 1;
+    if (ticks > 0x10000)
+        ticks = 0x10000;
+
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+    RTC->CR &= ~(RTC_CR_WUTE | RTC_CR_WUTIE);
+    if (!rtc_wait_flag(RTC_ISR_WUTWF)) {
+        RTC->WPR = 0xFF;
+        return false;
+    }
+    RTC->WUTR = ticks - 1;
+    RTC->CR = (RTC->CR & ~RTC_CR_WUCKSEL) | RTC_CR_WUTIE | RTC_CR_WUTE;
+    rtc_clear_flag(RTC_ISR_WUTF);
+    RTC->WPR = 0xFF;
+
+    EXTI->PR = RTC_WAKEUP_EXTI_LINE;
+    EXTI->RTSR |= RTC_WAKEUP_EXTI_LINE;
+    EXTI->EMR |= RTC_WAKEUP_EXTI_LINE;
+    return true;
+}
+
+/* true if the timer had run out. */
+static bool rtc_disarm(void)
+{
+    bool fired = (RTC->ISR & RTC_ISR_WUTF) != 0;
+
+    EXTI->EMR &= ~RTC_WAKEUP_EXTI_LINE;
+    EXTI->RTSR &= ~RTC_WAKEUP_EXTI_LINE;
+    EXTI->PR = RTC_WAKEUP_EXTI_LINE;
+
+    RTC->WPR = 0xCA;
+    RTC->WPR = 0x53;
+    RTC->CR &= ~(RTC_CR_WUTE | RTC_CR_WUTIE);
+    rtc_clear_flag(RTC_ISR_WUTF);
+    RTC->WPR = 0xFF;
+    return fired;
+}
+
+/* The pin stays in its alternate function: EXTI sees the input anyway. */
+static void rx_arm(GPIO_TypeDef *port, uint16_t pin)
+{
+    uint32_t line = POSITION_VAL(pin);
+
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+    SYSCFG->EXTICR[line >> 2] = (SYSCFG->EXTICR[line >> 2] & ~(0xFu << (4 * (line & 3))))
+                              | ((uint32_t)GPIO_GET_INDEX(port) << (4 * (line & 3)));
+    EXTI->PR = pin;
+    EXTI->FTSR |= pin;
+    EXTI->EMR |= pin;
+}
+
+static void rx_disarm(uint16_t pin)
+{
+    EXTI->EMR &= ~(uint32_t)pin;
+    EXTI->FTSR &= ~(uint32_t)pin;
+    EXTI->PR = pin;
+}
+
+/* huart's BRR for its baud rate with the kernel clock now on HSI. */
+static uint32_t hsi_brr(UART_HandleTypeDef *huart)
+{
+    uint32_t cfgr = RCC->CFGR;
+    uint32_t hclk = HSI_VALUE >> AHBPrescTable[(cfgr & RCC_CFGR_HPRE) >> RCC_CFGR_HPRE_Pos];
+    uint32_t pclk;
+
+    if (huart->Instance == USART1 || huart->Instance == USART6)
+        pclk = hclk >> APBPrescTable[(cfgr & RCC_CFGR_PPRE2) >> RCC_CFGR_PPRE2_Pos];
+    else
+        pclk = hclk >> APBPrescTable[(cfgr & RCC_CFGR_PPRE1) >> RCC_CFGR_PPRE1_Pos];
+    if (huart->Init.OverSampling == UART_OVERSAMPLING_8)
+        return UART_BRR_SAMPLING8(pclk, huart->Init.BaudRate);
+    return UART_BRR_SAMPLING16(pclk, huart->Init.BaudRate);
+}
+
+static void wait_clock_flag(volatile uint32_t *reg, uint32_t mask, uint32_t value)
+{
+    uint32_t spins = CLOCK_READY_SPINS;
+
+    while ((*reg & mask) != value)
+        if (--spins == 0)
+            Error_Handler();
+}
+
+/* Back to the oscillators and system clock switch found on entry. The PLL
+   factors, prescalers and flash latency are kept through Stop. */
+static void restore_clocks(uint32_t cr, uint32_t sw)
+{
+    if (cr & RCC_CR_HSEON) {
+        RCC->CR |= RCC_CR_HSEON;
+        wait_clock_flag(&RCC->CR, RCC_CR_HSERDY, RCC_CR_HSERDY);
+    }
+    if (cr & RCC_CR_PLLON) {
+        RCC->CR |= RCC_CR_PLLON;
+        wait_clock_flag(&RCC->CR, RCC_CR_PLLRDY, RCC_CR_PLLRDY);
+    }
+    RCC->CFGR = (RCC->CFGR & ~RCC_CFGR_SW) | sw;
+    wait_clock_flag(&RCC->CFGR, RCC_CFGR_SWS, sw << RCC_CFGR_SWS_Pos);
+}
+
+bool LowPower_StopUntilRx(GPIO_TypeDef *rx_port, uint16_t rx_pin,
+                          UART_HandleTypeDef *huart, uint32_t max_ms)
+{
+    uint32_t cr = RCC->CR & (RCC_CR_HSEON | RCC_CR_PLLON);
+    uint32_t sw = RCC->CFGR & RCC_CFGR_SW;
+    uint32_t brr = huart->Instance->BRR;
+    uint32_t before, after, slept = 0;
+    bool timed_out, measured;
+
+    if (max_ms > LOW_POWER_STOP_MAX_MS)
+        max_ms = LOW_POWER_STOP_MAX_MS;
+    if (!rtc_claim() || !rtc_arm(max_ms)) {
+        (void)Events_Wait(0);
+        return false;
+    }
+    measured = rtc_read_steps(&before);
+    rx_arm(rx_port, rx_pin);
+    HAL_SuspendTick();
+
+    /* Low-power regulator, flash left powered for the shorter wake-up. */
+    PWR->CR = (PWR->CR & ~(PWR_CR_PDDS | PWR_CR_FPDS)) | PWR_CR_LPDS;
+    SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+    /* Clear a stale event first, so the second WFE really stops. */
+    __SEV();
+    __WFE();
+    __WFE();
+    SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+
+    /* Running on HSI from here: keep the line readable while HSE and the
+       PLL come back. */
+    if (sw != RCC_CFGR_SW_HSI)
+        huart->Instance->BRR = hsi_brr(huart);
+    restore_clocks(cr, sw);
+    huart->Instance->BRR = brr;
+
+    rx_disarm(rx_pin);
+    timed_out = rtc_disarm();
+    /* SysTick and CYCCNT stood still: put the time slept on the HAL tick
+       and the boot timeline. */
+    measured = measured && rtc_read_steps(&after);
+    if (measured)
+        slept = rtc_elapsed_ms(before, after);
+    else if (timed_out)
+        slept = max_ms;
+    uwTick += slept;
+    BootTiming_AddSleep(slept);
+    HAL_ResumeTick();
+    return !timed_out;
+}
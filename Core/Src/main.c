@@ -24,6 +24,18 @@
 #include <stdio.h>
 #include "bootloader_logic.h"
 #include "bootloader_download.h"
+#include "boot_timing.h"
+#include "clock_profile.h"
+#include "transport_ble.h"
+#include "transport_wifi.h"
+#include "stephano.h"
+#include "cellular_update.h"
+#include "modem_n58.h"
+#include "transport_uart.h"
+#include "factory_flasher.h"
+#include "boot_shared.h"
+#include "param_store.h"
+#include "session_stats.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -33,7 +45,9 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+#ifndef BOOTLOADER_DEBUG_ENABLE
 #define BOOTLOADER_DEBUG_ENABLE 1
+#endif
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -71,7 +85,7 @@ int main(void)
 {
 
   /* USER CODE BEGIN 1 */
-
+  BootTiming_Init();
   /* USER CODE END 1 */
 
   /* MCU Configuration--------------------------------------------------------*/
@@ -82,13 +96,17 @@ int main(void)
   /* USER CODE BEGIN Init */
   /* Enable interrupts - BootOnlyBootloader disables them before jumping here */
   __enable_irq();
+  /* Counted on HSI until now: SystemClock_Config() changes the clock. */
+  BootTiming_Resync();
   /* USER CODE END Init */
 
   /* Configure the system clock */
   SystemClock_Config();
 
   /* USER CODE BEGIN SysInit */
-
+  /* Full speed for the boot-time hashing and any flash work; the radio
+     waits drop to CLOCK_PROFILE_LOW, the hand-off returns to the above. */
+  (void)ClockProfile_Set(CLOCK_PROFILE_FAST);
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
@@ -96,7 +114,20 @@ int main(void)
   MX_USART2_UART_Init();
   MX_USART1_UART_Init();
   /* USER CODE BEGIN 2 */
-
+  BootTiming_Mark(BOOT_PHASE_HAL_INIT);
+#ifdef FACTORY_FLASHER
+  /* RAM-loaded factory flasher build: serve the wire, never boot. */
+  FactoryFlasher_Run();
+#endif
+  /* The module takes 1.5 s of power-up holds plus its own boot: start it
+     now, alongside the sector scan; handing over to the application
+     cancels it. */
+  Stephano_PowerUpBegin();
+  /* Index the parameter store; a board with the old WELL_ID block gets it
+     moved in here, once. */
+  ParamStore_Init();
+  /* A session that failed before the last reset left its record in RAM. */
+  SessionStats_PersistDeferred();
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -114,8 +145,45 @@ int main(void)
   }
 #endif
 
-  /* Run second-stage bootloader: sector 6/7 search, jump, or BLE download */
-  Bootloader_Run();
+  /* Application-requested update check (mailbox + software reset). */
+  bool update_requested = BootShared_TakeRequest() == BOOT_REQUEST_UPDATE_CHECK;
+  bool wired = false;
+#if BOOTLOADER_ENABLE_WIRED
+  /* Bench/factory: strap or magic sequence on USART1 skips the normal boot.
+     The image still lands in sector 6 and is verified by the first stage. */
+  wired = TransportUart_Requested();
+#endif
+
+  if (wired)
+  {
+    Bootloader_SetTransport(TransportUart_Get());
+  }
+  else if (!update_requested)
+  {
+    /* Run second-stage bootloader: sector 6/7 search, jump, or BLE download */
+    Bootloader_Run();
+
+#if BOOTLOADER_ENABLE_CELLULAR
+    /* Cellular download first; returns only if it could not complete. */
+    CellularUpdate_Run(ModemN58_Get());
+#endif
+
+#if BOOTLOADER_ENABLE_WIFI
+    Bootloader_SetTransport(TransportWifi_Get());
+#endif
+  }
+  else
+  {
+    /* The application asked for an update check; the image it runs from
+       is known good, so only fetch over cellular if the server has a
+       different version, then go on to the BLE session. */
+#if BOOTLOADER_ENABLE_CELLULAR
+    CellularUpdate_Check(ModemN58_Get());
+#endif
+    /* Nobody may be there to answer: give up and boot it again. */
+    TransportBle_SetAdvertisingTimeout(BOOTLOADER_REQUEST_ADV_MS);
+    Bootloader_SetIdleTimeout(BOOTLOADER_REQUEST_IDLE_MS);
+  }
 
   /* Connect to the download server. This is connect or die trying effort, so no need for status checking. */
   Bootloader_ConnectToServer();
@@ -127,8 +195,9 @@ int main(void)
     HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
   }
 #endif
+    /* Does not return: the session ends in a reset or a jump, and idles
+       in WFI between events. */
     Bootloader_Download_Process();
-    HAL_Delay(10);
   }
   /* USER CODE END 3 */
 }
@@ -330,6 +399,20 @@ static void MX_GPIO_Init(void)
 }
 
 /* USER CODE BEGIN 4 */
+/* UART receive complete: pass the byte to the driver that owns the port. */
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+  if (huart == STEPHANO_UART_PTR)
+    Stephano_UartRxCplt();
+#if BOOTLOADER_ENABLE_WIRED
+  else if (huart == &huart1 && TransportUart_Active())
+    TransportUart_UartRxCplt();
+#endif
+#if BOOTLOADER_ENABLE_CELLULAR
+  else if (huart == &huart1)
+    ModemN58_UartRxCplt();
+#endif
+}
 
 /* USER CODE END 4 */
 
@@ -0,0 +1,318 @@
+/**
+  ******************************************************************************
+  * @file    modem_n58.c
+  * @brief   Neoway N58 modem driver: AT commands and built-in TCP socket over
+  *          USART1, received interrupt-driven into a line buffer (responses)
+  *          and a payload ring (+TCPRECV data).
+  ******************************************************************************
+  */
+
+#include "modem_n58.h"
+#include "spsc_ring.h"
+#include "events.h"
+#include "main.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N58_RX_BUFFER_SIZE      8192   /* must be a power of two (spsc_ring) */
+#define N58_LINE_SIZE           128
+#define N58_RESP_SIZE           512
+#define N58_LINK                0      /* the one TCP link we use */
+
+#define N58_READY_TIMEOUT_MS    15000
+#define N58_REGISTER_TIMEOUT_MS 60000
+#define N58_PPP_TIMEOUT_MS      30000
+#define N58_CONNECT_TIMEOUT_MS  20000
+#define N58_SEND_TIMEOUT_MS     5000
+
+#include "stm32f4xx_hal_uart.h"
+extern UART_HandleTypeDef huart1;
+
+static uint8_t rx_buffer[N58_RX_BUFFER_SIZE];
+static spsc_ring_t rx_ring;
+static uint8_t uart_rx_byte;
+
+/* ISR-side parser state. */
+static char line[N58_LINE_SIZE];
+static uint32_t line_len;
+static uint32_t payload_left;          /* +TCPRECV data bytes still to come */
+
+/* Response lines since the last command, '\n' separated, NUL terminated. */
+static volatile char resp[N58_RESP_SIZE];
+static volatile uint32_t resp_len;
+static volatile bool prompt_seen;
+static volatile bool link_open;
+
+/* Append a completed line to the response text, or act on a URC. */
+static void line_done(void)
+{
+    uint32_t i;
+
+    line[line_len] = '\0';
+    if (strncmp(line, "+TCPCLOSE:", 10) == 0 || strncmp(line, "+TCPSETUP:0,FAIL", 16) == 0)
+        link_open = false;
+    if (resp_len + line_len + 2 > N58_RESP_SIZE)
+        return;
+    for (i = 0; i < line_len; ++i)
+        resp[resp_len++] = line[i];
+    resp[resp_len++] = '\n';
+    resp[resp_len] = '\0';
+}
+
+/* "+TCPRECV:<link>,<len>," - switch to payload once both fields are in. */
+static void check_recv_header(void)
+{
+    uint32_t commas = 0, i;
+
+    if (line_len < 9 || strncmp(line, "+TCPRECV:", 9) != 0)
+        return;
+    for (i = 9; i < line_len; ++i)
+        if (line[i] == ',')
+            commas++;
+    if (commas == 2) {
+        line[line_len] = '\0';
+        payload_left = strtoul(strchr(line + 9, ',') + 1, NULL, 10);
+        line_len = 0;
+    }
+}
+
+static void n58_rx_byte(uint8_t b)
+{
+    if (payload_left > 0) {
+        (void)SpscRing_Put(&rx_ring, b);
+        Events_Post(EVENT_RX);
+        payload_left--;
+        return;
+    }
+    switch (b) {
+    case '\r':
+        break;
+    case '\n':
+        if (line_len > 0)
+            line_done();
+        line_len = 0;
+        break;
+    case '>':
+        if (line_len == 0) {
+            prompt_seen = true;
+            break;
+        }
+        /* fall through */
+    default:
+        if (line_len < N58_LINE_SIZE - 1)
+            line[line_len++] = (char)b;
+        if (b == ',')
+            check_recv_header();
+        break;
+    }
+}
+
+void ModemN58_UartRxCplt(void)
+{
+    n58_rx_byte(uart_rx_byte);
+    HAL_UART_Receive_IT(&huart1, &uart_rx_byte, 1);
+}
+
+static void resp_clear(void)
+{
+    __disable_irq();
+    resp_len = 0;
+    resp[0] = '\0';
+    prompt_seen = false;
+    __enable_irq();
+}
+
+static bool resp_has(const char *token)
+{
+    return strstr((const char *)resp, token) != NULL;
+}
+
+/* Wait for token (or the '>' prompt when token is NULL) in what the modem
+   has sent since resp_clear(). Unlike AT_SendCommand this returns as soon
+   as the answer is in; "ERROR" and "FAIL" end the wait early. */
+static bool wait_for(const char *token, uint32_t timeout_ms)
+{
+    uint32_t start = HAL_GetTick();
+
+    while (HAL_GetTick() - start < timeout_ms) {
+        if (token == NULL ? prompt_seen : resp_has(token))
+            return true;
+        if (resp_has("ERROR") || resp_has("FAIL"))
+            return false;
+    }
+    return false;
+}
+
+static bool n58_write(const uint8_t *data, uint32_t len)
+{
+    return HAL_UART_Transmit(&huart1, (uint8_t *)data, (uint16_t)len, 2000) == HAL_OK;
+}
+
+static bool n58_command(const char *cmd, const char *expect, uint32_t timeout_ms)
+{
+    resp_clear();
+    if (!n58_write((const uint8_t *)cmd, strlen(cmd)) || !n58_write((const uint8_t *)"\r\n", 2))
+        return false;
+    return wait_for(expect, timeout_ms);
+}
+
+/* Repeat cmd once a second until check() accepts the answer or timeout_ms
+   runs out. */
+static bool poll_for(const char *cmd, bool (*check)(void), uint32_t timeout_ms)
+{
+    uint32_t start = HAL_GetTick();
+
+    do {
+        if (n58_command(cmd, "OK", 1000) && check())
+            return true;
+        HAL_Delay(1000);
+    } while (HAL_GetTick() - start < timeout_ms);
+    return false;
+}
+
+static bool answered(void)
+{
+    return true;
+}
+
+/* +CREG: <n>,<stat>: registered home (1) or roaming (5). */
+static bool registered(void)
+{
+    return resp_has(",1") || resp_has(",5");
+}
+
+/* +XIIC: <state>,<ip>: state 1 once PPP is up. */
+static bool ppp_up(void)
+{
+    const char *p = strstr((const char *)resp, "+XIIC:");
+
+    if (p == NULL)
+        return false;
+    p += 6;
+    while (*p == ' ')
+        p++;
+    return *p == '1';
+}
+
+static bool n58_power_on(const char **error)
+{
+    SpscRing_Init(&rx_ring, rx_buffer, sizeof(rx_buffer));
+    line_len = 0;
+    payload_left = 0;
+    link_open = false;
+    resp_clear();
+
+    /* USART1 is the debug port otherwise; give it its interrupt. */
+    HAL_NVIC_SetPriority(USART1_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(USART1_IRQn);
+
+    HAL_GPIO_WritePin(n_3GON_GPIO_Port, n_3GON_Pin, GPIO_PIN_SET);
+    HAL_Delay(500);
+    HAL_GPIO_WritePin(n_3GON_GPIO_Port, n_3GON_Pin, GPIO_PIN_RESET);
+    HAL_UART_Receive_IT(&huart1, &uart_rx_byte, 1);
+
+    if (!poll_for("AT", answered, N58_READY_TIMEOUT_MS)) {
+        *error = "N58 not responding";
+        return false;
+    }
+    (void)n58_command("ATE0", "OK", 1000);
+    return true;
+}
+
+static bool n58_attach(const char **error)
+{
+    char cmd[96];
+
+    if (!n58_command("AT+CPIN?", "+CPIN: READY", 5000)) {
+        *error = "SIM not ready";
+        return false;
+    }
+    snprintf(cmd, sizeof(cmd), "AT+CGDCONT=1,\"IP\",\"%s\"", BOOTLOADER_CELL_APN);
+    if (!n58_command(cmd, "OK", 1000)) {
+        *error = "AT+CGDCONT failed";
+        return false;
+    }
+    if (!poll_for("AT+CREG?", registered, N58_REGISTER_TIMEOUT_MS)) {
+        *error = "Network registration timeout";
+        return false;
+    }
+    if (!n58_command("AT+XIIC=1", "OK", 5000)) {
+        *error = "AT+XIIC failed";
+        return false;
+    }
+    if (!poll_for("AT+XIIC?", ppp_up, N58_PPP_TIMEOUT_MS)) {
+        *error = "PPP timeout";
+        return false;
+    }
+    return true;
+}
+
+static bool n58_tcp_open(const char *host, uint16_t port, const char **error)
+{
+    char cmd[128];
+
+    SpscRing_Init(&rx_ring, rx_buffer, sizeof(rx_buffer));
+    snprintf(cmd, sizeof(cmd), "AT+TCPSETUP=%d,%s,%u", N58_LINK, host, (unsigned int)port);
+    if (!n58_command(cmd, "+TCPSETUP:0,OK", N58_CONNECT_TIMEOUT_MS)) {
+        *error = "AT+TCPSETUP failed";
+        return false;
+    }
+    link_open = true;
+    return true;
+}
+
+static bool n58_tcp_send(const uint8_t *data, uint32_t len)
+{
+    char cmd[32];
+
+    if (!link_open)
+        return false;
+    snprintf(cmd, sizeof(cmd), "AT+TCPSEND=%d,%lu", N58_LINK, (unsigned long)len);
+    if (!n58_command(cmd, NULL, N58_SEND_TIMEOUT_MS))
+        return false;
+    if (!n58_write(data, len))
+        return false;
+    return wait_for("+TCPSEND:0,", N58_SEND_TIMEOUT_MS);
+}
+
+static uint32_t n58_tcp_recv(uint8_t *dst, uint32_t len, uint32_t timeout_ms)
+{
+    uint32_t start = HAL_GetTick();
+
+    while (SpscRing_Count(&rx_ring) == 0) {
+        if (!link_open || HAL_GetTick() - start >= timeout_ms)
+            return 0;
+    }
+    return SpscRing_Read(&rx_ring, dst, len);
+}
+
+static void n58_tcp_close(void)
+{
+    if (link_open)
+        (void)n58_command("AT+TCPCLOSE=0", "+TCPCLOSE:0", 2000);
+    link_open = false;
+}
+
+static void n58_power_off(void)
+{
+    n58_tcp_close();
+    HAL_UART_AbortReceive_IT(&huart1);
+    HAL_GPIO_WritePin(n_3GON_GPIO_Port, n_3GON_Pin, GPIO_PIN_SET);
+}
+
+static const modem_ops_t n58_ops = {
+    .name = "N58",
+    .power_on = n58_power_on,
+    .attach = n58_attach,
+    .tcp_open = n58_tcp_open,
+    .tcp_send = n58_tcp_send,
+    .tcp_recv = n58_tcp_recv,
+    .tcp_close = n58_tcp_close,
+    .power_off = n58_power_off,
+};
+
+const modem_ops_t *ModemN58_Get(void)
+{
+    return &n58_ops;
+}
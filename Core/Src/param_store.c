@@ -0,0 +1,374 @@
+/**
+  ******************************************************************************
+  * @file    param_store.c
+  * @brief   Append-only key/value store in flash sectors 2 and 3.
+  ******************************************************************************
+  */
+
+#include "param_store.h"
+#include "flash_ops.h"
+#include <string.h>
+
+#define PARAM_SECTOR_MAGIC    0x4D524150u  /* "PARM" */
+#define PARAM_ERASED_WORD     0xFFFFFFFFu
+#define PARAM_KEY_INVALID     0xFFFFu
+#define LEGACY_WELL_ID_MAGIC  0x57454C4Cu  /* "WELL", the old fixed block */
+
+/* Sector 3 starts with the old fixed block: "WELL", the ID, 0xFFFF. The
+   store area behind it is the same size in both sectors. */
+#define LEGACY_SLOT_SIZE      8u
+#define STORE_A_ADDRESS       FLASH_SECTOR_PARAMS_A_ADDRESS
+#define STORE_B_ADDRESS       (FLASH_SECTOR_PARAMS_B_ADDRESS + LEGACY_SLOT_SIZE)
+#define STORE_SIZE            (FLASH_SECTOR_PARAMS_SIZE - LEGACY_SLOT_SIZE)
+
+/* At the start of each sector. Programmed after the records it carries,
+   seq before magic, so a copy cut short never looks valid. The valid
+   sector with the higher seq is the active one. */
+typedef struct {
+    uint32_t seq;
+    uint32_t magic;
+} param_sector_t;
+
+/* Followed by len value bytes, padded to a word with 0xFF. The header
+   word goes first, then the value, the CRC last. */
+typedef struct {
+    uint16_t key;
+    uint8_t len;
+    uint8_t reserved;   /* 0xFF */
+    uint32_t crc;       /* CRC-32 of key, len and value */
+} param_record_t;
+
+#define RECORD_SIZE(len)  (sizeof(param_record_t) + (((uint32_t)(len) + 3u) & ~3u))
+
+typedef struct {
+    uint16_t key;
+    const param_record_t *rec;   /* latest record for key */
+} param_entry_t;
+
+typedef struct {
+    uint16_t key;
+    const param_record_t *rec;
+} param_find_t;
+
+static param_entry_t entries[PARAM_STORE_MAX_KEYS];
+static uint32_t entry_count;
+static uint32_t active;      /* store base of the active sector, 0 if none */
+static uint32_t write_off;   /* next free offset in it */
+static bool loaded;
+
+uint32_t ParamStore_Crc32(uint32_t crc, const void *data, uint32_t n)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    uint32_t k;
+
+    crc = ~crc;
+    while (n--) {
+        crc ^= *p++;
+        for (k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+
+static uint32_t record_crc(uint16_t key, uint8_t len, const uint8_t *value)
+{
+    const uint8_t head[3] = { (uint8_t)key, (uint8_t)(key >> 8), len };
+
+    return ParamStore_Crc32(ParamStore_Crc32(0, head, sizeof(head)), value, len);
+}
+
+static const uint8_t *record_value(const param_record_t *rec)
+{
+    return (const uint8_t *)(rec + 1);
+}
+
+static bool sector_valid(uint32_t base, uint32_t *seq)
+{
+    const param_sector_t *s = (const param_sector_t *)base;
+
+    if (s->magic != PARAM_SECTOR_MAGIC || s->seq == PARAM_ERASED_WORD)
+        return false;
+    *seq = s->seq;
+    return true;
+}
+
+/* Base of the active sector, 0 if neither holds a store. */
+static uint32_t find_active(uint32_t *seq)
+{
+    uint32_t seq_a, seq_b;
+    bool a = sector_valid(STORE_A_ADDRESS, &seq_a);
+    bool b = sector_valid(STORE_B_ADDRESS, &seq_b);
+
+    if (a && (!b || seq_a > seq_b)) {
+        *seq = seq_a;
+        return STORE_A_ADDRESS;
+    }
+    if (b) {
+        *seq = seq_b;
+        return STORE_B_ADDRESS;
+    }
+    return 0;
+}
+
+/* Call visit on each intact record of the sector at base, oldest first.
+   Returns the offset of the first free word; a damaged record (torn by a
+   reset) ends the walk and returns the store size, so the next append
+   compacts rather than writing behind it. */
+static uint32_t walk(uint32_t base, void (*visit)(const param_record_t *, void *), void *ctx)
+{
+    uint32_t off = sizeof(param_sector_t);
+
+    while (off + sizeof(param_record_t) <= STORE_SIZE) {
+        const param_record_t *rec = (const param_record_t *)(base + off);
+
+        if (*(const uint32_t *)rec == PARAM_ERASED_WORD)
+            return off;
+        if (rec->key == PARAM_KEY_INVALID || rec->len == 0 || rec->len > PARAM_VALUE_MAX
+            || off + RECORD_SIZE(rec->len) > STORE_SIZE
+            || rec->crc != record_crc(rec->key, rec->len, record_value(rec)))
+            return STORE_SIZE;
+        visit(rec, ctx);
+        off += RECORD_SIZE(rec->len);
+    }
+    return STORE_SIZE;
+}
+
+static const param_record_t *lookup(uint16_t key)
+{
+    uint32_t i;
+
+    for (i = 0; i < entry_count; i++)
+        if (entries[i].key == key)
+            return entries[i].rec;
+    return NULL;
+}
+
+/* Later records replace earlier ones. A key past the index size can only
+   come from a newer firmware; it is dropped at the next compaction. */
+static void index_visit(const param_record_t *rec, void *ctx)
+{
+    uint32_t i;
+
+    (void)ctx;
+    for (i = 0; i < entry_count; i++) {
+        if (entries[i].key == rec->key) {
+            entries[i].rec = rec;
+            return;
+        }
+    }
+    if (entry_count < PARAM_STORE_MAX_KEYS) {
+        entries[entry_count].key = rec->key;
+        entries[entry_count].rec = rec;
+        entry_count++;
+    }
+}
+
+static void find_visit(const param_record_t *rec, void *ctx)
+{
+    param_find_t *find = (param_find_t *)ctx;
+
+    if (rec->key == find->key)
+        find->rec = rec;
+}
+
+static void load(void)
+{
+    uint32_t seq;
+
+    entry_count = 0;
+    active = find_active(&seq);
+    write_off = active ? walk(active, index_visit, NULL) : STORE_SIZE;
+    loaded = true;
+}
+
+static bool all_erased(uint32_t addr, uint32_t size)
+{
+    const uint32_t *p = (const uint32_t *)addr;
+    const uint32_t *end = (const uint32_t *)(addr + size);
+
+    while (p < end)
+        if (*p++ != PARAM_ERASED_WORD)
+            return false;
+    return true;
+}
+
+/* The ID in the old fixed block at the start of sector 3, if there is one. */
+static bool legacy_well_id(uint16_t *id)
+{
+    const uint32_t *legacy = (const uint32_t *)FLASH_SECTOR_PARAMS_B_ADDRESS;
+
+    if (legacy[0] != LEGACY_WELL_ID_MAGIC)
+        return false;
+    *id = (uint16_t)legacy[1];
+    return true;
+}
+
+/* Ours to erase: a store sector (valid, or a copy cut short before its
+   header went down: header erased, a record behind it) or, in sector 3,
+   the old fixed block. Anything else may belong to someone else. */
+static bool sector_owned(uint32_t store)
+{
+    const param_sector_t *hdr = (const param_sector_t *)store;
+    const param_record_t *first = (const param_record_t *)(hdr + 1);
+    uint16_t id;
+
+    if (hdr->magic == PARAM_SECTOR_MAGIC)
+        return true;
+    if (store == STORE_B_ADDRESS && legacy_well_id(&id))
+        return true;
+    return hdr->seq == PARAM_ERASED_WORD && hdr->magic == PARAM_ERASED_WORD
+        && first->key != PARAM_KEY_INVALID && first->len != 0
+        && first->len <= PARAM_VALUE_MAX && first->reserved == 0xFF;
+}
+
+/* Blank the sector of store for a copy, refusing one that is not ours;
+   in sector 3, put the old fixed block back for applications that still
+   read WELL_ID at its address. */
+static bool prepare_sector(uint32_t store)
+{
+    uint32_t base = (store == STORE_B_ADDRESS) ? FLASH_SECTOR_PARAMS_B_ADDRESS : store;
+    const param_record_t *rec;
+    uint32_t legacy[2];
+    uint16_t id;
+
+    if (!all_erased(base, FLASH_SECTOR_PARAMS_SIZE)) {
+        if (!sector_owned(store))
+            return false;
+        if (!Flash_EraseSector(store == STORE_B_ADDRESS ? FLASH_SECTOR_PARAMS_B : FLASH_SECTOR_PARAMS_A))
+            return false;
+    }
+    rec = lookup(PARAM_WELL_ID);
+    if (store != STORE_B_ADDRESS || rec == NULL || rec->len != sizeof(id))
+        return true;
+    memcpy(&id, record_value(rec), sizeof(id));
+    legacy[0] = LEGACY_WELL_ID_MAGIC;
+    legacy[1] = 0xFFFF0000u | id;
+    return Flash_WriteData(base, (const uint8_t *)legacy, sizeof(legacy));
+}
+
+/* Copy the latest record of every key to the other sector and make it the
+   active one; with no store yet, format sector A. The old sector is left
+   as is: until the new header is down it is still the valid one, and the
+   next compaction erases it. */
+static bool compact(void)
+{
+    uint32_t target = (active == STORE_A_ADDRESS) ? STORE_B_ADDRESS : STORE_A_ADDRESS;
+    uint32_t off = sizeof(param_sector_t);
+    param_sector_t hdr = { 1, PARAM_SECTOR_MAGIC };
+    uint32_t i;
+
+    if (active != 0)
+        hdr.seq = ((const param_sector_t *)active)->seq + 1;
+    if (!prepare_sector(target))
+        return false;
+    for (i = 0; i < entry_count; i++) {
+        uint32_t size = RECORD_SIZE(entries[i].rec->len);
+
+        if (!Flash_WriteData(target + off, (const uint8_t *)entries[i].rec, size))
+            return false;
+        off += size;
+    }
+    if (!Flash_WriteData(target, (const uint8_t *)&hdr, sizeof(hdr)))
+        return false;
+    load();
+    return active == target;
+}
+
+/* Keep the old fixed block in step with WELL_ID. Sector 3 can only be
+   rewritten once the store is out of it: move the store to sector 2
+   first if need be. */
+static void legacy_sync(void)
+{
+    const param_record_t *rec = lookup(PARAM_WELL_ID);
+    uint16_t id, old;
+
+    if (rec == NULL || rec->len != sizeof(id))
+        return;
+    memcpy(&id, record_value(rec), sizeof(id));
+    if (legacy_well_id(&old) && old == id)
+        return;
+    if (active == STORE_B_ADDRESS && !compact())
+        return;
+    (void)prepare_sector(STORE_B_ADDRESS);
+}
+
+void ParamStore_Init(void)
+{
+    uint16_t id;
+
+    load();
+    /* Boards from before the store keep "WELL" and the ID at the start of
+       sector 3; the store starts in sector 2 and leaves the block there. */
+    if (active == 0 && legacy_well_id(&id))
+        (void)ParamStore_Set(PARAM_WELL_ID, &id, sizeof(id));
+    legacy_sync();
+}
+
+bool ParamStore_Get(uint16_t key, void *value, uint32_t size, uint32_t *len)
+{
+    const param_record_t *rec;
+
+    if (!loaded)
+        ParamStore_Init();
+    rec = lookup(key);
+    if (rec == NULL)
+        return false;
+    memcpy(value, record_value(rec), rec->len < size ? rec->len : size);
+    if (len != NULL)
+        *len = rec->len;
+    return true;
+}
+
+bool ParamStore_Set(uint16_t key, const void *value, uint32_t len)
+{
+    const param_record_t *cur;
+    param_record_t rec;
+    uint32_t addr, size = RECORD_SIZE(len);
+
+    if (!loaded)
+        ParamStore_Init();
+    if (key == PARAM_KEY_INVALID || len == 0 || len > PARAM_VALUE_MAX)
+        return false;
+
+    cur = lookup(key);
+    if (cur != NULL && cur->len == len && memcmp(record_value(cur), value, len) == 0)
+        return true;
+    if (cur == NULL && entry_count == PARAM_STORE_MAX_KEYS)
+        return false;
+    if (write_off + size > STORE_SIZE) {
+        if (!compact() || write_off + size > STORE_SIZE)
+            return false;
+    }
+
+    addr = active + write_off;
+    rec.key = key;
+    rec.len = (uint8_t)len;
+    rec.reserved = 0xFF;
+    rec.crc = record_crc(key, (uint8_t)len, (const uint8_t *)value);
+    /* Whatever happens below, this space is spoken for: a failed write
+       leaves the rest of the sector to the next compaction. */
+    write_off = STORE_SIZE;
+    if (!Flash_WriteData(addr, (const uint8_t *)&rec, 4)
+        || !Flash_WriteData(addr + sizeof(rec), (const uint8_t *)value, len)
+        || !Flash_WriteData(addr + 4, (const uint8_t *)&rec.crc, 4))
+        return false;
+    write_off = addr - active + size;
+    index_visit((const param_record_t *)addr, NULL);
+    if (key == PARAM_WELL_ID)
+        legacy_sync();
+    return true;
+}
+
+int32_t ParamStore_Read(uint16_t key, void *value, uint32_t size)
+{
+    param_find_t find = { key, NULL };
+    uint32_t seq, base = find_active(&seq);
+
+    if (base == 0)
+        return -1;
+    (void)walk(base, find_visit, &find);
+    if (find.rec == NULL)
+        return -1;
+    memcpy(value, record_value(find.rec), find.rec->len < size ? find.rec->len : size);
+    return find.rec->len;
+}
@@ -0,0 +1,181 @@
+/**
+  ******************************************************************************
+  * @file    param_sync.c
+  * @brief   Configuration parameter phase: wire names, text form, digest.
+  ******************************************************************************
+  */
+
+#include "param_sync.h"
+#include "param_store.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    PARAM_FORMAT_NUMBER,        /* decimal, stored as uint32 */
+    PARAM_FORMAT_TEXT,          /* printable ASCII, stored without the NUL */
+    PARAM_FORMAT_DESTINATION    /* "-" or any of B, H, W in that order */
+} param_format_t;
+
+typedef struct {
+    const char *name;
+    uint16_t key;
+    param_format_t format;
+    bool write_only;            /* listed as NAME=*, still in the digest */
+} param_def_t;
+
+/* Wire names from the design doc's PARAMETERS list, in PARAMS LIST (and
+   digest) order. Only add at the end. */
+static const param_def_t PARAMS[] = {
+    { "ROD_IDLE_TIME",       PARAM_ROD_IDLE_TIME,       PARAM_FORMAT_NUMBER,      false },
+    { "BLE_REPORT_TIME",     PARAM_BLE_REPORT_TIME,     PARAM_FORMAT_NUMBER,      false },
+    { "HTTPS_SERVER_URL",    PARAM_HTTPS_SERVER_URL,    PARAM_FORMAT_TEXT,        false },
+    { "HTTPS_ENDPOINT",      PARAM_HTTPS_ENDPOINT,      PARAM_FORMAT_TEXT,        false },
+    { "N58_REPORT_TIME",     PARAM_N58_REPORT_TIME,     PARAM_FORMAT_NUMBER,      false },
+    { "MICRO_REPORT_TIME",   PARAM_MICRO_REPORT_TIME,   PARAM_FORMAT_NUMBER,      false },
+    { "FLOW_CALIBRATION",    PARAM_FLOW_CALIBRATION,    PARAM_FORMAT_TEXT,        false },
+    { "SUMMARY_DESTINATION", PARAM_SUMMARY_DESTINATION, PARAM_FORMAT_DESTINATION, false },
+    { "DETAIL_DESTINATION",  PARAM_DETAIL_DESTINATION,  PARAM_FORMAT_DESTINATION, false },
+    { "DEBUG_DESTINATION",   PARAM_DEBUG_DESTINATION,   PARAM_FORMAT_DESTINATION, false },
+    { "SESSION_TIMEOUT",     PARAM_SESSION_TIMEOUT,     PARAM_FORMAT_NUMBER,      false },
+    { "WIFI_SSID",           PARAM_WIFI_SSID,           PARAM_FORMAT_TEXT,        false },
+    { "WIFI_PASSWORD",       PARAM_WIFI_PASSWORD,       PARAM_FORMAT_TEXT,        true },
+    { "WIFI_SERVER",         PARAM_WIFI_SERVER,         PARAM_FORMAT_TEXT,        false },
+    { "WIFI_PORT",           PARAM_WIFI_PORT,           PARAM_FORMAT_NUMBER,      false },
+};
+
+#define PARAM_COUNT  (sizeof(PARAMS) / sizeof(PARAMS[0]))
+
+/* "NAME=VALUE" into buf, "NAME=*" for a write-only one when masked;
+   false if the parameter has no (usable) value. */
+static bool format_param(const param_def_t *def, char *buf, size_t size, bool masked)
+{
+    uint8_t value[PARAM_VALUE_MAX + 1];
+    uint32_t len;
+
+    if (!ParamStore_Get(def->key, value, PARAM_VALUE_MAX, &len))
+        return false;
+    if (masked && def->write_only) {
+        snprintf(buf, size, "%s=*", def->name);
+    } else if (def->format == PARAM_FORMAT_NUMBER) {
+        uint32_t n;
+
+        if (len != sizeof(n))
+            return false;
+        memcpy(&n, value, sizeof(n));
+        snprintf(buf, size, "%s=%lu", def->name, (unsigned long)n);
+    } else {
+        value[len] = '\0';
+        snprintf(buf, size, "%s=%s", def->name, (const char *)value);
+    }
+    return true;
+}
+
+static bool valid_text(const char *s)
+{
+    for (; *s != '\0'; s++)
+        if (*s < 0x20 || *s > 0x7E)
+            return false;
+    return true;
+}
+
+static bool valid_destination(const char *s)
+{
+    const char *order = "BHW";
+
+    if (strcmp(s, "-") == 0)
+        return true;
+    if (*s == '\0')
+        return false;
+    for (; *s != '\0'; s++) {
+        const char *at = strchr(order, *s);
+
+        if (at == NULL)
+            return false;
+        order = at + 1;
+    }
+    return true;
+}
+
+uint32_t ParamSync_Digest(void)
+{
+    char line[PARAM_SYNC_LINE_MAX];
+    uint32_t crc = 0;
+    uint32_t i;
+
+    for (i = 0; i < PARAM_COUNT; i++) {
+        if (!format_param(&PARAMS[i], line, sizeof(line), false))
+            continue;
+        crc = ParamStore_Crc32(crc, line, strlen(line));
+        crc = ParamStore_Crc32(crc, "\n", 1);
+    }
+    return crc;
+}
+
+void ParamSync_List(void (*emit)(const char *line))
+{
+    char line[PARAM_SYNC_LINE_MAX];
+    uint32_t i;
+
+    if (emit == NULL) return;
+
+    for (i = 0; i < PARAM_COUNT; i++)
+        if (format_param(&PARAMS[i], line, sizeof(line), true))
+            emit(line);
+    emit("PARAMS END");
+}
+
+bool ParamSync_Apply(const char *line, char *reply, size_t size)
+{
+    const char *eq = strchr(line, '=');
+    const char *value;
+    const param_def_t *def = NULL;
+    const char *error = NULL;
+    uint32_t i;
+
+    if (eq == NULL)
+        return false;
+    value = eq + 1;
+    for (i = 0; i < PARAM_COUNT; i++) {
+        if (strlen(PARAMS[i].name) == (size_t)(eq - line)
+            && strncmp(PARAMS[i].name, line, (size_t)(eq - line)) == 0) {
+            def = &PARAMS[i];
+            break;
+        }
+    }
+
+    if (def == NULL) {
+        error = "unknown parameter";
+    } else if (def->format == PARAM_FORMAT_NUMBER) {
+        char *end;
+        unsigned long n;
+
+        errno = 0;
+        n = strtoul(value, &end, 10);
+        if (*value < '0' || *value > '9' || *end != '\0' || errno == ERANGE
+            || (uint32_t)n != n) {
+            error = "not a number";
+        } else {
+            uint32_t v = (uint32_t)n;
+
+            if (!ParamStore_Set(def->key, &v, sizeof(v)))
+                error = "flash write failed";
+        }
+    } else if (*value == '\0') {
+        error = "empty value";
+    } else if (strlen(value) > PARAM_VALUE_MAX) {
+        error = "value too long";
+    } else if (!valid_text(value)
+               || (def->format == PARAM_FORMAT_DESTINATION && !valid_destination(value))) {
+        error = "invalid value";
+    } else if (!ParamStore_Set(def->key, value, strlen(value))) {
+        error = "flash write failed";
+    }
+
+    if (error != NULL)
+        snprintf(reply, size, "ERROR=\"%s\"", error);
+    else
+        snprintf(reply, size, "OK");
+    return true;
+}
@@ -0,0 +1,247 @@
+/**
+  ******************************************************************************
+  * @file    session_stats.c
+  * @brief   Per-session download statistics and their flash ring.
+  ******************************************************************************
+  */
+
+#include "session_stats.h"
+#include "boot_timing.h"
+#include "flash_ops.h"
+#include "main.h"
+#include <stdio.h>
+#include <string.h>
+
+#define STATS_COMMIT_MAGIC   0x53544154  /* "STAT" */
+#define STATS_DEFER_MAGIC    0x44454652  /* "DEFR" */
+#define STATS_SLOT_ERASED    0xFFFFFFFF
+
+/* One 64-byte slot per session. The commit word is programmed last, so a
+   slot torn by a reset mid-write is recognised and skipped. */
+typedef struct {
+    uint32_t seq;
+    uint16_t well_id;
+    uint8_t kind;
+    uint8_t result;
+    session_stats_t stats;
+    uint32_t reserved[3];
+    uint32_t commit;
+} stats_record_t;
+
+#define STATS_SLOT_COUNT     (FLASH_SECTOR_STATS_SIZE / sizeof(stats_record_t))
+
+/* A failed session, carried across its reset. */
+typedef struct {
+    uint32_t magic;
+    uint16_t well_id;
+    uint8_t kind;
+    uint8_t reserved;
+    session_stats_t stats;
+    uint32_t check;      /* ~XOR of the words before it */
+} stats_deferred_t;
+
+/* Not zeroed by the startup code; validated by magic and check. */
+__attribute__((section(".noinit")))
+static stats_deferred_t deferred;
+
+static session_stats_t stats;
+static uint32_t transfer_start_tick;
+static bool transfer_started;
+
+void SessionStats_Begin(void)
+{
+    memset(&stats, 0, sizeof(stats));
+    transfer_start_tick = 0;
+    transfer_started = false;
+}
+
+void SessionStats_TransferStart(void)
+{
+    transfer_start_tick = HAL_GetTick();
+    transfer_started = true;
+}
+
+void SessionStats_AddPacket(uint32_t bytes)
+{
+    stats.packets++;
+    stats.bytes_received += bytes;
+}
+
+void SessionStats_AddRetransmit(void)
+{
+    stats.retransmits++;
+}
+
+void SessionStats_SetOverruns(uint32_t overruns)
+{
+    stats.ring_overruns = overruns;
+}
+
+void SessionStats_AddFlashProgram(uint32_t cycles)
+{
+    stats.flash_program_us += BootTiming_CyclesToUs(cycles);
+}
+
+void SessionStats_AddFlashErase(uint32_t cycles)
+{
+    stats.flash_erase_us += BootTiming_CyclesToUs(cycles);
+}
+
+void SessionStats_SetAtRetries(uint32_t retries)
+{
+    stats.at_retries = retries;
+}
+
+void SessionStats_SetTransport(session_transport_t transport)
+{
+    stats.transport = (uint32_t)transport;
+}
+
+void SessionStats_Finish(void)
+{
+    if (transfer_started) {
+        stats.transfer_ms = HAL_GetTick() - transfer_start_tick;
+        stats.throughput_bps = (stats.transfer_ms > 0)
+            ? (uint32_t)(((uint64_t)stats.bytes_received * 1000U) / stats.transfer_ms)
+            : stats.bytes_received;
+    }
+}
+
+const session_stats_t *SessionStats_Get(void)
+{
+    return &stats;
+}
+
+/* Records written before the transport was tracked hold erased flash here. */
+static const char *transport_name(uint32_t transport)
+{
+    switch (transport) {
+    case SESSION_TRANSPORT_SPP:  return "SPP";
+    case SESSION_TRANSPORT_GATT: return "GATT";
+    case SESSION_TRANSPORT_WIFI: return "WIFI";
+    case SESSION_TRANSPORT_UART: return "UART";
+    default:                     return "-";
+    }
+}
+
+static void format_stats(char *buf, size_t len, const char *prefix, const session_stats_t *s)
+{
+    snprintf(buf, len, "%sBYTES=%lu PACKETS=%lu RETX=%lu OVERRUNS=%lu PROG_MS=%lu ERASE_MS=%lu AT_RETRIES=%lu XFER_MS=%lu BPS=%lu TRANSPORT=%s",
+             prefix,
+             (unsigned long)s->bytes_received, (unsigned long)s->packets,
+             (unsigned long)s->retransmits, (unsigned long)s->ring_overruns,
+             (unsigned long)(s->flash_program_us / 1000U), (unsigned long)(s->flash_erase_us / 1000U),
+             (unsigned long)s->at_retries, (unsigned long)s->transfer_ms,
+             (unsigned long)s->throughput_bps, transport_name(s->transport));
+}
+
+void SessionStats_Format(char *buf, size_t len)
+{
+    format_stats(buf, len, "WSM STATS ", &stats);
+}
+
+/* Blank, or at least one committed slot: the sector is the ring. Anything
+   else (a first stage grown past sector 0) is never erased. */
+static bool ring_owned(void)
+{
+    const stats_record_t *slots = (const stats_record_t *)FLASH_SECTOR_STATS_ADDRESS;
+    const uint32_t *p = (const uint32_t *)FLASH_SECTOR_STATS_ADDRESS;
+    const uint32_t *end = (const uint32_t *)(FLASH_SECTOR_STATS_ADDRESS + FLASH_SECTOR_STATS_SIZE);
+    uint32_t i;
+
+    for (i = 0; i < STATS_SLOT_COUNT; i++)
+        if (slots[i].commit == STATS_COMMIT_MAGIC)
+            return true;
+    while (p < end)
+        if (*p++ != STATS_SLOT_ERASED)
+            return false;
+    return true;
+}
+
+static bool persist_record(const session_stats_t *s, uint16_t well_id, session_kind_t kind, bool success)
+{
+    const stats_record_t *slots = (const stats_record_t *)FLASH_SECTOR_STATS_ADDRESS;
+    stats_record_t rec;
+    uint32_t next_seq = 0;
+    uint32_t i;
+    uint32_t commit = STATS_COMMIT_MAGIC;
+
+    if (!ring_owned())
+        return false;
+    for (i = 0; i < STATS_SLOT_COUNT; i++) {
+        if (slots[i].seq == STATS_SLOT_ERASED)
+            break;
+        next_seq = slots[i].seq + 1;
+    }
+    if (i == STATS_SLOT_COUNT) {
+        if (!Flash_EraseSector(FLASH_SECTOR_STATS))
+            return false;
+        i = 0;
+    }
+
+    memset(&rec, 0xFF, sizeof(rec));
+    rec.seq = next_seq;
+    rec.well_id = well_id;
+    rec.kind = (uint8_t)kind;
+    rec.result = success ? 1 : 0;
+    rec.stats = *s;
+
+    if (!Flash_WriteData((uint32_t)&slots[i], (const uint8_t *)&rec, offsetof(stats_record_t, commit)))
+        return false;
+    return Flash_WriteData((uint32_t)&slots[i].commit, (const uint8_t *)&commit, sizeof(commit));
+}
+
+bool SessionStats_Persist(uint16_t well_id, session_kind_t kind, bool success)
+{
+    return persist_record(&stats, well_id, kind, success);
+}
+
+static uint32_t deferred_check(void)
+{
+    const uint32_t *w = (const uint32_t *)&deferred;
+    uint32_t x = 0;
+    uint32_t i;
+
+    for (i = 0; i < offsetof(stats_deferred_t, check) / 4; i++)
+        x ^= w[i];
+    return ~x;
+}
+
+void SessionStats_Defer(uint16_t well_id, session_kind_t kind)
+{
+    deferred.magic = STATS_DEFER_MAGIC;
+    deferred.well_id = well_id;
+    deferred.kind = (uint8_t)kind;
+    deferred.reserved = 0;
+    deferred.stats = stats;
+    deferred.check = deferred_check();
+}
+
+void SessionStats_PersistDeferred(void)
+{
+    if (deferred.magic != STATS_DEFER_MAGIC || deferred.check != deferred_check())
+        return;
+    /* Dropped first: a reset during the write must not repeat it. */
+    deferred.magic = 0;
+    (void)persist_record(&deferred.stats, deferred.well_id, (session_kind_t)deferred.kind, false);
+}
+
+void SessionStats_ReportLog(void (*emit)(const char *line))
+{
+    const stats_record_t *slots = (const stats_record_t *)FLASH_SECTOR_STATS_ADDRESS;
+    char prefix[40];
+    char line[240];
+    uint32_t i;
+
+    if (emit == NULL) return;
+
+    for (i = 0; i < STATS_SLOT_COUNT && slots[i].seq != STATS_SLOT_ERASED; i++) {
+        if (slots[i].commit != STATS_COMMIT_MAGIC)
+            continue;
+        snprintf(prefix, sizeof(prefix), "STATS %lu %u %u %u ",
+                 (unsigned long)slots[i].seq, slots[i].well_id, slots[i].kind, slots[i].result);
+        format_stats(line, sizeof(line), prefix, &slots[i].stats);
+        emit(line);
+    }
+    emit("STATS END");
+}
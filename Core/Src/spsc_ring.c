@@ -0,0 +1,127 @@
+/**
+  ******************************************************************************
+  * @file    spsc_ring.c
+  * @brief   Lock-free single-producer/single-consumer byte ring.
+  ******************************************************************************
+  */
+
+#include "spsc_ring.h"
+#include <string.h>
+
+/* Acquire: order the index load before the buffer access that depends on it.
+   Release: complete the buffer access before publishing the new index.
+   On the Cortex-M4 a DMB covers both; on a host use the C11 fences. */
+#if defined(__ARM_ARCH)
+#define SPSC_ACQUIRE()  __asm volatile ("dmb" ::: "memory")
+#define SPSC_RELEASE()  __asm volatile ("dmb" ::: "memory")
+#else
+#define SPSC_ACQUIRE()  __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define SPSC_RELEASE()  __atomic_thread_fence(__ATOMIC_RELEASE)
+#endif
+
+bool SpscRing_Init(spsc_ring_t *ring, uint8_t *buffer, uint32_t size)
+{
+    if (ring == NULL || buffer == NULL || size == 0 || (size & (size - 1)) != 0)
+        return false;
+
+    ring->buffer = buffer;
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->overflows = 0;
+    return true;
+}
+
+bool SpscRing_Put(spsc_ring_t *ring, uint8_t b)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = ring->tail;
+
+    SPSC_ACQUIRE();
+    if (head - tail > ring->mask) {
+        ring->overflows++;
+        return false;
+    }
+    ring->buffer[head & ring->mask] = b;
+    SPSC_RELEASE();
+    ring->head = head + 1;
+    return true;
+}
+
+uint32_t SpscRing_Count(const spsc_ring_t *ring)
+{
+    uint32_t tail = ring->tail;
+    uint32_t head = ring->head;
+    return head - tail;
+}
+
+uint32_t SpscRing_Free(const spsc_ring_t *ring)
+{
+    return ring->mask + 1 - SpscRing_Count(ring);
+}
+
+uint32_t SpscRing_Size(const spsc_ring_t *ring)
+{
+    return ring->mask + 1;
+}
+
+uint32_t SpscRing_Overflows(const spsc_ring_t *ring)
+{
+    return ring->overflows;
+}
+
+bool SpscRing_Get(spsc_ring_t *ring, uint8_t *b)
+{
+    uint32_t tail = ring->tail;
+
+    if (ring->head == tail)
+        return false;
+    SPSC_ACQUIRE();
+    *b = ring->buffer[tail & ring->mask];
+    SPSC_RELEASE();
+    ring->tail = tail + 1;
+    return true;
+}
+
+/* Copy up to len bytes starting at the tail, in at most two segments. */
+static uint32_t copy_out(const spsc_ring_t *ring, uint32_t tail, uint8_t *dst, uint32_t len)
+{
+    uint32_t avail = ring->head - tail;
+    uint32_t n = (len < avail) ? len : avail;
+    uint32_t start = tail & ring->mask;
+    uint32_t first = ring->mask + 1 - start;
+
+    SPSC_ACQUIRE();
+    if (first > n)
+        first = n;
+    memcpy(dst, &ring->buffer[start], first);
+    if (n > first)
+        memcpy(dst + first, &ring->buffer[0], n - first);
+    return n;
+}
+
+uint32_t SpscRing_Read(spsc_ring_t *ring, uint8_t *dst, uint32_t len)
+{
+    uint32_t tail = ring->tail;
+    uint32_t n = copy_out(ring, tail, dst, len);
+
+    SPSC_RELEASE();
+    ring->tail = tail + n;
+    return n;
+}
+
+uint32_t SpscRing_Peek(const spsc_ring_t *ring, uint8_t *dst, uint32_t len)
+{
+    return copy_out(ring, ring->tail, dst, len);
+}
+
+uint32_t SpscRing_Skip(spsc_ring_t *ring, uint32_t len)
+{
+    uint32_t tail = ring->tail;
+    uint32_t avail = ring->head - tail;
+    uint32_t n = (len < avail) ? len : avail;
+
+    SPSC_RELEASE();
+    ring->tail = tail + n;
+    return n;
+}
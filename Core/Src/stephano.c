@@ -0,0 +1,397 @@
+/**
+  ******************************************************************************
+  * @file    stephano.c
+  * @brief   Stephano-I module bring-up and UART receive path.
+  ******************************************************************************
+  */
+
+#include "stephano.h"
+#include "at_command.h"
+#include "boot_timing.h"
+#include "clock_profile.h"
+#include "events.h"
+#include "flash_ops.h"
+#include "session_stats.h"
+#include "main.h"
+#include <string.h>
+#include <stdio.h>
+
+#ifndef BOOTLOADER_DEBUG_ENABLE
+#define BOOTLOADER_DEBUG_ENABLE 1
+#endif
+
+#define STEPHANO_RX_BUFFER_SIZE 4096   /* must be a power of two (spsc_ring) */
+/* RTS watermarks: stop the module at 3/4 full, release it at 1/4. */
+#define RX_FLOW_HIGH_WATERMARK  (STEPHANO_RX_BUFFER_SIZE - STEPHANO_RX_BUFFER_SIZE / 4)
+#define RX_FLOW_LOW_WATERMARK   (STEPHANO_RX_BUFFER_SIZE / 4)
+
+#include "stm32f4xx_hal_uart.h"
+extern UART_HandleTypeDef huart1;
+
+static uint8_t rx_buffer[STEPHANO_RX_BUFFER_SIZE];
+static spsc_ring_t rx_ring;
+static volatile bool rx_flow_stopped = false;
+static uint8_t uart_rx_byte;
+static void (*volatile rx_filter)(uint8_t b) = NULL;
+static volatile bool powered = false;
+static bool configured = false;
+
+/* Power-up holds, each a minimum: a late step only lengthens one. */
+#define STEPHANO_POWER_OFF_MS    500
+#define STEPHANO_POWER_ON_MS     500
+#define STEPHANO_RESET_MS        500
+#define STEPHANO_READY_TIMEOUT_MS 10000
+
+/* Power-up sequence, advanced from SysTick by Stephano_PowerUpTick() so it
+   runs alongside the boot-time sector scan and hashing. */
+typedef enum {
+    SEQ_IDLE = 0,       /* not started, or consumed by Stephano_Start() */
+    SEQ_POWER_OFF,
+    SEQ_POWER_ON,
+    SEQ_RESET,
+    SEQ_BOOTING,        /* reset released, waiting for "ready" */
+    SEQ_READY,
+    SEQ_TIMEOUT
+} seq_state_t;
+
+static volatile seq_state_t seq_state = SEQ_IDLE;
+static volatile uint32_t seq_tick;          /* HAL tick the state was entered */
+static volatile bool seq_paused = false;    /* main thread drives the pins */
+static volatile bool ready_seen;
+static uint8_t ready_matched;
+
+/* Receive filter while the module boots: nothing is kept, only "ready" is
+   matched, so the boot log cannot fill the ring. */
+static void ready_filter(uint8_t b)
+{
+    static const char READY[] = "ready";
+
+    if (b == (uint8_t)READY[ready_matched]) {
+        if (READY[++ready_matched] == '\0') {
+            ready_seen = true;
+            ready_matched = 0;
+        }
+    } else {
+        ready_matched = (b == (uint8_t)READY[0]) ? 1 : 0;
+    }
+}
+
+static void seq_enter(seq_state_t state)
+{
+    seq_tick = HAL_GetTick();
+    seq_state = state;
+    if (state == SEQ_READY || state == SEQ_TIMEOUT)
+        Events_Post(EVENT_RADIO);
+}
+
+static void seq_release_reset(void)
+{
+    BootTiming_Mark(BOOT_PHASE_STEPHANO_WAIT_READY);
+    HAL_GPIO_WritePin(n_STEPHANO_RST_GPIO_Port, n_STEPHANO_RST_Pin, GPIO_PIN_SET);
+    seq_enter(SEQ_BOOTING);
+}
+
+/* Milliseconds left in the current hold, 0 once it has run out. */
+static uint32_t seq_hold_left(uint32_t hold_ms)
+{
+    uint32_t elapsed = HAL_GetTick() - seq_tick;
+
+    return (elapsed < hold_ms) ? hold_ms - elapsed : 0;
+}
+
+/* Power-cycle and reset with the download sector erasing meanwhile: the
+   remaining holds are played from SRAM, since flash is unreadable for the
+   whole erase. Reset is released once the erase is done, so "ready" never
+   arrives while the CPU is stalled. false, with nothing done, if there is
+   nothing to erase ahead or the holds are already over. */
+static bool power_up_erasing(void)
+{
+    flash_pin_step_t steps[3];
+    uint32_t count = 0;
+    uint32_t erase_cycles;
+    seq_state_t state;
+
+    seq_paused = true;
+    state = seq_state;
+    switch (state) {
+    case SEQ_POWER_OFF:
+        steps[count++] = (flash_pin_step_t){ NULL, 0, GPIO_PIN_RESET, (uint16_t)seq_hold_left(STEPHANO_POWER_OFF_MS) };
+        steps[count++] = (flash_pin_step_t){ n_STEPHANO_ON_GPIO_Port, n_STEPHANO_ON_Pin, GPIO_PIN_RESET, STEPHANO_POWER_ON_MS };
+        steps[count++] = (flash_pin_step_t){ n_STEPHANO_RST_GPIO_Port, n_STEPHANO_RST_Pin, GPIO_PIN_RESET, STEPHANO_RESET_MS };
+        break;
+    case SEQ_POWER_ON:
+        steps[count++] = (flash_pin_step_t){ NULL, 0, GPIO_PIN_RESET, (uint16_t)seq_hold_left(STEPHANO_POWER_ON_MS) };
+        steps[count++] = (flash_pin_step_t){ n_STEPHANO_RST_GPIO_Port, n_STEPHANO_RST_Pin, GPIO_PIN_RESET, STEPHANO_RESET_MS };
+        break;
+    case SEQ_RESET:
+        steps[count++] = (flash_pin_step_t){ NULL, 0, GPIO_PIN_RESET, (uint16_t)seq_hold_left(STEPHANO_RESET_MS) };
+        break;
+    default:
+        break;
+    }
+    if (count == 0 || !Flash_EraseWhileSequencing(steps, count, &erase_cycles)) {
+        seq_paused = false;
+        return false;
+    }
+    powered = true;
+    seq_release_reset();
+    seq_paused = false;
+    SessionStats_AddFlashErase(erase_cycles);
+
+#if BOOTLOADER_DEBUG_ENABLE
+  {
+    char dbg_msg[128];
+    int len = snprintf(dbg_msg, sizeof(dbg_msg), "%s download sector erased ahead in %lu ms\r\n", __FUNCTION__,
+                       (unsigned long)(BootTiming_CyclesToUs(erase_cycles) / 1000));
+    HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
+  }
+#endif
+    return true;
+}
+
+/* Configure our RTS line as a GPIO (active low) and let the module send. */
+static void rx_flow_init(void)
+{
+#if BOOTLOADER_USE_HARDWARE_FLOW_CONTROL
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+    HAL_GPIO_WritePin(STEPHANO_FLOW_RTS_GPIO_Port, STEPHANO_FLOW_RTS_Pin, GPIO_PIN_RESET);
+    GPIO_InitStruct.Pin = STEPHANO_FLOW_RTS_Pin;
+    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+    HAL_GPIO_Init(STEPHANO_FLOW_RTS_GPIO_Port, &GPIO_InitStruct);
+#endif
+    rx_flow_stopped = false;
+}
+
+/* Consumer side: release the module once the ring has drained below the
+   low watermark. Call after taking bytes out of rx_ring. */
+static void rx_flow_update(void)
+{
+#if BOOTLOADER_USE_HARDWARE_FLOW_CONTROL
+    if (rx_flow_stopped && SpscRing_Count(&rx_ring) <= RX_FLOW_LOW_WATERMARK) {
+        rx_flow_stopped = false;
+        HAL_GPIO_WritePin(STEPHANO_FLOW_RTS_GPIO_Port, STEPHANO_FLOW_RTS_Pin, GPIO_PIN_RESET);
+    }
+#endif
+}
+
+void Stephano_PowerUpBegin(void)
+{
+    seq_paused = true;
+    SpscRing_Init(&rx_ring, rx_buffer, sizeof(rx_buffer));
+    ready_seen = false;
+    ready_matched = 0;
+    rx_filter = ready_filter;
+
+    /* Our RTS is a GPIO driven from the ring watermarks; assert it (low)
+       before the module powers up so it never sees a floating line. */
+    rx_flow_init();
+    __HAL_UART_DISABLE(STEPHANO_UART_PTR);
+    __HAL_UART_HWCONTROL_CTS_DISABLE(STEPHANO_UART_PTR);
+    __HAL_UART_ENABLE(STEPHANO_UART_PTR);
+    Stephano_RxStart();
+
+    BootTiming_Mark(BOOT_PHASE_STEPHANO_POWER_OFF);
+    HAL_GPIO_WritePin(n_STEPHANO_ON_GPIO_Port, n_STEPHANO_ON_Pin, GPIO_PIN_SET);
+    powered = false;
+    configured = false;
+    seq_enter(SEQ_POWER_OFF);
+    seq_paused = false;
+}
+
+void Stephano_PowerUpTick(void)
+{
+    if (seq_paused)
+        return;
+
+    switch (seq_state) {
+    case SEQ_POWER_OFF:
+        if (seq_hold_left(STEPHANO_POWER_OFF_MS) == 0) {
+            BootTiming_Mark(BOOT_PHASE_STEPHANO_POWER_ON);
+            HAL_GPIO_WritePin(n_STEPHANO_ON_GPIO_Port, n_STEPHANO_ON_Pin, GPIO_PIN_RESET);
+            powered = true;
+            seq_enter(SEQ_POWER_ON);
+        }
+        break;
+    case SEQ_POWER_ON:
+        if (seq_hold_left(STEPHANO_POWER_ON_MS) == 0) {
+            BootTiming_Mark(BOOT_PHASE_STEPHANO_RESET);
+            HAL_GPIO_WritePin(n_STEPHANO_RST_GPIO_Port, n_STEPHANO_RST_Pin, GPIO_PIN_RESET);
+            seq_enter(SEQ_RESET);
+        }
+        break;
+    case SEQ_RESET:
+        if (seq_hold_left(STEPHANO_RESET_MS) == 0)
+            seq_release_reset();
+        break;
+    case SEQ_BOOTING:
+        if (ready_seen)
+            seq_enter(SEQ_READY);
+        else if (seq_hold_left(STEPHANO_READY_TIMEOUT_MS) == 0)
+            seq_enter(SEQ_TIMEOUT);
+        break;
+    default:
+        break;
+    }
+}
+
+void Stephano_PowerUpCancel(void)
+{
+    seq_paused = true;
+    if (seq_state == SEQ_IDLE) {
+        seq_paused = false;
+        return;
+    }
+    Stephano_RxStop();
+    rx_filter = NULL;
+    /* The levels MX_GPIO_Init sets: powered, out of reset. */
+    HAL_GPIO_WritePin(n_STEPHANO_ON_GPIO_Port, n_STEPHANO_ON_Pin, GPIO_PIN_RESET);
+    HAL_GPIO_WritePin(n_STEPHANO_RST_GPIO_Port, n_STEPHANO_RST_Pin, GPIO_PIN_SET);
+    powered = true;
+    configured = false;
+    seq_state = SEQ_IDLE;
+    seq_paused = false;
+}
+
+bool Stephano_Start(const char **error)
+{
+    seq_state_t state;
+    clock_profile_t profile;
+
+    /* Normally begun at reset; a later start (another transport) power
+       cycles the module again. */
+    if (seq_state == SEQ_IDLE || seq_state == SEQ_TIMEOUT)
+        Stephano_PowerUpBegin();
+
+    /* The download sector erases ahead during what is left of the power-up
+       holds when the session allowed it (Flash_PrepareDownloadSector). */
+    (void)power_up_erasing();
+
+#if BOOTLOADER_DEBUG_ENABLE
+  {
+    char dbg_msg[128];
+    int len = sprintf(dbg_msg, "%s waiting for ready\r\n", __FUNCTION__);
+    HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
+  }
+#endif
+    /* The sequencer advances from SysTick; sleep between ticks, on the
+       low clock. */
+    profile = ClockProfile_Set(CLOCK_PROFILE_LOW);
+    for (;;) {
+        state = seq_state;
+        if (state == SEQ_READY || state == SEQ_TIMEOUT)
+            break;
+        (void)Events_Wait(EVENT_RADIO);
+    }
+    (void)ClockProfile_Set(profile);
+
+    /* AT commands use blocking receive from here on. */
+    Stephano_RxStop();
+    rx_filter = NULL;
+    SpscRing_Init(&rx_ring, rx_buffer, sizeof(rx_buffer));
+    seq_state = SEQ_IDLE;
+    if (state == SEQ_TIMEOUT) {
+        *error = "Stephano Ready timeout";
+        return false;
+    }
+
+    BootTiming_Mark(BOOT_PHASE_AT_RESTORE);
+    /* Not retried: RESTORE reboots the module, and a repeat lands in the
+       middle of that reboot. */
+    if (AT_SendCommand("AT+RESTORE", NULL, 0, 1000, true) != AT_OK) {
+        *error = "AT+RESTORE failed";
+        return false;
+    }
+
+    BootTiming_Mark(BOOT_PHASE_AT_UART_CUR);
+#if BOOTLOADER_USE_HARDWARE_FLOW_CONTROL
+    /* Flow control 3: module honours our RTS and drives its own. */
+    if (AT_SendCommandRetry("AT+UART_CUR=115200,8,1,0,3", NULL, 0, 1000, STEPHANO_AT_SETUP_RETRIES) != AT_OK) {
+        *error = "AT+UART_CUR failed";
+        return false;
+    }
+
+    /* Module now honours flow control: let the USART hold our TX on its RTS. */
+    __HAL_UART_DISABLE(STEPHANO_UART_PTR);
+    __HAL_UART_HWCONTROL_CTS_ENABLE(STEPHANO_UART_PTR);
+    __HAL_UART_ENABLE(STEPHANO_UART_PTR);
+#else
+    if (AT_SendCommandRetry("AT+UART_CUR=115200,8,1,0,1", NULL, 0, 1000, STEPHANO_AT_SETUP_RETRIES) != AT_OK) {
+        *error = "AT+UART_CUR failed";
+        return false;
+    }
+#endif
+    configured = true;
+    return true;
+}
+
+bool Stephano_IsPowered(void)
+{
+    return powered;
+}
+
+bool Stephano_IsConfigured(void)
+{
+    return configured;
+}
+
+void Stephano_SetRxFilter(void (*filter)(uint8_t b))
+{
+    rx_filter = filter;
+}
+
+void Stephano_RxStart(void)
+{
+    HAL_UART_Receive_IT(STEPHANO_UART_PTR, &uart_rx_byte, 1);
+}
+
+void Stephano_RxStop(void)
+{
+    HAL_UART_AbortReceive_IT(STEPHANO_UART_PTR);
+}
+
+spsc_ring_t *Stephano_RxRing(void)
+{
+    return &rx_ring;
+}
+
+uint32_t Stephano_Read(uint8_t *dst, uint32_t len)
+{
+    uint32_t n = SpscRing_Read(&rx_ring, dst, len);
+
+    rx_flow_update();
+    return n;
+}
+
+bool Stephano_Write(const uint8_t *data, uint32_t len)
+{
+    return HAL_UART_Transmit(STEPHANO_UART_PTR, (uint8_t *)data, (uint16_t)len, 2000) == HAL_OK;
+}
+
+/* Add byte to rx ring (from UART callback). Overflows are counted by the ring.
+   Above the high watermark RTS is de-asserted so the module holds the data. */
+void Stephano_RxByte(uint8_t b)
+{
+    void (*filter)(uint8_t b) = rx_filter;
+
+    if (filter != NULL)
+        filter(b);
+    else
+        (void)SpscRing_Put(&rx_ring, b);
+    Events_Post(EVENT_RX);
+#if BOOTLOADER_USE_HARDWARE_FLOW_CONTROL
+    if (!rx_flow_stopped && SpscRing_Count(&rx_ring) >= RX_FLOW_HIGH_WATERMARK) {
+        rx_flow_stopped = true;
+        HAL_GPIO_WritePin(STEPHANO_FLOW_RTS_GPIO_Port, STEPHANO_FLOW_RTS_Pin, GPIO_PIN_SET);
+    }
+#endif
+}
+
+/* Called from HAL_UART_RxCpltCallback; add byte and restart receive. */
+void Stephano_UartRxCplt(void)
+{
+    Stephano_RxByte(uart_rx_byte);
+    HAL_UART_Receive_IT(STEPHANO_UART_PTR, &uart_rx_byte, 1);
+}
@@ -22,6 +22,8 @@
 #include "stm32f4xx_it.h"
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
+#include "flash_ops.h"
+#include "stephano.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -56,6 +58,9 @@
 
 /* External variables --------------------------------------------------------*/
 /* USER CODE BEGIN EV */
+#if BOOTLOADER_ENABLE_CELLULAR || BOOTLOADER_ENABLE_WIRED
+extern UART_HandleTypeDef huart1;   /* N58 modem / wired update */
+#endif
 /* USER CODE END EV */
 
 /******************************************************************************/
@@ -185,6 +190,7 @@ void SysTick_Handler(void)
   /* USER CODE END SysTick_IRQn 0 */
   HAL_IncTick();
   /* USER CODE BEGIN SysTick_IRQn 1 */
+  Stephano_PowerUpTick();
 
   /* USER CODE END SysTick_IRQn 1 */
 }
@@ -196,7 +202,7 @@ void SysTick_Handler(void)
 /* please refer to the startup file (startup_stm32f4xx.s).                    */
 /******************************************************************************/
 
-#if STEPHANO_USE_UART1
+#if STEPHANO_USE_UART1 || BOOTLOADER_ENABLE_CELLULAR || BOOTLOADER_ENABLE_WIRED
 /**
   * @brief This function handles USART1 global interrupt.
   */
@@ -209,7 +215,8 @@ void USART1_IRQHandler(void)
 
   /* USER CODE END USART1_IRQn 1 */
 }
-#else
+#endif
+#if !STEPHANO_USE_UART1
 /**
   * @brief This function handles USART2 global interrupt.
   */
@@ -225,5 +232,12 @@ void USART2_IRQHandler(void)
 #endif
 
 /* USER CODE BEGIN 1 */
-
+/**
+  * @brief This function handles the flash global interrupt (end of a
+  *        background erase of the download sector).
+  */
+void FLASH_IRQHandler(void)
+{
+  Flash_IRQHandler();
+}
 /* USER CODE END 1 */
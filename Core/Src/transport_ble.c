@@ -0,0 +1,510 @@
+/**
+  ******************************************************************************
+  * @file    transport_ble.c
+  * @brief   BLE transport via the Stephano-I module (SPP passthrough or GATT).
+  ******************************************************************************
+  */
+
+#include "transport_ble.h"
+#include "at_command.h"
+#include "ble_gatt.h"
+#include "boot_timing.h"
+#include "clock_profile.h"
+#include "events.h"
+#include "low_power.h"
+#include "session_stats.h"
+#include "stephano.h"
+#include "main.h"
+#include <string.h>
+#include <stdio.h>
+
+#ifndef BOOTLOADER_DEBUG_ENABLE
+#define BOOTLOADER_DEBUG_ENABLE 1
+#endif
+
+#define AT_SETUP_RETRIES        STEPHANO_AT_SETUP_RETRIES
+#define URC_LINE_SIZE           64
+
+/* BLE link tuning requested right after the central connects. Intervals
+   are in 1.25 ms units, supervision timeout in 10 ms units. */
+#define BLE_LINK_MTU            517
+#define BLE_LINK_INTERVAL_MIN   6      /* 7.5 ms, the shortest BLE allows */
+#define BLE_LINK_INTERVAL_MAX   12     /* 15 ms */
+#define BLE_LINK_LATENCY        0
+#define BLE_LINK_TIMEOUT        500    /* 5 s */
+#define BLE_LINK_DATA_LEN       251    /* data length extension maximum */
+#define BLE_LINK_PHY_2M         2
+
+/* After connecting, the PC has this long to enable notifications on the GATT
+   TX characteristic if it wants the GATT transport instead of SPP. */
+#define GATT_SELECT_WINDOW_MS   2000
+
+/* Advertising: how long to wait for a central before giving up, 0 = until
+   one connects; TransportBle_SetAdvertisingTimeout() changes it. Stop-mode
+   stretches (BOOTLOADER_ADV_STOP_MODE) end on the RTC at least this often
+   to keep the HAL tick going. After a wake on the receive line, the line
+   must go quiet this long before a URC that lost its first bytes to the
+   wake-up is taken as missed and the module is asked instead. */
+#define BLE_ADV_TIMEOUT_MS      0
+#define BLE_ADV_STOP_MS         1000
+#define BLE_ADV_WAKE_QUIET_MS   50
+
+#include "stm32f4xx_hal_uart.h"
+extern UART_HandleTypeDef huart1;
+
+typedef enum {
+    BLE_TRANSPORT_SPP,     /* module in SPP passthrough, UART carries raw data */
+    BLE_TRANSPORT_GATT     /* module in AT mode, data in +WRITE URCs / notifications */
+} ble_transport_t;
+
+/* Link parameters in effect after tuning, as read back from the module.
+   Zero means the module did not report the value. */
+typedef struct {
+    uint16_t mtu;
+    uint16_t interval;      /* 1.25 ms units */
+    uint16_t latency;
+    uint16_t timeout;       /* 10 ms units */
+    uint16_t data_len;      /* 0 when data length extension was refused */
+    uint8_t tx_phy;
+    uint8_t rx_phy;
+} ble_link_params_t;
+
+static volatile ble_transport_t ble_transport = BLE_TRANSPORT_SPP;
+static ble_link_params_t ble_link;
+static uint32_t bytes_in;
+static uint32_t bytes_out;
+
+#define MAC_BUF_SIZE 20
+static char mac_buf[MAC_BUF_SIZE] = "00:00:00:00:00:00";
+static bool connected = false;
+static uint32_t adv_timeout_ms = BLE_ADV_TIMEOUT_MS;
+
+/* Extract MAC from AT+BLEADDR? response (Stephano-I BLE address). */
+static void get_mac_from_module(void)
+{
+    char resp[AT_MAX_RESPONSE_LEN];
+    if (AT_SendCommand("AT+BLEADDR?", resp, sizeof(resp), 3000, true) != AT_OK) {
+        strncpy(mac_buf, "00:00:00:00:00:00", MAC_BUF_SIZE - 1);
+        mac_buf[MAC_BUF_SIZE - 1] = '\0';
+        return;
+    }
+    /* +BLEADDR:xx:xx:xx:xx:xx:xx or +BLEADDR:"xx:xx:xx:xx:xx:xx" */
+    const char *p = strstr(resp, "+BLEADDR:");
+    if (p != NULL) {
+        p += 9; /* skip "+BLEADDR:" */
+        if (*p == '"') p++; /* skip optional quote */
+    } else {
+        p = resp;
+    }
+    while (*p && !((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F'))) p++;
+    size_t i = 0;
+    while (*p && ((*p >= '0' && *p <= '9') || (*p >= 'a' && *p <= 'f') || (*p >= 'A' && *p <= 'F') || (*p == ':')) && i < MAC_BUF_SIZE - 1) {
+        mac_buf[i++] = *p++;
+    }
+    mac_buf[i] = '\0';
+    if (i == 0) {
+        strncpy(mac_buf, "00:00:00:00:00:00", MAC_BUF_SIZE - 1);
+        mac_buf[MAC_BUF_SIZE - 1] = '\0';
+    }
+}
+
+/* One tuning command. On the GATT transport the receive interrupt stays on
+   the +WRITE parser, so the PC can start writing while this runs. */
+static bool link_command(const char *cmd, char *resp, uint16_t len)
+{
+#if BOOTLOADER_ENABLE_GATT_TRANSPORT
+    if (ble_transport == BLE_TRANSPORT_GATT)
+        return BleGatt_Command(cmd, resp, len, 1000);
+#endif
+    return AT_SendCommand(cmd, resp, len, 1000, true) == AT_OK;
+}
+
+/* Ask the module to move the fresh connection to the fastest link it and the
+   central will agree on: large ATT MTU, shortest connection interval, data
+   length extension and the 2M PHY. Every step is best effort: a central that
+   refuses keeps the defaults and the download still works, only slower.
+   The values in effect are read back into ble_link for "WSM LINK". */
+static void tune_ble_link(void)
+{
+    char cmd[64];
+    char resp[AT_MAX_RESPONSE_LEN];
+    const char *p;
+    unsigned int a, b, c, d, e, f;
+
+    BootTiming_Mark(BOOT_PHASE_BLE_LINK_TUNE);
+    memset(&ble_link, 0, sizeof(ble_link));
+
+    snprintf(cmd, sizeof(cmd), "AT+BLECFGMTU=0,%u", (unsigned int)BLE_LINK_MTU);
+    (void)link_command(cmd, NULL, 0);
+
+    snprintf(cmd, sizeof(cmd), "AT+BLECONNPARAM=0,%u,%u,%u,%u",
+             (unsigned int)BLE_LINK_INTERVAL_MIN, (unsigned int)BLE_LINK_INTERVAL_MAX,
+             (unsigned int)BLE_LINK_LATENCY, (unsigned int)BLE_LINK_TIMEOUT);
+    (void)link_command(cmd, NULL, 0);
+
+    snprintf(cmd, sizeof(cmd), "AT+BLEDATALEN=0,%u", (unsigned int)BLE_LINK_DATA_LEN);
+    if (link_command(cmd, NULL, 0))
+        ble_link.data_len = BLE_LINK_DATA_LEN;
+
+    snprintf(cmd, sizeof(cmd), "AT+BLESETPHY=0,%u", (unsigned int)BLE_LINK_PHY_2M);
+    (void)link_command(cmd, NULL, 0);
+
+    /* +BLECFGMTU:<conn_index>,<mtu> */
+    if (link_command("AT+BLECFGMTU?", resp, sizeof(resp))
+        && (p = strstr(resp, "+BLECFGMTU:")) != NULL
+        && sscanf(p + 11, "%u,%u", &a, &b) == 2)
+        ble_link.mtu = (uint16_t)b;
+
+    /* +BLECONNPARAM:<conn_index>,<min>,<max>,<current>,<latency>,<timeout> */
+    if (link_command("AT+BLECONNPARAM?", resp, sizeof(resp))
+        && (p = strstr(resp, "+BLECONNPARAM:")) != NULL
+        && sscanf(p + 14, "%u,%u,%u,%u,%u,%u", &a, &b, &c, &d, &e, &f) == 6) {
+        ble_link.interval = (uint16_t)d;
+        ble_link.latency = (uint16_t)e;
+        ble_link.timeout = (uint16_t)f;
+    }
+
+    /* +BLESETPHY:<device_addr>,<tx_phy>,<rx_phy> */
+    if (link_command("AT+BLESETPHY?", resp, sizeof(resp))
+        && (p = strstr(resp, "+BLESETPHY:")) != NULL
+        && (p = strchr(p, ',')) != NULL
+        && sscanf(p + 1, "%u,%u", &a, &b) == 2) {
+        ble_link.tx_phy = (uint8_t)a;
+        ble_link.rx_phy = (uint8_t)b;
+    }
+
+#if BOOTLOADER_DEBUG_ENABLE
+  {
+    char dbg_msg[128];
+    int len = snprintf(dbg_msg, sizeof(dbg_msg), "%s MTU=%u INTERVAL=%u DLE=%u PHY=%u/%u\r\n", __FUNCTION__,
+                       ble_link.mtu, ble_link.interval, ble_link.data_len, ble_link.tx_phy, ble_link.rx_phy);
+    HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
+  }
+#endif
+}
+
+#if BOOTLOADER_ENABLE_GATT_TRANSPORT
+/* Listen for the PC enabling notifications on the GATT TX characteristic,
+   until it does, touches the SPP characteristics instead, or the window
+   closes. The UART receive interrupt runs through the +WRITE parser
+   meanwhile, so data the PC writes early is kept in the receive ring; on
+   GATT it stays armed from here on, tuning included. */
+static bool wait_gatt_subscribe(void)
+{
+    uint32_t start = HAL_GetTick();
+
+    BleGatt_Init(Stephano_RxRing());
+    ble_transport = BLE_TRANSPORT_GATT;
+    Stephano_SetRxFilter(BleGatt_RxByte);   /* keeps only the value bytes of +WRITE URCs */
+    Stephano_RxStart();
+    while (!BleGatt_Subscribed() && !BleGatt_SppActivity()
+           && HAL_GetTick() - start < GATT_SELECT_WINDOW_MS)
+        (void)Events_Wait(EVENT_RX);
+
+    if (BleGatt_Subscribed())
+        return true;
+    Stephano_RxStop();
+    Stephano_SetRxFilter(NULL);
+    ble_transport = BLE_TRANSPORT_SPP;
+    return false;
+}
+#endif
+
+/* Bring up the data path on a fresh connection: select the transport (GATT
+   if the PC subscribed in time, SPP otherwise), tune the link, then enter
+   SPP passthrough when that is the transport in use. */
+static bool open_data_path(const char **error)
+{
+    ble_transport = BLE_TRANSPORT_SPP;
+#if BOOTLOADER_ENABLE_GATT_TRANSPORT
+    (void)wait_gatt_subscribe();
+#endif
+
+    tune_ble_link();
+
+    if (ble_transport == BLE_TRANSPORT_SPP) {
+        if (AT_SendCommand("AT+BLESPPCFG=1,1,2,1,1,0", NULL, 0, 2000, true) != AT_OK) {
+            *error = "AT+BLESPPCFG failed";
+            return false;
+        }
+        if (AT_SendCommand("AT+BLESPP", NULL, 0, 2000, true) != AT_OK) {
+            *error = "AT+BLESPP failed";
+            return false;
+        }
+        SessionStats_SetTransport(SESSION_TRANSPORT_SPP);
+    } else {
+        SessionStats_SetTransport(SESSION_TRANSPORT_GATT);
+    }
+
+    BootTiming_Mark(BOOT_PHASE_SPP_READY);
+    return true;
+}
+
+/* Connected as far as the module is concerned: +BLECONN:<index>,<addr>. */
+static bool module_reports_connection(void)
+{
+    char resp[AT_MAX_RESPONSE_LEN];
+    bool found;
+
+    Stephano_RxStop();
+    found = AT_SendCommand("AT+BLECONN?", resp, sizeof(resp), 500, true) == AT_OK
+            && strstr(resp, "+BLECONN:") != NULL;
+    Stephano_RxStart();
+    return found;
+}
+
+/* No +BLECONN in the AT+BLEADVSTART response: listen for the URC. When remote
+   connects, Stephano sends +BLECONN. Respond with AT+BLECONN:0,<MAC>, then open
+   the data path: SPP per StephanoI_ATcommands.pdf page 5 steps 6-11, or GATT
+   write/notify if the PC subscribes first.
+   Idle stretches are spent in Stop mode; the URC's start bit wakes us. */
+static bool wait_for_connection(const char **error)
+{
+    char line[URC_LINE_SIZE];
+    size_t line_len = 0;
+    uint32_t start = HAL_GetTick();
+    uint32_t last_rx = 0;
+    bool woken = false;
+    clock_profile_t profile;
+    uint8_t b;
+
+    /* Stop-mode wake-ups restore the low clock too. */
+    profile = ClockProfile_Set(CLOCK_PROFILE_LOW);
+    Stephano_RxStart();
+    for (;;) {
+        if (Stephano_Read(&b, 1) == 1) {
+            last_rx = HAL_GetTick();
+            if (b != '\n') {
+                if (b != '\r' && line_len < sizeof(line) - 1)
+                    line[line_len++] = (char)b;
+                continue;
+            }
+            line[line_len] = '\0';
+            line_len = 0;
+            /* Not "+BLECONN": the '+' may be the byte the wake-up cost. */
+            if (strstr(line, "BLECONN") != NULL)
+                break;
+            continue;
+        }
+        if (adv_timeout_ms != 0 && HAL_GetTick() - start >= adv_timeout_ms) {
+            Stephano_RxStop();
+            (void)ClockProfile_Set(profile);
+            *error = "No BLE connection";
+            return false;
+        }
+        if (woken) {
+            if (HAL_GetTick() - last_rx < BLE_ADV_WAKE_QUIET_MS) {
+                (void)Events_Wait(EVENT_RX);
+                continue;
+            }
+            woken = false;
+            line_len = 0;
+            if (module_reports_connection())
+                break;
+            continue;
+        }
+#if BOOTLOADER_ADV_STOP_MODE
+        woken = LowPower_StopUntilRx(STEPHANO_RX_WAKE_GPIO_Port, STEPHANO_RX_WAKE_Pin,
+                                     STEPHANO_UART_PTR, BLE_ADV_STOP_MS);
+        last_rx = HAL_GetTick();
+#else
+        (void)Events_Wait(EVENT_RX);
+#endif
+    }
+
+    Stephano_RxStop();
+    (void)ClockProfile_Set(profile);
+    BootTiming_Mark(BOOT_PHASE_BLE_CONNECTED);
+
+    char bleconn_cmd[64];
+    snprintf(bleconn_cmd, sizeof(bleconn_cmd), "AT+BLECONN:0,%s", mac_buf);
+    if (AT_SendCommand(bleconn_cmd, NULL, 0, 2000, true) != AT_OK) {
+        *error = "AT+BLECONN failed";
+        return false;
+    }
+
+    return open_data_path(error);
+}
+
+static bool ble_open(const char **error)
+{
+	char response_bufr[AT_MAX_RESPONSE_LEN] = { 0 };
+
+    ble_transport = BLE_TRANSPORT_SPP;
+    bytes_in = 0;
+    bytes_out = 0;
+
+    if (!Stephano_Start(error))
+        return false;
+
+    BootTiming_Mark(BOOT_PHASE_AT_BLEINIT);
+    if (AT_SendCommandRetry("AT+BLEINIT=2", NULL, 0, 1000, AT_SETUP_RETRIES) != AT_OK) {
+        *error = "AT+BLEINIT=2 failed";
+        return false;
+    }
+
+    /* Get Stephano-I BLE MAC address for AT+BLECONN response when remote connects. */
+    BootTiming_Mark(BOOT_PHASE_AT_BLEADDR);
+    get_mac_from_module();
+
+    BootTiming_Mark(BOOT_PHASE_AT_GATTS_CREATE);
+    if (AT_SendCommandRetry("AT+BLEGATTSSRVCRE", NULL, 0, 1000, AT_SETUP_RETRIES) != AT_OK) {
+        *error = "AT+BLEGATTSSRVCRE failed";
+        return false;
+    }
+
+/*
+     Configure the SPP Parameters
+    if (AT_SendCommand("AT+BLESPPCFG=1,1,3,1,3", NULL, 0, 2000, true) != AT_OK)
+        dying_gasp("AT+BLEGATTSSRVCRE failed");
+     Entry 1: <srv_index>, <gzip_en>, <tx_char_index>, <rx_char_index>
+     Note: The exact indices depend on the internal GATT table.
+       On Stephano-I, 1,1,3,1,3 is the standard for the built-in SAPP profile
+*/
+
+    BootTiming_Mark(BOOT_PHASE_AT_GATTS_START);
+    if (AT_SendCommandRetry("AT+BLEGATTSSRVSTART", NULL, 0, 1000, AT_SETUP_RETRIES) != AT_OK) {
+        *error = "AT+BLEGATTSSRVSTART failed";
+        return false;
+    }
+
+    BootTiming_Mark(BOOT_PHASE_AT_BLENAME);
+    if (AT_SendCommandRetry("AT+BLENAME=\"Stephano-I\"", NULL, 0, 1000, AT_SETUP_RETRIES) != AT_OK) {
+        *error = "AT+BLENAME=\"Stephano-I\" failed";
+        return false;
+    }
+
+    BootTiming_Mark(BOOT_PHASE_AT_ADVDATA);
+    if (AT_SendCommandRetry("AT+BLEADVDATA=\"0201060B095374657068616E6F2D49\"", NULL, 0, 1000, AT_SETUP_RETRIES) != AT_OK) {
+        *error = "AT+BLEADVDATA=\"0201060B095374657068616E6F2D49\" failed";
+        return false;
+    }
+
+    BootTiming_Mark(BOOT_PHASE_ADVERTISING);
+    /* The blocking receive runs to its timeout: keep it short, the rest of
+       the wait for +BLECONN:0,"<MAC>" is wait_for_connection() in Stop mode. */
+    if (AT_SendCommand("AT+BLEADVSTART", response_bufr, sizeof(response_bufr) - 1, 1000, true) != AT_OK) {
+        *error = "AT+BLEADVSTART failed";
+        return false;
+    }
+
+#if BOOTLOADER_DEBUG_ENABLE
+	{
+		char dbg_msg[128];
+		int len = sprintf(dbg_msg, "%s Looking for +BLECONN\r\n", __FUNCTION__);
+		HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
+	}
+#endif
+
+	if (strstr(response_bufr, "+BLECONN"))
+	{
+		BootTiming_Mark(BOOT_PHASE_BLE_CONNECTED);
+		/* Pick SPP or GATT and bring the data path up */
+		if (!open_data_path(error))
+			return false;
+	}
+	else if (!wait_for_connection(error))
+	{
+		return false;
+	}
+
+    /* Start interrupt-driven receive for subsequent SPP traffic (on GATT
+       it has been running since the transport was chosen) */
+    Stephano_RxStart();
+    connected = true;
+    return true;
+}
+
+static uint32_t ble_available(void)
+{
+    return SpscRing_Count(Stephano_RxRing());
+}
+
+static uint32_t ble_read(uint8_t *dst, uint32_t len)
+{
+    uint32_t n = Stephano_Read(dst, len);
+
+    bytes_in += n;
+    return n;
+}
+
+static bool ble_write(const uint8_t *data, uint32_t len)
+{
+    bytes_out += len;
+#if BOOTLOADER_ENABLE_GATT_TRANSPORT
+    if (ble_transport == BLE_TRANSPORT_GATT)
+        return BleGatt_Notify(data, len, ble_link.mtu);
+#endif
+    return Stephano_Write(data, len);
+}
+
+static void ble_close(void)
+{
+    connected = false;
+    Stephano_RxStop();
+    Stephano_SetRxFilter(NULL);
+}
+
+static const char *ble_address(void)
+{
+    return mac_buf;
+}
+
+static void ble_get_stats(transport_stats_t *stats)
+{
+    stats->rx_window = SpscRing_Size(Stephano_RxRing());
+    stats->rx_overruns = SpscRing_Overflows(Stephano_RxRing());
+    stats->bytes_in = bytes_in;
+    stats->bytes_out = bytes_out;
+}
+
+/* "TRANSPORT=<SPP|GATT> MTU=<bytes> INTERVAL_US=<us> LATENCY=<n> TIMEOUT_MS=<ms> DLE=<bytes> PHY=<tx>/<rx>" */
+static void ble_link_info(char *buf, size_t len)
+{
+    snprintf(buf, len, "TRANSPORT=%s MTU=%u INTERVAL_US=%lu LATENCY=%u TIMEOUT_MS=%lu DLE=%u PHY=%u/%u",
+             (ble_transport == BLE_TRANSPORT_GATT) ? "GATT" : "SPP",
+             ble_link.mtu, (unsigned long)ble_link.interval * 1250UL, ble_link.latency,
+             (unsigned long)ble_link.timeout * 10UL, ble_link.data_len, ble_link.tx_phy, ble_link.rx_phy);
+}
+
+static const transport_t transport_ble = {
+    .name = "BLE",
+    .open = ble_open,
+    .available = ble_available,
+    .read = ble_read,
+    .write = ble_write,
+    .close = ble_close,
+    .address = ble_address,
+    .get_stats = ble_get_stats,
+    .link_info = ble_link_info,
+};
+
+const transport_t *TransportBle_Get(void)
+{
+    return &transport_ble;
+}
+
+bool TransportBle_GetMac(uint8_t mac[6])
+{
+    unsigned int b[6];
+    uint32_t i;
+    bool nonzero = false;
+
+    if (sscanf(mac_buf, "%2x:%2x:%2x:%2x:%2x:%2x", &b[0], &b[1], &b[2], &b[3], &b[4], &b[5]) != 6)
+        return false;
+    for (i = 0; i < 6; ++i) {
+        mac[i] = (uint8_t)b[i];
+        nonzero |= b[i] != 0;
+    }
+    return nonzero;
+}
+
+bool TransportBle_Connected(void)
+{
+    return connected;
+}
+
+void TransportBle_SetAdvertisingTimeout(uint32_t ms)
+{
+    adv_timeout_ms = ms;
+}
@@ -0,0 +1,133 @@
+/**
+  ******************************************************************************
+  * @file    transport_loopback.c
+  * @brief   In-memory transport for benchmarking the download engine.
+  ******************************************************************************
+  */
+
+#include "transport_loopback.h"
+#include "spsc_ring.h"
+#include <stdio.h>
+
+#define LOOPBACK_BUFFER_SIZE  4096   /* per direction, power of two */
+
+static uint8_t to_wsm_buffer[LOOPBACK_BUFFER_SIZE];
+static uint8_t to_pc_buffer[LOOPBACK_BUFFER_SIZE];
+static spsc_ring_t to_wsm;
+static spsc_ring_t to_pc;
+static void (*service)(void);
+static uint32_t bytes_in;
+static uint32_t bytes_out;
+static uint32_t overruns;
+
+void TransportLoopback_Init(void (*host_service)(void))
+{
+    service = host_service;
+    SpscRing_Init(&to_wsm, to_wsm_buffer, sizeof(to_wsm_buffer));
+    SpscRing_Init(&to_pc, to_pc_buffer, sizeof(to_pc_buffer));
+}
+
+uint32_t TransportLoopback_HostWrite(const uint8_t *data, uint32_t len)
+{
+    uint32_t i;
+
+    for (i = 0; i < len; i++) {
+        if (!SpscRing_Put(&to_wsm, data[i]))
+            break;
+    }
+    return i;
+}
+
+uint32_t TransportLoopback_HostRead(uint8_t *dst, uint32_t len)
+{
+    return SpscRing_Read(&to_pc, dst, len);
+}
+
+static bool loopback_open(const char **error)
+{
+    (void)error;
+    bytes_in = 0;
+    bytes_out = 0;
+    overruns = 0;
+    return true;
+}
+
+static uint32_t loopback_available(void)
+{
+    if (SpscRing_Count(&to_wsm) == 0 && service != NULL)
+        service();
+    return SpscRing_Count(&to_wsm);
+}
+
+static uint32_t loopback_read(uint8_t *dst, uint32_t len)
+{
+    uint32_t n;
+
+    if (SpscRing_Count(&to_wsm) == 0 && service != NULL)
+        service();
+    n = SpscRing_Read(&to_wsm, dst, len);
+    bytes_in += n;
+    return n;
+}
+
+/* Blocks only as long as host_service makes room; without progress the
+   rest of the write is dropped and counted, like a full link would. */
+static bool loopback_write(const uint8_t *data, uint32_t len)
+{
+    uint32_t i = 0;
+
+    while (i < len) {
+        if (SpscRing_Put(&to_pc, data[i])) {
+            i++;
+            continue;
+        }
+        if (service == NULL)
+            break;
+        service();
+        if (SpscRing_Free(&to_pc) == 0)
+            break;
+    }
+    bytes_out += i;
+    overruns += len - i;
+    return i == len;
+}
+
+static void loopback_close(void)
+{
+}
+
+static const char *loopback_address(void)
+{
+    return "00:00:00:00:00:00";
+}
+
+static void loopback_get_stats(transport_stats_t *stats)
+{
+    stats->rx_window = SpscRing_Size(&to_wsm);
+    stats->rx_overruns = SpscRing_Overflows(&to_wsm);
+    stats->bytes_in = bytes_in;
+    stats->bytes_out = bytes_out;
+}
+
+static void loopback_link_info(char *buf, size_t len)
+{
+    snprintf(buf, len, "TRANSPORT=LOOPBACK IN=%lu OUT=%lu TX_DROPPED=%lu",
+             (unsigned long)bytes_in, (unsigned long)bytes_out, (unsigned long)overruns);
+}
+
+static const transport_t transport_loopback = {
+    .name = "LOOPBACK",
+    .open = loopback_open,
+    .available = loopback_available,
+    .read = loopback_read,
+    .write = loopback_write,
+    .close = loopback_close,
+    .address = loopback_address,
+    .get_stats = loopback_get_stats,
+    .link_info = loopback_link_info,
+};
+
+const transport_t *TransportLoopback_Get(void)
+{
+    return &transport_loopback;
+}
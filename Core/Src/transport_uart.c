@@ -0,0 +1,193 @@
+/**
+  ******************************************************************************
+  * @file    transport_uart.c
+  * @brief   Wired USART1 transport: boot-time entry check (strap or magic
+  *          sequence) and interrupt-fed receive ring.
+  ******************************************************************************
+  */
+
+#include "transport_uart.h"
+#include "session_stats.h"
+#include "spsc_ring.h"
+#include "events.h"
+#include "main.h"
+#include <string.h>
+#include <stdio.h>
+
+#define UART_RX_BUFFER_SIZE  4096   /* must be a power of two (spsc_ring) */
+
+#include "stm32f4xx_hal_uart.h"
+extern UART_HandleTypeDef huart1;
+
+static uint8_t rx_buffer[UART_RX_BUFFER_SIZE];
+static spsc_ring_t rx_ring;
+static uint8_t uart_rx_byte;
+static volatile bool active;
+static char uid[28];
+static uint32_t bytes_in;
+static uint32_t bytes_out;
+
+/* Strap is a spare pin: pull it up only for the read, then park it as
+   analog again like the rest of the unused pins. */
+static bool strap_pulled_low(void)
+{
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    bool low;
+
+    GPIO_InitStruct.Pin = WIRED_STRAP_Pin;
+    GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+    GPIO_InitStruct.Pull = GPIO_PULLUP;
+    HAL_GPIO_Init(WIRED_STRAP_GPIO_Port, &GPIO_InitStruct);
+    HAL_Delay(1);
+    low = HAL_GPIO_ReadPin(WIRED_STRAP_GPIO_Port, WIRED_STRAP_Pin) == GPIO_PIN_RESET;
+
+    GPIO_InitStruct.Mode = GPIO_MODE_ANALOG;
+    GPIO_InitStruct.Pull = GPIO_NOPULL;
+    HAL_GPIO_Init(WIRED_STRAP_GPIO_Port, &GPIO_InitStruct);
+    return low;
+}
+
+/* Match WIRED_MAGIC anywhere in what arrives within the window. */
+static bool magic_received(uint32_t window_ms)
+{
+    const char *magic = WIRED_MAGIC;
+    size_t matched = 0;
+    uint32_t start = HAL_GetTick();
+    uint8_t b;
+
+    while (HAL_GetTick() - start < window_ms) {
+        if (HAL_UART_Receive(&huart1, &b, 1, 1) != HAL_OK)
+            continue;
+        if (b == (uint8_t)magic[matched])
+            matched++;
+        else
+            matched = (b == (uint8_t)magic[0]) ? 1 : 0;
+        if (magic[matched] == '\0')
+            return true;
+    }
+    return false;
+}
+
+bool TransportUart_Requested(void)
+{
+    char ack[32];
+    int len;
+
+    if (!strap_pulled_low()
+        && (BOOTLOADER_WIRED_MAGIC_WINDOW_MS == 0 || !magic_received(BOOTLOADER_WIRED_MAGIC_WINDOW_MS)))
+        return false;
+
+    /* Blocking transmit returns after the last stop bit, so the PC sees the
+       whole answer before the baud rate changes. */
+    len = snprintf(ack, sizeof(ack), "WSM WIRED %lu\r\n", (unsigned long)BOOTLOADER_WIRED_BAUD);
+    HAL_UART_Transmit(&huart1, (uint8_t *)ack, (uint16_t)len, 100);
+    return true;
+}
+
+bool TransportUart_Active(void)
+{
+    return active;
+}
+
+void TransportUart_UartRxCplt(void)
+{
+    (void)SpscRing_Put(&rx_ring, uart_rx_byte);
+    Events_Post(EVENT_RX);
+    HAL_UART_Receive_IT(&huart1, &uart_rx_byte, 1);
+}
+
+static bool uart_open(const char **error)
+{
+    const uint32_t *id = (const uint32_t *)UID_BASE;
+
+    bytes_in = 0;
+    bytes_out = 0;
+    SpscRing_Init(&rx_ring, rx_buffer, sizeof(rx_buffer));
+    snprintf(uid, sizeof(uid), "%08lX%08lX%08lX",
+             (unsigned long)id[2], (unsigned long)id[1], (unsigned long)id[0]);
+
+    HAL_UART_Abort(&huart1);
+    huart1.Init.BaudRate = BOOTLOADER_WIRED_BAUD;
+    if (HAL_UART_Init(&huart1) != HAL_OK) {
+        *error = "UART init failed";
+        return false;
+    }
+    /* Let the PC's last magic bytes, sent at the old baud, go by. */
+    HAL_Delay(20);
+    __HAL_UART_CLEAR_OREFLAG(&huart1);
+    (void)huart1.Instance->DR;
+
+    /* USART1 otherwise only carries blocking debug prints. */
+    HAL_NVIC_SetPriority(USART1_IRQn, 0, 0);
+    HAL_NVIC_EnableIRQ(USART1_IRQn);
+    active = true;
+    HAL_UART_Receive_IT(&huart1, &uart_rx_byte, 1);
+
+    SessionStats_SetTransport(SESSION_TRANSPORT_UART);
+    return true;
+}
+
+static uint32_t uart_available(void)
+{
+    return SpscRing_Count(&rx_ring);
+}
+
+static uint32_t uart_read(uint8_t *dst, uint32_t len)
+{
+    uint32_t n = SpscRing_Read(&rx_ring, dst, len);
+
+    bytes_in += n;
+    return n;
+}
+
+static bool uart_write(const uint8_t *data, uint32_t len)
+{
+    if (HAL_UART_Transmit(&huart1, (uint8_t *)data, (uint16_t)len, 2000) != HAL_OK)
+        return false;
+    bytes_out += len;
+    return true;
+}
+
+static void uart_close(void)
+{
+    HAL_UART_AbortReceive_IT(&huart1);
+    HAL_NVIC_DisableIRQ(USART1_IRQn);
+    active = false;
+}
+
+/* MCU unique ID: there is no radio MAC on this link. */
+static const char *uart_address(void)
+{
+    return uid;
+}
+
+static void uart_get_stats(transport_stats_t *stats)
+{
+    stats->rx_window = SpscRing_Size(&rx_ring);
+    stats->rx_overruns = SpscRing_Overflows(&rx_ring);
+    stats->bytes_in = bytes_in;
+    stats->bytes_out = bytes_out;
+}
+
+/* "TRANSPORT=UART BAUD=<baud>" */
+static void uart_link_info(char *buf, size_t len)
+{
+    snprintf(buf, len, "TRANSPORT=UART BAUD=%lu", (unsigned long)huart1.Init.BaudRate);
+}
+
+static const transport_t transport_uart = {
+    .name = "UART",
+    .open = uart_open,
+    .available = uart_available,
+    .read = uart_read,
+    .write = uart_write,
+    .close = uart_close,
+    .address = uart_address,
+    .get_stats = uart_get_stats,
+    .link_info = uart_link_info,
+};
+
+const transport_t *TransportUart_Get(void)
+{
+    return &transport_uart;
+}
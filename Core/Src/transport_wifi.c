@@ -0,0 +1,273 @@
+/**
+  ******************************************************************************
+  * @file    transport_wifi.c
+  * @brief   Wi-Fi station / TCP transport via the Stephano-I module.
+  ******************************************************************************
+  */
+
+#include "transport_wifi.h"
+#include "at_command.h"
+#include "boot_timing.h"
+#include "param_store.h"
+#include "session_stats.h"
+#include "stephano.h"
+#include "main.h"
+#include <string.h>
+#include <stdio.h>
+
+#ifndef BOOTLOADER_DEBUG_ENABLE
+#define BOOTLOADER_DEBUG_ENABLE 1
+#endif
+
+#define WIFI_JOIN_TIMEOUT_MS     15000
+#define WIFI_CONNECT_TIMEOUT_MS  5000
+#define WIFI_ADDR_SIZE           20
+#define WIFI_SSID_MAX            32     /* 802.11 */
+#define WIFI_PASSWORD_MAX        64     /* WPA2 passphrase or PSK */
+#define WIFI_SERVER_MAX          64
+
+#include "stm32f4xx_hal_uart.h"
+extern UART_HandleTypeDef huart1;
+
+static char sta_mac[WIFI_ADDR_SIZE] = "00:00:00:00:00:00";
+static char wifi_ssid[WIFI_SSID_MAX + 1];
+static char wifi_password[WIFI_PASSWORD_MAX + 1];
+static char wifi_server[WIFI_SERVER_MAX + 1];
+static unsigned int wifi_port;
+static bool tcp_connected;
+static bool passthrough;
+static int wifi_rssi;
+static unsigned int wifi_channel;
+static uint32_t bytes_in;
+static uint32_t bytes_out;
+
+/* Text parameter key into out, or fallback if it has none that fits. */
+static void load_text(uint16_t key, char *out, size_t size, const char *fallback)
+{
+    char value[PARAM_VALUE_MAX + 1];
+    uint32_t len;
+
+    if (ParamStore_Get(key, value, PARAM_VALUE_MAX, &len) && len < size) {
+        memcpy(out, value, len);
+        out[len] = '\0';
+    } else {
+        strncpy(out, fallback, size - 1);
+        out[size - 1] = '\0';
+    }
+}
+
+static void load_settings(void)
+{
+    uint32_t port, len;
+
+    load_text(PARAM_WIFI_SSID, wifi_ssid, sizeof(wifi_ssid), BOOTLOADER_WIFI_SSID);
+    load_text(PARAM_WIFI_PASSWORD, wifi_password, sizeof(wifi_password), BOOTLOADER_WIFI_PASSWORD);
+    load_text(PARAM_WIFI_SERVER, wifi_server, sizeof(wifi_server), BOOTLOADER_WIFI_SERVER);
+    if (ParamStore_Get(PARAM_WIFI_PORT, &port, sizeof(port), &len) && len == sizeof(port)
+        && port > 0 && port <= 0xFFFF)
+        wifi_port = (unsigned int)port;
+    else
+        wifi_port = BOOTLOADER_WIFI_PORT;
+}
+
+/* s as an AT string argument: quotes, commas and backslashes are escaped. */
+static size_t at_escape(char *out, size_t size, const char *s)
+{
+    size_t n = 0;
+
+    for (; *s != '\0' && n + 2 < size; s++) {
+        if (*s == '"' || *s == ',' || *s == '\\')
+            out[n++] = '\\';
+        out[n++] = *s;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+/* Copy the first "quoted" field after tag in resp into out. */
+static bool quoted_field(const char *resp, const char *tag, char *out, size_t len)
+{
+    const char *p = strstr(resp, tag);
+    size_t i = 0;
+
+    if (p == NULL || (p = strchr(p, '"')) == NULL)
+        return false;
+    p++;
+    while (*p && *p != '"' && i < len - 1)
+        out[i++] = *p++;
+    out[i] = '\0';
+    return i > 0;
+}
+
+/* Channel and RSSI of the joined AP, from
+   +CWJAP:"<ssid>","<bssid>",<channel>,<rssi>,... */
+static void read_ap_info(void)
+{
+    char resp[AT_MAX_RESPONSE_LEN];
+    const char *p;
+    int channel, rssi;
+
+    wifi_rssi = 0;
+    wifi_channel = 0;
+    if (AT_SendCommand("AT+CWJAP?", resp, sizeof(resp), 1000, true) != AT_OK)
+        return;
+    if ((p = strstr(resp, "+CWJAP:")) == NULL || (p = strstr(p, "\",\"")) == NULL
+        || (p = strstr(p + 3, "\",")) == NULL)
+        return;
+    if (sscanf(p + 2, "%d,%d", &channel, &rssi) == 2) {
+        wifi_channel = (unsigned int)channel;
+        wifi_rssi = rssi;
+    }
+}
+
+static bool wifi_open(const char **error)
+{
+    char cmd[2 * (WIFI_SSID_MAX + WIFI_PASSWORD_MAX) + 32];   /* every character escaped */
+    char resp[AT_MAX_RESPONSE_LEN];
+    size_t n;
+
+    bytes_in = 0;
+    bytes_out = 0;
+    tcp_connected = false;
+    passthrough = false;
+    load_settings();
+
+    if (!Stephano_Start(error))
+        return false;
+
+    if (AT_SendCommandRetry("AT+CWMODE=1", NULL, 0, 1000, STEPHANO_AT_SETUP_RETRIES) != AT_OK) {
+        *error = "AT+CWMODE failed";
+        return false;
+    }
+
+    if (AT_SendCommand("AT+CIPSTAMAC?", resp, sizeof(resp), 1000, true) != AT_OK
+        || !quoted_field(resp, "+CIPSTAMAC:", sta_mac, sizeof(sta_mac)))
+        strcpy(sta_mac, "00:00:00:00:00:00");
+
+#if BOOTLOADER_DEBUG_ENABLE
+  {
+    char dbg_msg[128];
+    int len = snprintf(dbg_msg, sizeof(dbg_msg), "%s joining %s\r\n", __FUNCTION__, wifi_ssid);
+    HAL_UART_Transmit(&huart1, (uint8_t*)dbg_msg, len, 1000);
+  }
+#endif
+
+    /* A failed join ends in "+CWJAP:<code>" and "FAIL", without OK/ERROR. */
+    n = (size_t)snprintf(cmd, sizeof(cmd), "AT+CWJAP=\"");
+    n += at_escape(cmd + n, sizeof(cmd) - n, wifi_ssid);
+    n += (size_t)snprintf(cmd + n, sizeof(cmd) - n, "\",\"");
+    n += at_escape(cmd + n, sizeof(cmd) - n, wifi_password);
+    snprintf(cmd + n, sizeof(cmd) - n, "\"");
+    if (AT_SendCommand(cmd, resp, sizeof(resp), WIFI_JOIN_TIMEOUT_MS, true) != AT_OK
+        || strstr(resp, "FAIL") != NULL || strstr(resp, "GOT IP") == NULL) {
+        *error = "Wi-Fi join failed";
+        return false;
+    }
+    read_ap_info();
+
+    if (AT_SendCommand("AT+CIPMUX=0", NULL, 0, 1000, true) != AT_OK) {
+        *error = "AT+CIPMUX failed";
+        return false;
+    }
+
+    n = (size_t)snprintf(cmd, sizeof(cmd), "AT+CIPSTART=\"TCP\",\"");
+    n += at_escape(cmd + n, sizeof(cmd) - n, wifi_server);
+    snprintf(cmd + n, sizeof(cmd) - n, "\",%u", wifi_port);
+    if (AT_SendCommand(cmd, resp, sizeof(resp), WIFI_CONNECT_TIMEOUT_MS, true) != AT_OK
+        || strstr(resp, "CONNECT") == NULL) {
+        *error = "TCP connect failed";
+        return false;
+    }
+    tcp_connected = true;
+
+    /* Passthrough: after AT+CIPSEND's '>' prompt the UART carries the TCP
+       stream both ways, just like BLE SPP. */
+    if (AT_SendCommand("AT+CIPMODE=1", NULL, 0, 1000, true) != AT_OK) {
+        *error = "AT+CIPMODE failed";
+        return false;
+    }
+    if (AT_SendCommand("AT+CIPSEND", resp, sizeof(resp), 1000, true) != AT_OK
+        || strchr(resp, '>') == NULL) {
+        *error = "AT+CIPSEND failed";
+        return false;
+    }
+    passthrough = true;
+
+    SessionStats_SetTransport(SESSION_TRANSPORT_WIFI);
+    BootTiming_Mark(BOOT_PHASE_SPP_READY);
+    Stephano_RxStart();
+    return true;
+}
+
+static uint32_t wifi_available(void)
+{
+    return SpscRing_Count(Stephano_RxRing());
+}
+
+static uint32_t wifi_read(uint8_t *dst, uint32_t len)
+{
+    uint32_t n = Stephano_Read(dst, len);
+
+    bytes_in += n;
+    return n;
+}
+
+static bool wifi_write(const uint8_t *data, uint32_t len)
+{
+    bytes_out += len;
+    return Stephano_Write(data, len);
+}
+
+/* Leave passthrough ("+++" framed by a quiet UART) and drop the connection,
+   as far as wifi_open got. Outside passthrough "+++" would be taken as a
+   malformed command. */
+static void wifi_close(void)
+{
+    Stephano_RxStop();
+    if (passthrough) {
+        HAL_Delay(50);
+        (void)Stephano_Write((const uint8_t *)"+++", 3);
+        HAL_Delay(1000);
+    }
+    if (tcp_connected)
+        (void)AT_SendCommand("AT+CIPCLOSE", NULL, 0, 1000, true);
+    passthrough = false;
+    tcp_connected = false;
+}
+
+static const char *wifi_address(void)
+{
+    return sta_mac;
+}
+
+static void wifi_get_stats(transport_stats_t *stats)
+{
+    stats->rx_window = SpscRing_Size(Stephano_RxRing());
+    stats->rx_overruns = SpscRing_Overflows(Stephano_RxRing());
+    stats->bytes_in = bytes_in;
+    stats->bytes_out = bytes_out;
+}
+
+/* "TRANSPORT=WIFI SSID=<ssid> CHANNEL=<n> RSSI=<dBm> SERVER=<host>:<port>" */
+static void wifi_link_info(char *buf, size_t len)
+{
+    snprintf(buf, len, "TRANSPORT=WIFI SSID=%s CHANNEL=%u RSSI=%d SERVER=%s:%u",
+             wifi_ssid, wifi_channel, wifi_rssi, wifi_server, wifi_port);
+}
+
+static const transport_t transport_wifi = {
+    .name = "WIFI",
+    .open = wifi_open,
+    .available = wifi_available,
+    .read = wifi_read,
+    .write = wifi_write,
+    .close = wifi_close,
+    .address = wifi_address,
+    .get_stats = wifi_get_stats,
+    .link_info = wifi_link_info,
+};
+
+const transport_t *TransportWifi_Get(void)
+{
+    return &transport_wifi;
+}
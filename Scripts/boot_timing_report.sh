@@ -0,0 +1,107 @@
+#!/usr/bin/env sh
+#
+# Host-side formatter for the bootloader phase timing table.
+# Reads a capture of the WSM session or debug UART containing the lines
+# emitted by BootTiming_Report() (reply to "WSM TIMING"):
+#
+#   TIMING <this|prev> <idx> <PHASE> <time_us> <tick_ms>
+#   TIMING END
+#
+# and prints, per boot, each phase with its start time since reset and its
+# duration (gap to the next mark).
+# Uses only: sh, awk.
+#
+# Usage: boot_timing_report.sh [-b <budget-file>] [<capture-file>]
+#   Reads stdin when no capture file is given.
+#
+# Budget file (optional), one rule per line, '#' starts a comment:
+#   <PHASE> <max_duration_ms>     duration of PHASE must not exceed the limit
+#   @<PHASE> <max_start_ms>       PHASE must start within the limit from reset
+# Only the "this" boot is checked. Exits 2 when a budget is exceeded.
+#
+
+set -e
+
+BUDGET=""
+if [ "$1" = "-b" ]; then
+  if [ $# -lt 2 ]; then
+    echo "Usage: $0 [-b <budget-file>] [<capture-file>]" >&2
+    exit 1
+  fi
+  BUDGET="$2"
+  shift 2
+fi
+
+if [ -n "$BUDGET" ] && [ ! -f "$BUDGET" ]; then
+  echo "Error: budget file not found: $BUDGET" >&2
+  exit 1
+fi
+
+INPUT="${1:--}"
+if [ "$INPUT" != "-" ] && [ ! -f "$INPUT" ]; then
+  echo "Error: capture file not found: $INPUT" >&2
+  exit 1
+fi
+
+awk -v budget="$BUDGET" '
+BEGIN {
+  nb = 0
+  if (budget != "") {
+    while ((getline ln < budget) > 0) {
+      sub(/#.*/, "", ln)
+      if (split(ln, f, " ") < 2) continue
+      if (substr(f[1], 1, 1) == "@") start_limit[substr(f[1], 2)] = f[2] + 0
+      else dur_limit[f[1]] = f[2] + 0
+      nb++
+    }
+    close(budget)
+  }
+}
+{
+  # Tolerate prefixes such as debug "Received" wrappers or timestamps.
+  p = index($0, "TIMING ")
+  if (p == 0) next
+  split(substr($0, p), f, " ")
+  if (f[2] == "END") next
+  boot = f[2]
+  idx = f[3] + 0
+  name[boot, idx] = f[4]
+  us[boot, idx] = f[5] + 0
+  if (!((boot) in cnt) || idx + 1 > cnt[boot]) cnt[boot] = idx + 1
+}
+END {
+  fail = 0
+  nboots = split("prev this", order, " ")
+  for (o = 1; o <= nboots; o++) {
+    boot = order[o]
+    if (!((boot) in cnt)) continue
+    printf "== %s boot ==\n", boot
+    printf "%-4s %-22s %12s %12s\n", "#", "phase", "start_ms", "duration_ms"
+    for (i = 0; i < cnt[boot]; i++) {
+      start = us[boot, i] / 1000.0
+      if (i + 1 < cnt[boot]) {
+        dur = (us[boot, i + 1] - us[boot, i]) / 1000.0
+        durs = sprintf("%12.3f", dur)
+      } else {
+        dur = -1
+        durs = sprintf("%12s", "-")
+      }
+      printf "%-4d %-22s %12.3f %s\n", i, name[boot, i], start, durs
+
+      if (boot != "this") continue
+      n = name[boot, i]
+      if ((n in dur_limit) && dur >= 0 && dur > dur_limit[n]) {
+        printf "BUDGET EXCEEDED: %s took %.3f ms (limit %d ms)\n", n, dur, dur_limit[n]
+        fail = 1
+      }
+      if ((n in start_limit) && start > start_limit[n]) {
+        printf "BUDGET EXCEEDED: %s started at %.3f ms (limit %d ms)\n", n, start, start_limit[n]
+        fail = 1
+      }
+    }
+    printf "\n"
+  }
+  if (nb > 0 && !fail) printf "All %d budget rules met.\n", nb
+  exit fail ? 2 : 0
+}
+' "$INPUT"
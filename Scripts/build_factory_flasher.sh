@@ -0,0 +1,43 @@
+#!/usr/bin/env sh
+#
+# Builds the RAM-resident factory flasher: the bootloader sources compiled
+# with -DFACTORY_FLASHER and linked with STM32F401RETX_RAM.ld, so the whole
+# image (vectors included) runs from SRAM at 0x20000000. Load it with a
+# debugger (load the ELF, then start at the reset vector) or with the ROM
+# bootloader's Write Memory + Go; it then serves Scripts/factory_flash.py
+# over USART1 (see Core/Inc/factory_flasher.h).
+# Uses the same arm-none-eabi toolchain and flags as the CubeIDE build.
+#
+# Usage: build_factory_flasher.sh [<output-dir>]
+#   Output dir defaults to FactoryFlasher/ in the project root.
+#   FLASHER_BAUD=<baud> overrides the wire speed (default 3000000).
+# Output: <output-dir>/wsm_factory_flasher.elf, .bin, .map
+#
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+OUT=${1:-"$ROOT/FactoryFlasher"}
+BAUD=${FLASHER_BAUD:-3000000}
+NAME=wsm_factory_flasher
+
+CC=arm-none-eabi-gcc
+CPU="-mcpu=cortex-m4 -mthumb -mfpu=fpv4-sp-d16 -mfloat-abi=hard"
+DEFS="-DUSE_HAL_DRIVER -DSTM32F401xE -DFACTORY_FLASHER -DFLASHER_BAUD=$BAUD -DUSER_VECT_TAB_ADDRESS -DVECT_TAB_SRAM"
+INCS="-I$ROOT/Core/Inc -I$ROOT/Drivers/STM32F4xx_HAL_Driver/Inc -I$ROOT/Drivers/STM32F4xx_HAL_Driver/Inc/Legacy -I$ROOT/Drivers/CMSIS/Device/ST/STM32F4xx/Include -I$ROOT/Drivers/CMSIS/Include"
+CFLAGS="$CPU -std=gnu11 -g3 -Os -ffunction-sections -fdata-sections -Wall --specs=nano.specs $DEFS $INCS"
+
+mkdir -p "$OUT/obj"
+rm -f "$OUT"/obj/*.o
+
+for SRC in "$ROOT"/Core/Src/*.c "$ROOT"/Drivers/STM32F4xx_HAL_Driver/Src/*.c; do
+  $CC $CFLAGS -c "$SRC" -o "$OUT/obj/$(basename "$SRC" .c).o"
+done
+$CC $CPU -g3 -c -x assembler-with-cpp "$ROOT/Core/Startup/startup_stm32f401retx.s" -o "$OUT/obj/startup_stm32f401retx.o"
+
+$CC -o "$OUT/$NAME.elf" "$OUT"/obj/*.o $CPU -T"$ROOT/STM32F401RETX_RAM.ld" \
+  --specs=nosys.specs --specs=nano.specs -Wl,-Map="$OUT/$NAME.map" -Wl,--gc-sections -static \
+  -Wl,--start-group -lc -lm -Wl,--end-group
+arm-none-eabi-objcopy -O binary "$OUT/$NAME.elf" "$OUT/$NAME.bin"
+arm-none-eabi-size "$OUT/$NAME.elf"
+echo "Factory flasher: $OUT/$NAME.elf (load at 0x20000000, $BAUD baud)"
@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+#
+# Factory-line host for the RAM-resident flasher (build it with
+# Scripts/build_factory_flasher.sh and load it into SRAM first). Programs
+# one or more regions over the USART1 wire, pipelining WRITE frames up to
+# the flasher's receive window, checks every region's SHA-256 read back
+# from flash, and prints the flasher's timing report.
+#
+#   region = <address>:<file>, e.g.
+#     0x08010000:well-monitor-2-bootloader.bin   (sector 4)
+#     0x0800C000:params.bin                      (sector 3)
+#     0x08060000:app.bin                         (sector 7)
+#
+# Blocks that are all 0xFF are skipped; the erase already left them so.
+# Uses only the Python 3 standard library.
+#
+# Usage: factory_flash.py --serial /dev/ttyUSB0 [--baud 3000000]
+#            [--block 2048] [--no-reset] <region> [<region> ...]
+#
+
+import argparse
+import hashlib
+import os
+import select
+import sys
+import termios
+import time
+import tty
+
+
+class Wire:
+    def __init__(self, path, baud):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+        attrs = termios.tcgetattr(self.fd)
+        attrs[4] = attrs[5] = getattr(termios, "B%d" % baud)
+        termios.tcsetattr(self.fd, termios.TCSANOW, attrs)
+        termios.tcflush(self.fd, termios.TCIOFLUSH)
+        self.buf = b""
+
+    def send(self, data):
+        while data:
+            data = data[os.write(self.fd, data):]
+
+    def read_line(self, timeout=10.0):
+        deadline = time.monotonic() + timeout
+        while b"\n" not in self.buf:
+            left = deadline - time.monotonic()
+            if left <= 0:
+                raise TimeoutError("no answer from the flasher")
+            ready, _, _ = select.select([self.fd], [], [], left)
+            if ready:
+                self.buf += os.read(self.fd, 4096)
+        line, self.buf = self.buf.split(b"\n", 1)
+        return line.rstrip(b"\r").decode(errors="replace")
+
+    def command(self, line, expect, timeout=10.0):
+        self.send(line.encode() + b"\n")
+        reply = self.read_line(timeout)
+        if not reply.startswith(expect):
+            raise RuntimeError("%s -> %s" % (line, reply))
+        return reply
+
+
+def connect(wire):
+    """PING until the flasher answers; returns its receive window."""
+    for _ in range(20):
+        wire.send(b"PING\n")
+        try:
+            reply = wire.read_line(0.25)
+        except TimeoutError:
+            continue
+        if reply.startswith("FLASHER READY "):
+            return int(reply.split()[2])
+    raise RuntimeError("flasher not answering (loaded and running?)")
+
+
+def program(wire, addr, data, block, window):
+    wire.command("ERASE 0x%08X %d" % (addr, len(data)), "ERASE OK", timeout=30.0)
+
+    frames = []
+    for off in range(0, len(data), block):
+        chunk = data[off:off + block]
+        if chunk.count(0xFF) == len(chunk):
+            continue
+        frames.append(("WRITE 0x%08X %d\n" % (addr + off, len(chunk))).encode() + chunk)
+
+    in_flight = []
+    for frame in frames:
+        while in_flight and sum(in_flight) + len(frame) > window:
+            ack(wire, in_flight)
+        wire.send(frame)
+        in_flight.append(len(frame))
+    while in_flight:
+        ack(wire, in_flight)
+
+    want = hashlib.sha256(data).hexdigest()
+    got = wire.command("SHA256 0x%08X %d" % (addr, len(data)), "SHA256 ").split()[1]
+    if got != want:
+        raise RuntimeError("0x%08X: SHA-256 mismatch, flash %s, image %s" % (addr, got, want))
+
+
+def ack(wire, in_flight):
+    reply = wire.read_line()
+    if not reply.startswith("WRITE OK"):
+        raise RuntimeError(reply)
+    in_flight.pop(0)
+
+
+def parse_region(text):
+    addr, _, path = text.partition(":")
+    if not path:
+        raise argparse.ArgumentTypeError("region is <address>:<file>")
+    with open(path, "rb") as f:
+        data = f.read()
+    # Words are programmed whole; pad like erased flash.
+    data += b"\xff" * (-len(data) % 4)
+    return int(addr, 0), data, path
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Program a WSM through the RAM flasher")
+    parser.add_argument("--serial", required=True)
+    parser.add_argument("--baud", type=int, default=3000000)
+    parser.add_argument("--block", type=int, default=2048, help="WRITE payload size (max 2048)")
+    parser.add_argument("--no-reset", action="store_true", help="leave the flasher running")
+    parser.add_argument("regions", nargs="+", type=parse_region, metavar="address:file")
+    args = parser.parse_args()
+
+    wire = Wire(args.serial, args.baud)
+    start = time.monotonic()
+    try:
+        window = connect(wire)
+        for addr, data, path in args.regions:
+            t = time.monotonic()
+            program(wire, addr, data, args.block, window)
+            print("0x%08X %s: %d bytes, %.2f s, verified"
+                  % (addr, path, len(data), time.monotonic() - t))
+        print(wire.command("TIMING", "TIMING "))
+        if not args.no_reset:
+            wire.command("RESET", "RESET OK")
+    except (RuntimeError, TimeoutError) as e:
+        print("!! %s" % e)
+        return 1
+    print("-- board done in %.2f s" % (time.monotonic() - start))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
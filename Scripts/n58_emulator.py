@@ -0,0 +1,288 @@
+#!/usr/bin/env python3
+#
+# Emulates the Neoway N58 modem on the WSM's EXT_MODEM port, for
+# bench-testing the cellular update path (BOOTLOADER_ENABLE_CELLULAR=1)
+# without a SIM or network. Answers the AT subset the bootloader uses:
+#
+#   AT, ATE0, AT+CPIN?, AT+CGDCONT, AT+CREG?, AT+XIIC=1, AT+XIIC?
+#   AT+TCPSETUP=0,<host>,<port>   AT+TCPSEND=0,<len>   AT+TCPCLOSE=0
+#
+# and pushes received TCP data as "+TCPRECV:0,<len>,<data>".
+# The TCP link is either proxied to the real host:port (--proxy) or
+# answered here by a small HTTP server for --image, with Range and ETag
+# support. --drop-after cuts the link once, mid-download, to exercise
+# resume.
+# Uses only the Python 3 standard library.
+#
+# Usage: n58_emulator.py (--serial /dev/ttyUSB0 | --pty) [--baud 115200]
+#            (--image <app.bin> | --proxy) [--etag <tag>]
+#            [--recv-size <bytes>] [--drop-after <bytes>]
+#
+
+import argparse
+import hashlib
+import os
+import select
+import socket
+import sys
+import termios
+import tty
+
+
+def open_serial(path, baud):
+    fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+    tty.setraw(fd)
+    attrs = termios.tcgetattr(fd)
+    speed = getattr(termios, "B%d" % baud)
+    attrs[4] = attrs[5] = speed
+    termios.tcsetattr(fd, termios.TCSANOW, attrs)
+    return fd
+
+
+class HttpImage:
+    """Serves one image for any GET path, honouring single byte ranges."""
+
+    def __init__(self, image, etag):
+        self.image = image
+        self.etag = etag
+        self.buf = b""
+
+    def feed(self, data):
+        """Request bytes in; returns (response bytes, close after)."""
+        self.buf += data
+        out, close = b"", False
+        while b"\r\n\r\n" in self.buf:
+            head, self.buf = self.buf.split(b"\r\n\r\n", 1)
+            lines = head.decode(errors="replace").split("\r\n")
+            headers = {}
+            for h in lines[1:]:
+                if ":" in h:
+                    k, v = h.split(":", 1)
+                    headers[k.strip().lower()] = v.strip()
+            print("<< %s  %s" % (lines[0], headers.get("range", "")))
+            rsp, c = self.respond(headers)
+            out += rsp
+            close = close or c or headers.get("connection", "").lower() == "close"
+        return out, close
+
+    def respond(self, headers):
+        size = len(self.image)
+        rng = headers.get("range", "")
+        if not rng.startswith("bytes="):
+            body = self.image
+            return self.head("200 OK", len(body), []) + body, False
+        a, _, b = rng[6:].partition("-")
+        start = int(a)
+        end = min(int(b) if b else size - 1, size - 1)
+        if start >= size:
+            return self.head("416 Range Not Satisfiable", 0,
+                             ["Content-Range: bytes */%d" % size]), False
+        body = self.image[start:end + 1]
+        return self.head("206 Partial Content", len(body),
+                         ["Content-Range: bytes %d-%d/%d" % (start, end, size)]) + body, False
+
+    def head(self, status, length, extra):
+        lines = ["HTTP/1.1 " + status,
+                 "Content-Type: application/octet-stream",
+                 "Content-Length: %d" % length,
+                 'ETag: "%s"' % self.etag,
+                 "Accept-Ranges: bytes"] + extra
+        print(">> " + status + ("  " + extra[0] if extra else ""))
+        return ("\r\n".join(lines) + "\r\n\r\n").encode()
+
+
+class Modem:
+    def __init__(self, fd, args, image):
+        self.fd = fd
+        self.args = args
+        self.image = image
+        self.echo = True
+        self.ppp = False
+        self.sock = None         # --proxy
+        self.http = None         # --image
+        self.pending = b""       # data waiting to be pushed as +TCPRECV
+        self.close_after = False
+        self.sent_total = 0
+        self.dropped = False
+        self.line = b""
+        self.skip_lf = False     # the LF of a CRLF-terminated command
+        self.send_left = 0       # raw bytes expected after AT+TCPSEND
+        self.send_buf = b""
+
+    def out(self, text):
+        os.write(self.fd, text if isinstance(text, bytes) else text.encode())
+
+    def reply(self, *lines):
+        for l in lines:
+            self.out("\r\n" + l + "\r\n")
+
+    def link_open(self):
+        return self.sock is not None or self.http is not None
+
+    def link_close(self, urc):
+        if self.sock is not None:
+            self.sock.close()
+        self.sock = None
+        self.http = None
+        self.pending = b""
+        self.close_after = False
+        if urc:
+            self.reply("+TCPCLOSE:0,Link Closed")
+
+    def command(self, cmd):
+        print("AT< " + cmd)
+        u = cmd.upper()
+        if u == "AT" or u.startswith("AT+CGDCONT="):
+            self.reply("OK")
+        elif u == "ATE0":
+            self.echo = False
+            self.reply("OK")
+        elif u == "AT+CPIN?":
+            self.reply("+CPIN: READY", "OK")
+        elif u == "AT+CREG?":
+            self.reply("+CREG: 0,1", "OK")
+        elif u == "AT+XIIC=1":
+            self.ppp = True
+            self.reply("OK")
+        elif u == "AT+XIIC?":
+            self.reply("+XIIC:    1, 10.0.0.2" if self.ppp else "+XIIC:    0, 0.0.0.0", "OK")
+        elif u.startswith("AT+TCPSETUP="):
+            self.tcp_setup(cmd[12:])
+        elif u.startswith("AT+TCPSEND="):
+            n = int(cmd.split(",")[1])
+            if not self.link_open():
+                self.reply("ERROR")
+                return
+            self.send_left = n
+            self.send_buf = b""
+            self.out("\r\n>")
+        elif u.startswith("AT+TCPCLOSE="):
+            self.link_close(False)
+            self.reply("OK", "+TCPCLOSE:0,OK")
+        else:
+            self.reply("ERROR")
+
+    def tcp_setup(self, params):
+        _, host, port = params.split(",")
+        if not self.ppp:
+            self.reply("ERROR")
+            return
+        self.link_close(False)
+        if self.args.proxy:
+            try:
+                self.sock = socket.create_connection((host, int(port)), timeout=10)
+            except OSError as e:
+                print("!! connect %s:%s failed: %s" % (host, port, e))
+                self.reply("OK", "+TCPSETUP:0,FAIL")
+                return
+        else:
+            self.http = HttpImage(self.image, self.args.etag)
+        print("-- link to %s:%s open" % (host, port))
+        self.reply("OK", "+TCPSETUP:0,OK")
+
+    def tcp_data(self, data):
+        """Bytes the WSM sent on the link."""
+        self.reply("OK", "+TCPSEND:0,%d" % len(data))
+        if self.sock is not None:
+            self.sock.sendall(data)
+        elif self.http is not None:
+            rsp, close = self.http.feed(data)
+            self.pending += rsp
+            self.close_after = self.close_after or close
+
+    def push(self):
+        """Hand pending link data to the WSM, one +TCPRECV at a time."""
+        if not self.pending:
+            if self.close_after:
+                self.link_close(True)
+            return
+        n = min(len(self.pending), self.args.recv_size)
+        if self.args.drop_after and not self.dropped and self.sent_total + n >= self.args.drop_after:
+            n = max(0, self.args.drop_after - self.sent_total)
+            self.dropped = True
+            if n:
+                self.out(("\r\n+TCPRECV:0,%d," % n).encode() + self.pending[:n] + b"\r\n")
+            print("-- dropping the link after %d bytes" % (self.sent_total + n))
+            self.link_close(True)
+            return
+        data, self.pending = self.pending[:n], self.pending[n:]
+        self.sent_total += n
+        self.out(("\r\n+TCPRECV:0,%d," % n).encode() + data + b"\r\n")
+
+    def serial_in(self, data):
+        for i in range(len(data)):
+            b = data[i:i + 1]
+            if self.skip_lf:
+                self.skip_lf = False
+                if b == b"\n":
+                    continue
+            if self.send_left:
+                self.send_buf += b
+                self.send_left -= 1
+                if not self.send_left:
+                    self.tcp_data(self.send_buf)
+                continue
+            if self.echo:
+                self.out(b)
+            if b in (b"\r", b"\n"):
+                self.skip_lf = b == b"\r"
+                if self.line.strip():
+                    self.command(self.line.strip().decode(errors="replace"))
+                self.line = b""
+            else:
+                self.line += b
+
+    def run(self):
+        while True:
+            rlist = [self.fd] + ([self.sock] if self.sock is not None else [])
+            ready, _, _ = select.select(rlist, [], [], 0.01 if self.pending or self.close_after else 1)
+            if self.fd in ready:
+                self.serial_in(os.read(self.fd, 4096))
+            if self.sock is not None and self.sock in ready:
+                data = self.sock.recv(4096)
+                if data:
+                    self.pending += data
+                else:
+                    self.close_after = True
+            self.push()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="N58 modem emulator")
+    port = parser.add_mutually_exclusive_group(required=True)
+    port.add_argument("--serial", help="serial device wired to the WSM EXT_MODEM port")
+    port.add_argument("--pty", action="store_true", help="create a pseudo-terminal instead")
+    parser.add_argument("--baud", type=int, default=115200)
+    source = parser.add_mutually_exclusive_group(required=True)
+    source.add_argument("--image", help="serve this file over HTTP on any TCPSETUP")
+    source.add_argument("--proxy", action="store_true", help="connect TCPSETUP to the real host")
+    parser.add_argument("--etag", help="ETag to report (default: sha256 prefix of the image)")
+    parser.add_argument("--recv-size", type=int, default=512, help="max bytes per +TCPRECV")
+    parser.add_argument("--drop-after", type=int, default=0,
+                        help="close the link once after this many bytes")
+    args = parser.parse_args()
+
+    image = None
+    if args.image:
+        with open(args.image, "rb") as f:
+            image = f.read()
+        if args.etag is None:
+            args.etag = hashlib.sha256(image).hexdigest()[:16]
+        print("serving %s, %d bytes, ETag \"%s\"" % (args.image, len(image), args.etag))
+
+    if args.pty:
+        fd, slave = os.openpty()
+        tty.setraw(fd)
+        print("modem on %s" % os.ttyname(slave))
+    else:
+        fd = open_serial(args.serial, args.baud)
+
+    try:
+        Modem(fd, args, image).run()
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
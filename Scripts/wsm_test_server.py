@@ -0,0 +1,320 @@
+#!/usr/bin/env python3
+#
+# Stand-in for the PC update server, for bench-testing the WSM download
+# protocol over TCP (Wi-Fi transport, BOOTLOADER_ENABLE_WIFI=1) or over a
+# serial cable on the EXT_MODEM port (wired transport, --serial; firmware
+# built with BOOTLOADER_ENABLE_WIRED=1).
+# Plays the PC side described in Docs/Bootloader design.txt:
+#
+#   WSM ID <id>        -> WSM ID OK
+#   WSM MAC <mac>      -> WSM ID <well_id>
+#   WSM BL <ver>       -> WSM BL OK, or WSM BL <new_ver> <size> + BL DATA packets
+#   WSM APP <ver>      -> WSM APP OK, or WSM APP <new_ver> <size> + APP DATA packets
+#   WSM APP <ver> SLOT <sector>   (BOOTLOADER_AB_SLOTS=1) the same, sending
+#                      the image linked for that sector (--app-slot6/7)
+#   WSM LINK <info>    sent by the WSM once the link is open; only logged
+#   WSM PARAMS <crc>   -> PARAMS OK if the well already has every --param
+#                      value, else PARAMS LIST, the NAME=VALUE lines that
+#                      differ, PARAMS END. Sent after WSM APP OK and after
+#                      a finished download; the WSM answers DONE, then
+#                      boots or resets. Unanswered, it gives up after 10 s.
+#
+# Unless --no-window, the server opts in to credits with "WSM CREDITS" and
+# the WSM answers "CREDITS <window>": packets are then pipelined up to that
+# many bytes in flight, topped up by the WSM's "CREDIT <n>" lines;
+# otherwise each packet waits for its "DATA OK".
+# With --serial the WSM is asked into wired mode: the magic sequence is
+# sent at 115200 baud until the board (reset it now) answers
+# "WSM WIRED <baud>", then the session runs at that baud rate.
+# Uses only the Python 3 standard library.
+#
+# Usage: wsm_test_server.py [--port 5000 | --serial /dev/ttyUSB0] [--well-id 1]
+#            [--app <image.bin> --app-version <ver>]
+#            [--app-slot6 <image.bin> --app-slot7 <image.bin>]
+#            [--bl <image.bin> --bl-version <ver>]
+#            [--param NAME=VALUE ...] [--packet <bytes>] [--no-window] [--once]
+#
+
+import argparse
+import os
+import select
+import socket
+import sys
+import termios
+import time
+import tty
+import zlib
+
+WIRED_MAGIC = b"WSM WIRED\r\n"
+
+# PARAMS LIST order in Core/Src/param_sync.c; the digest depends on it.
+# Write-only parameters are listed as NAME=* and digested as stored: the
+# server only knows their value once it has set it itself.
+PARAM_NAMES = [
+    "ROD_IDLE_TIME", "BLE_REPORT_TIME", "HTTPS_SERVER_URL", "HTTPS_ENDPOINT",
+    "N58_REPORT_TIME", "MICRO_REPORT_TIME", "FLOW_CALIBRATION",
+    "SUMMARY_DESTINATION", "DETAIL_DESTINATION", "DEBUG_DESTINATION",
+    "SESSION_TIMEOUT", "WIFI_SSID", "WIFI_PASSWORD", "WIFI_SERVER", "WIFI_PORT",
+]
+WRITE_ONLY = {"WIFI_PASSWORD"}
+
+# Parameters last seen on each well, by well ID, across sessions.
+known_params = {}
+
+
+def params_digest(params):
+    text = "".join("%s=%s\n" % (name, params[name]) for name in PARAM_NAMES if name in params)
+    return zlib.crc32(text.encode()) & 0xFFFFFFFF
+
+
+class Session:
+    def __init__(self, conn, args):
+        self.conn = conn
+        self.args = args
+        self.buf = b""
+        self.credits = 0
+        self.acks = 0
+        self.well_id = None
+        self.window = 0
+        self.asked_credits = False
+
+    def send_line(self, line):
+        print(">> " + line)
+        self.conn.sendall(line.encode() + b"\r\n")
+
+    def read_line(self):
+        while b"\n" not in self.buf:
+            data = self.conn.recv(4096)
+            if not data:
+                raise EOFError("WSM closed the connection")
+            self.buf += data
+        line, self.buf = self.buf.split(b"\n", 1)
+        line = line.rstrip(b"\r").decode(errors="replace")
+        print("<< " + line)
+        return line
+
+    def handle_async(self, line, kind):
+        """Account for CREDIT / DATA OK lines; fail on errors."""
+        if line.startswith("CREDIT "):
+            self.credits += int(line.split()[1])
+        elif line == kind + " DATA OK":
+            self.acks += 1
+        elif "ERROR" in line or line.startswith("Bootloader Error!"):
+            raise RuntimeError(line)
+
+    def download(self, kind, image):
+        """Send image after "<kind> DL READY"."""
+        line = self.read_line()
+        while not line.startswith(kind + " DL "):
+            line = self.read_line()
+        if not line.startswith(kind + " DL READY"):
+            raise RuntimeError(line)
+        window = self.window
+
+        self.credits = window
+        self.acks = 0
+        in_flight = 0
+        packets = [image[i:i + self.args.packet] for i in range(0, len(image), self.args.packet)]
+        start = time.monotonic()
+
+        for n, data in enumerate(packets):
+            frame = ("%s DATA %d %d\r\n" % (kind, n, len(data))).encode() + data
+            if window:
+                while in_flight + len(frame) > self.credits:
+                    self.handle_async(self.read_line(), kind)
+                in_flight += len(frame)
+            self.conn.sendall(frame)
+            if not window:
+                while self.acks <= n:
+                    self.handle_async(self.read_line(), kind)
+
+        while self.acks < len(packets):
+            self.handle_async(self.read_line(), kind)
+
+        elapsed = time.monotonic() - start
+        print("-- %s: %d bytes in %d packets, %.2f s, %.0f B/s%s"
+              % (kind, len(image), len(packets), elapsed,
+                 len(image) / elapsed if elapsed > 0 else 0,
+                 " (window %d)" % window if window else ""))
+
+    def offer(self, kind, current, image, version):
+        if image is None or current == version:
+            self.send_line("WSM %s OK" % kind)
+            return
+        self.send_line("WSM %s %s %d" % (kind, version, len(image)))
+        self.download(kind, image)
+
+    def sync_params(self, digest):
+        """Answer "WSM PARAMS <digest>": one line if nothing differs."""
+        wanted = dict(p.split("=", 1) for p in self.args.param)
+        known = known_params.get(self.well_id)
+        if not wanted or (known is not None
+                          and params_digest(dict(known, **wanted)) == digest):
+            self.send_line("PARAMS OK")
+            return
+        if known is None or params_digest(known) != digest:
+            self.send_line("PARAMS LIST")
+            known = {}
+            line = self.read_line()
+            while line != "PARAMS END":
+                name, _, value = line.partition("=")
+                if not (name in WRITE_ONLY and value == "*"):
+                    known[name] = value
+                line = self.read_line()
+        for name, value in wanted.items():
+            if known.get(name) == value:
+                continue
+            self.send_line("%s=%s" % (name, value))
+            reply = self.read_line()
+            if reply == "OK":
+                known[name] = value
+            else:
+                print("!! %s not accepted: %s" % (name, reply))
+        known_params[self.well_id] = known
+        self.send_line("PARAMS END")
+
+    def run(self):
+        bl = read_image(self.args.bl)
+        app = read_image(self.args.app)
+        while True:
+            line = self.read_line()
+            if not self.asked_credits and not self.args.no_window:
+                self.send_line("WSM CREDITS")
+                self.asked_credits = True
+            if line.startswith("CREDITS "):
+                self.window = int(line.split()[1])
+            elif line.startswith("WSM ID "):
+                self.well_id = int(line[7:])
+                self.send_line("WSM ID OK")
+            elif line.startswith("WSM MAC "):
+                self.well_id = self.args.well_id
+                self.send_line("WSM ID %d" % self.args.well_id)
+            elif line.startswith("WSM BL "):
+                self.offer("BL", line[7:].strip(), bl, self.args.bl_version)
+            elif line.startswith("WSM APP "):
+                current, _, slot = line[8:].strip().partition(" SLOT ")
+                image = read_image(getattr(self.args, "app_slot" + slot, None)) if slot else None
+                self.offer("APP", current, image or app, self.args.app_version)
+            elif line.startswith("WSM PARAMS "):
+                self.sync_params(int(line[11:], 16))
+            elif line == "DONE":
+                break
+            elif line.startswith("Bootloader Error!"):
+                raise RuntimeError(line)
+        # The WSM reports its statistics and reboots, or starts the application.
+        try:
+            while True:
+                self.read_line()
+        except (EOFError, OSError):
+            pass
+
+
+class SerialConn:
+    """Just enough of a socket (sendall / recv / close) over a tty."""
+
+    def __init__(self, path):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        tty.setraw(self.fd)
+        self.set_baud(115200)
+
+    def set_baud(self, baud):
+        attrs = termios.tcgetattr(self.fd)
+        attrs[4] = attrs[5] = getattr(termios, "B%d" % baud)
+        termios.tcsetattr(self.fd, termios.TCSADRAIN, attrs)
+
+    def sendall(self, data):
+        while data:
+            data = data[os.write(self.fd, data):]
+
+    def recv(self, n):
+        return os.read(self.fd, n)
+
+    def close(self):
+        os.close(self.fd)
+
+
+def enter_wired(conn):
+    """Send the magic until the WSM answers; returns the baud it switched to."""
+    print("-- sending the wired-mode request, reset the WSM")
+    buf = b""
+    while True:
+        conn.sendall(WIRED_MAGIC)
+        ready, _, _ = select.select([conn.fd], [], [], 0.005)
+        if ready:
+            buf = (buf + conn.recv(256))[-256:]
+            idx = buf.find(b"WSM WIRED ")
+            if idx >= 0 and b"\n" in buf[idx:]:
+                baud = int(buf[idx + 10:].split(b"\r")[0].split(b"\n")[0])
+                print("<< WSM WIRED %d" % baud)
+                return baud
+
+
+def read_image(path):
+    if path is None:
+        return None
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description="WSM update server stand-in (TCP or serial)")
+    parser.add_argument("--port", type=int, default=5000)
+    parser.add_argument("--serial", help="run one wired session on this serial device")
+    parser.add_argument("--well-id", type=int, default=1)
+    parser.add_argument("--app")
+    parser.add_argument("--app-version")
+    parser.add_argument("--app-slot6", help="A/B build: image linked for sector 6 (0x08040000)")
+    parser.add_argument("--app-slot7", help="A/B build: image linked for sector 7 (0x08060000)")
+    parser.add_argument("--bl")
+    parser.add_argument("--bl-version")
+    parser.add_argument("--param", action="append", default=[], metavar="NAME=VALUE",
+                        help="configuration parameter the well should have (repeatable)")
+    parser.add_argument("--packet", type=int, default=1024)
+    parser.add_argument("--no-window", action="store_true",
+                        help="stop-and-wait even if the WSM advertises a window")
+    parser.add_argument("--once", action="store_true", help="exit after one session")
+    args = parser.parse_args()
+
+    has_app = args.app is not None or args.app_slot6 is not None or args.app_slot7 is not None
+    if has_app != (args.app_version is not None) or (args.bl is None) != (args.bl_version is None):
+        parser.error("an image needs its version")
+    for p in args.param:
+        if p.partition("=")[0] not in PARAM_NAMES:
+            parser.error("unknown parameter in --param %s" % p)
+
+    if args.serial:
+        conn = SerialConn(args.serial)
+        try:
+            conn.set_baud(enter_wired(conn))
+            Session(conn, args).run()
+        except (RuntimeError, EOFError) as e:
+            print("!! session failed: %s" % e)
+            return 1
+        finally:
+            conn.close()
+        return 0
+
+    srv = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    srv.bind(("", args.port))
+    srv.listen(1)
+    print("listening on port %d" % args.port)
+
+    status = 0
+    while True:
+        conn, peer = srv.accept()
+        print("-- connection from %s:%d" % peer)
+        conn.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        try:
+            Session(conn, args).run()
+        except (RuntimeError, EOFError) as e:
+            print("!! session failed: %s" % e)
+            status = 1
+        finally:
+            conn.close()
+        if args.once:
+            return status
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,424 @@
+/**
+  ******************************************************************************
+  * @file    download_bench.c
+  * @brief   Host benchmark for the download engine: bootloader_download.c,
+  *          built for Linux against target_stubs.c, downloads an
+  *          application image over the loopback transport from a scripted
+  *          PC that runs in the transport's service hook.
+  *
+  *          Each round is a full session (handshake, BL/APP offer, the
+  *          transfer, the reset), first in stop-and-wait, then with
+  *          credits ("WSM CREDITS"), then as a bootloader download.
+  *          "WSM BL <ver> <size>" and "WSM APP <ver> <size>" are both
+  *          offered, so a prefix match that misses either fails here.
+  *          Every download must be followed by "WSM PARAMS" and "DONE"
+  *          before the reset. The image in the download sector is
+  *          compared with what was sent after every round.
+  *
+  *          Two more sessions take the parameter phase with a digest the
+  *          PC does not know: PARAMS LIST must add up to the digest, every
+  *          NAME=VALUE line gets its OK or ERROR="..." reply, and the next
+  *          session must report a new digest listing the applied values. The throughput
+  *          measures the engine alone: no radio, no flash wait states.
+  *
+  *          Usage: download_bench [image_bytes] [packet_bytes] [rounds]
+  ******************************************************************************
+  */
+
+#include "bootloader_download.h"
+#include "flash_ops.h"
+#include "param_store.h"
+#include "target_stubs.h"
+#include "transport_loopback.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PC_OUT_SIZE     16384
+#define PC_LINE_SIZE    256
+#define PC_TIMEOUT_MS   10000
+#define PC_LISTED_SIZE  2048
+
+typedef struct {
+    const char *line;             /* sent in the parameter phase */
+    const char *reply;            /* the WSM's answer to it */
+} pc_apply_t;
+
+/* What the PC does with "WSM PARAMS <digest>". */
+typedef struct {
+    bool list;                    /* ask for PARAMS LIST first */
+    const pc_apply_t *apply;
+    uint32_t count;
+} pc_params_t;
+
+typedef struct {
+    const char *kind;             /* "APP" or "BL": what the PC offers */
+    const uint8_t *image;
+    uint32_t image_size;
+    uint32_t packet;
+    uint32_t packets;
+    bool credits;
+
+    uint8_t out[PC_OUT_SIZE];     /* queued for the WSM */
+    uint32_t out_len;
+    uint32_t out_pos;
+    char line[PC_LINE_SIZE];
+    uint32_t line_len;
+
+    uint32_t window;              /* from "CREDITS <n>" */
+    uint64_t credit_total;        /* window plus every "CREDIT <n>" */
+    uint32_t credit_lines;
+    uint64_t sent;                /* frame bytes since "APP DL READY" */
+    uint32_t next_packet;
+    uint32_t acks;
+    bool transferring;
+    uint32_t digest;              /* from "WSM PARAMS <digest>" */
+    bool listing;                 /* between "PARAMS LIST" and "PARAMS END" */
+    uint32_t list_crc;
+    char listed[PC_LISTED_SIZE];  /* the listed lines, '\n' after each */
+    uint32_t listed_len;
+    bool applying;                /* waiting for the reply to a line */
+    uint32_t applied;
+    bool done;                    /* "DONE" after the parameter phase */
+    bool failed;
+    char error[PC_LINE_SIZE];
+    uint32_t start_ms;
+} pc_t;
+
+static pc_t pc;
+static const pc_params_t *pc_params;   /* NULL: answer "PARAMS OK" */
+
+static void pc_fail(const char *why)
+{
+    if (!pc.failed) {
+        pc.failed = true;
+        snprintf(pc.error, sizeof(pc.error), "%s", why);
+    }
+}
+
+static void pc_queue(const void *data, uint32_t len)
+{
+    if (pc.out_pos == pc.out_len)
+        pc.out_pos = pc.out_len = 0;
+    if (pc.out_len + len > sizeof(pc.out)) {
+        pc_fail("PC output overflow");
+        return;
+    }
+    memcpy(pc.out + pc.out_len, data, len);
+    pc.out_len += len;
+}
+
+static void pc_send_line(const char *s)
+{
+    pc_queue(s, (uint32_t)strlen(s));
+    pc_queue("\r\n", 2);
+}
+
+/* Send the next NAME=VALUE line of the script, or close the phase. */
+static void pc_next_apply(void)
+{
+    pc.applying = pc.applied < pc_params->count;
+    pc_send_line(pc.applying ? pc_params->apply[pc.applied].line : "PARAMS END");
+}
+
+static void pc_list_line(const char *line)
+{
+    size_t len = strlen(line);
+
+    if (strcmp(line, "PARAMS END") == 0) {
+        pc.listing = false;
+        if (pc.list_crc != pc.digest)
+            pc_fail("PARAMS LIST does not add up to the digest");
+        pc_next_apply();
+        return;
+    }
+    pc.list_crc = ParamStore_Crc32(pc.list_crc, line, (uint32_t)len);
+    pc.list_crc = ParamStore_Crc32(pc.list_crc, "\n", 1);
+    if (pc.listed_len + len + 2 > sizeof(pc.listed)) {
+        pc_fail("PARAMS LIST too long");
+        return;
+    }
+    memcpy(pc.listed + pc.listed_len, line, len);
+    pc.listed_len += (uint32_t)len;
+    pc.listed[pc.listed_len++] = '\n';
+    pc.listed[pc.listed_len] = '\0';
+}
+
+static void pc_apply_reply(const char *line)
+{
+    char why[PC_LINE_SIZE];
+
+    if (strcmp(line, pc_params->apply[pc.applied].reply) != 0) {
+        snprintf(why, sizeof(why), "%.60s: got %.60s, expected %.60s",
+                 pc_params->apply[pc.applied].line, line, pc_params->apply[pc.applied].reply);
+        pc_fail(why);
+        return;
+    }
+    pc.applied++;
+    pc_next_apply();
+}
+
+static void pc_handle_line(const char *line)
+{
+    char buf[64];
+    size_t kind_len = strlen(pc.kind);
+    bool ours = strncmp(line, pc.kind, kind_len) == 0 && line[kind_len] == ' ';
+
+    /* The replies carry ERROR="..." by design: not a session failure. */
+    if (pc.listing) {
+        pc_list_line(line);
+    } else if (pc.applying) {
+        pc_apply_reply(line);
+    } else if (strncmp(line, "CREDITS ", 8) == 0) {
+        pc.window = (uint32_t)strtoul(line + 8, NULL, 10);
+    } else if (strncmp(line, "CREDIT ", 7) == 0) {
+        pc.credit_total += strtoul(line + 7, NULL, 10);
+        pc.credit_lines++;
+    } else if (ours && strcmp(line + kind_len, " DATA OK") == 0) {
+        pc.acks++;
+    } else if (strncmp(line, "WSM ID ", 7) == 0) {
+        pc_send_line("WSM ID OK");
+    } else if (strncmp(line, "WSM MAC ", 8) == 0) {
+        pc_send_line("WSM ID 1");
+    } else if (strncmp(line, "WSM BL ", 7) == 0 || strncmp(line, "WSM APP ", 8) == 0) {
+        if (strncmp(line + 4, pc.kind, kind_len) == 0) {
+            snprintf(buf, sizeof(buf), "WSM %s 2.0.0 %lu", pc.kind, (unsigned long)pc.image_size);
+            pc_send_line(buf);
+        } else {
+            snprintf(buf, sizeof(buf), "WSM %s OK", line[4] == 'B' ? "BL" : "APP");
+            pc_send_line(buf);
+        }
+    } else if (strncmp(line, "WSM PARAMS ", 11) == 0) {
+        if (pc.acks != pc.packets)
+            pc_fail("parameter phase before the download finished");
+        pc.digest = (uint32_t)strtoul(line + 11, NULL, 16);
+        if (pc_params == NULL) {
+            pc_send_line("PARAMS OK");
+        } else if (pc_params->list) {
+            pc.listing = true;
+            pc_send_line("PARAMS LIST");
+        } else {
+            pc_next_apply();
+        }
+    } else if (strcmp(line, "DONE") == 0) {
+        pc.done = true;
+    } else if (ours && strcmp(line + kind_len, " DL READY") == 0) {
+        pc.transferring = true;
+        pc.credit_total = pc.credits ? pc.window : 0;
+        pc.sent = 0;
+    } else if (strstr(line, "ERROR") != NULL || strncmp(line, "Bootloader Error!", 17) == 0) {
+        pc_fail(line);
+    }
+}
+
+/* Queue the next "<kind> DATA n size" frame if the flow control allows it. */
+static void pc_queue_packet(void)
+{
+    char head[48];
+    uint32_t off = pc.next_packet * pc.packet;
+    uint32_t len = pc.image_size - off;
+    int head_len;
+
+    if (!pc.transferring || pc.next_packet >= pc.packets || pc.out_pos != pc.out_len)
+        return;
+    if (len > pc.packet)
+        len = pc.packet;
+    head_len = snprintf(head, sizeof(head), "%s DATA %lu %lu\r\n",
+                        pc.kind, (unsigned long)pc.next_packet, (unsigned long)len);
+    if (pc.credits) {
+        if (pc.sent + (uint32_t)head_len + len > pc.credit_total)
+            return;
+    } else if (pc.acks != pc.next_packet) {
+        return;
+    }
+    pc_queue(head, (uint32_t)head_len);
+    pc_queue(pc.image + off, len);
+    pc.sent += (uint32_t)head_len + len;
+    pc.next_packet++;
+}
+
+/* Take in everything the WSM has sent. */
+static void pc_drain(void)
+{
+    uint8_t buf[512];
+    uint32_t n, i;
+
+    while ((n = TransportLoopback_HostRead(buf, sizeof(buf))) > 0) {
+        for (i = 0; i < n; i++) {
+            if (buf[i] == '\n') {
+                pc.line[pc.line_len] = '\0';
+                pc.line_len = 0;
+                pc_handle_line(pc.line);
+            } else if (buf[i] != '\r' && pc.line_len < sizeof(pc.line) - 1) {
+                pc.line[pc.line_len++] = (char)buf[i];
+            }
+        }
+    }
+}
+
+/* Loopback service hook: the engine found its input empty or its output
+   full. Drain what the WSM sent, answer it, feed it more. */
+static void pc_service(void)
+{
+    pc_drain();
+    pc_queue_packet();
+    if (pc.out_pos < pc.out_len)
+        pc.out_pos += TransportLoopback_HostWrite(pc.out + pc.out_pos, pc.out_len - pc.out_pos);
+
+    if (HAL_GetTick() - pc.start_ms > PC_TIMEOUT_MS)
+        pc_fail("session stalled");
+    if (pc.failed)
+        NVIC_SystemReset();
+}
+
+/* One session; true if the image arrived intact and the WSM reset. */
+static bool run_session(const char *kind, const uint8_t *image, uint32_t size, uint32_t packet,
+                        bool credits)
+{
+    memset(&pc, 0, sizeof(pc));
+    pc.kind = kind;
+    pc.image = image;
+    pc.image_size = size;
+    pc.packet = packet;
+    pc.packets = (size + packet - 1) / packet;
+    pc.credits = credits;
+    pc.start_ms = HAL_GetTick();
+
+    TransportLoopback_Init(pc_service);
+    Bootloader_SetTransport(TransportLoopback_Get());
+    TargetStubs_ExitReason = TARGET_EXIT_NONE;
+    if (setjmp(TargetStubs_Exit) == 0) {
+        Bootloader_ConnectToServer();
+        if (credits)
+            pc_send_line("WSM CREDITS");
+        Bootloader_Download_Process();
+    }
+    pc_drain();   /* the last lines went out right before the reset */
+
+    if (pc.failed) {
+        fprintf(stderr, "FAIL: %s\n", pc.error);
+        return false;
+    }
+    if (TargetStubs_ExitReason != TARGET_EXIT_RESET || pc.acks != pc.packets) {
+        fprintf(stderr, "FAIL: session ended after %lu of %lu packets\n",
+                (unsigned long)pc.acks, (unsigned long)pc.packets);
+        return false;
+    }
+    if (!pc.done) {
+        fprintf(stderr, "FAIL: reset without the parameter phase\n");
+        return false;
+    }
+    if (memcmp((const void *)(uintptr_t)Flash_SectorAddress(FLASH_SECTOR_DOWNLOAD), image, size) != 0) {
+        fprintf(stderr, "FAIL: download sector does not match the image\n");
+        return false;
+    }
+    return true;
+}
+
+static bool bench(const char *name, const char *kind, const uint8_t *image, uint32_t size,
+                  uint32_t packet, uint32_t rounds, bool credits)
+{
+    struct timespec t0, t1;
+    double seconds;
+    uint32_t i;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < rounds; i++)
+        if (!run_session(kind, image, size, packet, credits))
+            return false;
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    seconds = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%-14s %lu x %lu bytes in %lu-byte packets: %.3f s, %.1f MB/s%s\n",
+           name, (unsigned long)rounds, (unsigned long)size, (unsigned long)packet, seconds,
+           (double)size * rounds / seconds / 1e6,
+           credits ? "" : " (one packet in flight)");
+    if (credits)
+        printf("%-14s window %lu bytes, %lu CREDIT lines in the last round\n", "",
+               (unsigned long)pc.window, (unsigned long)pc.credit_lines);
+    return true;
+}
+
+static char long_value[32 + PARAM_VALUE_MAX];
+
+static const pc_apply_t PARAMS_APPLY[] = {
+    { "ROD_IDLE_TIME=30",       "OK" },
+    { "ROD_IDLE_TIME=abc",      "ERROR=\"not a number\"" },
+    { "SUMMARY_DESTINATION=WB", "ERROR=\"invalid value\"" },
+    { "NO_SUCH_PARAM=1",        "ERROR=\"unknown parameter\"" },
+    { long_value,               "ERROR=\"value too long\"" },
+    { "SUMMARY_DESTINATION=BW", "OK" },
+};
+
+/* A session whose digest the PC does not know: list, then apply the
+   script; then one that only lists, which must show a new digest. */
+static bool params_sessions(const uint8_t *image, uint32_t size, uint32_t packet)
+{
+    static const pc_params_t apply = { true, PARAMS_APPLY, sizeof(PARAMS_APPLY) / sizeof(PARAMS_APPLY[0]) };
+    static const pc_params_t list = { true, NULL, 0 };
+    uint32_t before;
+    bool ok;
+
+    snprintf(long_value, sizeof(long_value), "HTTPS_ENDPOINT=%0*d", PARAM_VALUE_MAX + 1, 0);
+    pc_params = &apply;
+    ok = run_session("APP", image, size, packet, true);
+    before = pc.digest;
+    if (ok && pc.applied != apply.count) {
+        fprintf(stderr, "FAIL: %lu of %lu parameter lines answered\n",
+                (unsigned long)pc.applied, (unsigned long)apply.count);
+        ok = false;
+    }
+    pc_params = &list;
+    ok = ok && run_session("APP", image, size, packet, true);
+    pc_params = NULL;
+    if (!ok)
+        return false;
+    if (pc.digest == before) {
+        fprintf(stderr, "FAIL: digest unchanged after PARAMS lines applied\n");
+        return false;
+    }
+    if (strstr(pc.listed, "ROD_IDLE_TIME=30\n") == NULL
+        || strstr(pc.listed, "SUMMARY_DESTINATION=BW\n") == NULL) {
+        fprintf(stderr, "FAIL: applied values not listed\n");
+        return false;
+    }
+    printf("%-14s digest %08lX -> %08lX, %lu lines applied\n", "params",
+           (unsigned long)before, (unsigned long)pc.digest, (unsigned long)apply.count);
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t size = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 120000;
+    uint32_t packet = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 1024;
+    uint32_t rounds = (argc > 3) ? (uint32_t)strtoul(argv[3], NULL, 0) : 200;
+    uint8_t *image;
+    uint32_t i, seed = 0x12345678u;
+
+    if (size == 0 || size > FLASH_SECTOR_SIZE_6_7 || packet == 0 || packet > 2048 || rounds == 0) {
+        fprintf(stderr, "image up to %u bytes, packets of 1 to 2048 bytes\n", FLASH_SECTOR_SIZE_6_7);
+        return 2;
+    }
+    if (!TargetStubs_Init())
+        return 2;
+    image = malloc(size);
+    if (image == NULL)
+        return 2;
+    for (i = 0; i < size; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        image[i] = (uint8_t)seed;
+    }
+
+    if (!bench("stop-and-wait", "APP", image, size, packet, rounds, false)
+        || !bench("credits", "APP", image, size, packet, rounds, true)
+        || !bench("bootloader", "BL", image, size, packet, rounds, true)
+        || !params_sessions(image, size, packet)) {
+        free(image);
+        return 1;
+    }
+    free(image);
+    printf("PASS\n");
+    return 0;
+}
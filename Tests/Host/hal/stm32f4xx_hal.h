@@ -0,0 +1,52 @@
+/**
+  ******************************************************************************
+  * @file    stm32f4xx_hal.h
+  * @brief   Host stand-in for the HAL, just enough for main.h and the
+  *          download engine to build on Linux. The functions are in
+  *          target_stubs.c.
+  ******************************************************************************
+  */
+
+#ifndef HOST_STM32F4XX_HAL_H
+#define HOST_STM32F4XX_HAL_H
+
+#include <stdint.h>
+
+typedef enum {
+    HAL_OK,
+    HAL_ERROR,
+    HAL_BUSY,
+    HAL_TIMEOUT
+} HAL_StatusTypeDef;
+
+typedef enum {
+    GPIO_PIN_RESET,
+    GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct { uint32_t unused; } GPIO_TypeDef;
+typedef struct { uint32_t unused; } UART_HandleTypeDef;
+
+#define GPIO_PIN_0   0x0001u
+#define GPIO_PIN_1   0x0002u
+#define GPIO_PIN_2   0x0004u
+#define GPIO_PIN_3   0x0008u
+#define GPIO_PIN_9   0x0200u
+#define GPIO_PIN_10  0x0400u
+#define GPIO_PIN_11  0x0800u
+#define GPIO_PIN_12  0x1000u
+#define GPIO_PIN_13  0x2000u
+#define GPIO_PIN_14  0x4000u
+
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t ms);
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t len, uint32_t timeout);
+
+/* Leaves the engine: back to the harness through longjmp. */
+void NVIC_SystemReset(void) __attribute__((noreturn));
+
+static inline void __disable_irq(void)
+{
+}
+
+#endif /* HOST_STM32F4XX_HAL_H */
@@ -0,0 +1,2 @@
+/* Host build: the UART types are in stm32f4xx_hal.h. */
+#include "stm32f4xx_hal.h"
@@ -0,0 +1,248 @@
+/**
+  ******************************************************************************
+  * @file    param_store_test.c
+  * @brief   Host test for param_store.c against the flash of
+  *          target_stubs.c: the latest record wins, an unchanged value is
+  *          not written again, compaction moves every key to the other
+  *          sector and back, a torn record is ignored, the old fixed
+  *          WELL_ID block is migrated and kept up to date, and a sector
+  *          holding anything else is never erased.
+  *
+  *          Usage: param_store_test
+  ******************************************************************************
+  */
+
+#include "flash_ops.h"
+#include "param_store.h"
+#include "target_stubs.h"
+#include <stdio.h>
+#include <string.h>
+
+#define SECTOR_A        ((uint8_t *)(uintptr_t)FLASH_SECTOR_PARAMS_A_ADDRESS)
+#define SECTOR_B        ((uint8_t *)(uintptr_t)FLASH_SECTOR_PARAMS_B_ADDRESS)
+#define STORE_B         (SECTOR_B + 8)      /* behind the old fixed block */
+#define STORE_MAGIC     0x4D524150u         /* "PARM" */
+#define LEGACY_MAGIC    0x57454C4Cu         /* "WELL" */
+#define FILL_KEY        PARAM_HTTPS_SERVER_URL
+#define FILL_LEN        100
+
+static int failures;
+
+static void fail(const char *what)
+{
+    fprintf(stderr, "FAIL: %s\n", what);
+    failures++;
+}
+
+static uint32_t word_at(const uint8_t *p)
+{
+    uint32_t w;
+
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+static void wipe(void)
+{
+    (void)Flash_EraseSector(FLASH_SECTOR_PARAMS_A);
+    (void)Flash_EraseSector(FLASH_SECTOR_PARAMS_B);
+    ParamStore_Init();
+}
+
+static uint32_t get_u32(uint16_t key)
+{
+    uint32_t v = 0, len = 0;
+
+    if (!ParamStore_Get(key, &v, sizeof(v), &len) || len != sizeof(v))
+        return 0xFFFFFFFFu;
+    return v;
+}
+
+static bool set_u32(uint16_t key, uint32_t v)
+{
+    return ParamStore_Set(key, &v, sizeof(v));
+}
+
+/* A value that changes with n, so every call appends a record. */
+static bool set_fill(uint32_t n)
+{
+    char v[FILL_LEN];
+
+    memset(v, 'a' + n % 26, sizeof(v));
+    return ParamStore_Set(FILL_KEY, v, sizeof(v));
+}
+
+static bool legacy_is(uint16_t id)
+{
+    return word_at(SECTOR_B) == LEGACY_MAGIC && word_at(SECTOR_B + 4) == (0xFFFF0000u | id);
+}
+
+/* Offset of the first free word in the store at base, walking the records. */
+static uint32_t store_end(const uint8_t *base)
+{
+    uint32_t off = 8;
+
+    while (word_at(base + off) != 0xFFFFFFFFu)
+        off += 8 + ((base[off + 2] + 3u) & ~3u);
+    return off;
+}
+
+static void test_latest_wins(void)
+{
+    static uint8_t before[FLASH_SECTOR_PARAMS_SIZE];
+
+    wipe();
+    if (!set_u32(PARAM_ROD_IDLE_TIME, 10) || !set_u32(PARAM_ROD_IDLE_TIME, 20)
+        || !set_u32(PARAM_BLE_REPORT_TIME, 5))
+        fail("set");
+    if (get_u32(PARAM_ROD_IDLE_TIME) != 20)
+        fail("latest record does not win");
+    memcpy(before, SECTOR_A, sizeof(before));
+    if (!set_u32(PARAM_ROD_IDLE_TIME, 20))
+        fail("unchanged set refused");
+    if (memcmp(before, SECTOR_A, sizeof(before)) != 0)
+        fail("unchanged set wrote flash");
+    ParamStore_Init();
+    if (get_u32(PARAM_ROD_IDLE_TIME) != 20 || get_u32(PARAM_BLE_REPORT_TIME) != 5)
+        fail("values lost across init");
+}
+
+static bool keys_intact(uint32_t n)
+{
+    uint16_t key;
+    char v[FILL_LEN];
+    uint32_t read;
+
+    for (key = PARAM_ROD_IDLE_TIME; key <= PARAM_MICRO_REPORT_TIME; key++) {
+        if (key == FILL_KEY || key == PARAM_HTTPS_ENDPOINT)
+            continue;
+        if (get_u32(key) != key * 3u || ParamStore_Read(key, &read, sizeof(read)) != 4 || read != key * 3u)
+            return false;
+    }
+    return ParamStore_Get(FILL_KEY, v, sizeof(v), NULL) && v[0] == (char)('a' + n % 26)
+        && ParamStore_Read(PARAM_WELL_ID, &read, sizeof(read)) == 2;
+}
+
+static void test_compaction(void)
+{
+    uint16_t key, id = 0x0102;
+    uint32_t n = 0;
+
+    wipe();
+    (void)ParamStore_Set(PARAM_WELL_ID, &id, sizeof(id));
+    for (key = PARAM_ROD_IDLE_TIME; key <= PARAM_MICRO_REPORT_TIME; key++)
+        if (key != FILL_KEY && key != PARAM_HTTPS_ENDPOINT)
+            (void)set_u32(key, key * 3u);
+
+    /* A -> B: sector 3 keeps the old block in front of the store. */
+    while (word_at(STORE_B + 4) != STORE_MAGIC && n < 1000)
+        if (!set_fill(++n))
+            break;
+    if (word_at(STORE_B + 4) != STORE_MAGIC)
+        fail("no compaction into sector 3");
+    if (!legacy_is(id))
+        fail("old WELL_ID block not rewritten with sector 3");
+    if (!keys_intact(n))
+        fail("key lost compacting into sector 3");
+    ParamStore_Init();
+    if (!keys_intact(n))
+        fail("key lost across init after compaction");
+
+    /* B -> A: sector 2 is erased and takes over with a higher seq. */
+    while (word_at(SECTOR_A + 4) != STORE_MAGIC || word_at(SECTOR_A) <= word_at(STORE_B))
+        if (!set_fill(++n) || n > 2000)
+            break;
+    if (word_at(SECTOR_A + 4) != STORE_MAGIC || word_at(SECTOR_A) <= word_at(STORE_B))
+        fail("no compaction back into sector 2");
+    if (!keys_intact(n))
+        fail("key lost compacting into sector 2");
+
+    /* A new WELL_ID with the store in sector 3 moves it out first. */
+    while (word_at(STORE_B + 4) != STORE_MAGIC || word_at(STORE_B) <= word_at(SECTOR_A))
+        if (!set_fill(++n) || n > 3000)
+            break;
+    id = 0x0304;
+    if (!ParamStore_Set(PARAM_WELL_ID, &id, sizeof(id)))
+        fail("set WELL_ID with the store in sector 3");
+    if (!legacy_is(id) || word_at(STORE_B + 4) != 0xFFFFFFFFu)
+        fail("old WELL_ID block not updated");
+    if (!keys_intact(n))
+        fail("key lost moving out of sector 3");
+}
+
+static void test_torn_record(void)
+{
+    uint8_t torn[8] = { PARAM_ROD_IDLE_TIME & 0xFF, PARAM_ROD_IDLE_TIME >> 8, 4, 0xFF, 99, 0, 0, 0 };
+    uint32_t off;
+
+    wipe();
+    (void)set_u32(PARAM_ROD_IDLE_TIME, 7);
+    off = store_end(SECTOR_A);
+    /* Header word and value, no CRC: reset before the last program. */
+    (void)Flash_WriteData(FLASH_SECTOR_PARAMS_A_ADDRESS + off, torn, 4);
+    (void)Flash_WriteData(FLASH_SECTOR_PARAMS_A_ADDRESS + off + 8, torn + 4, 4);
+    ParamStore_Init();
+    if (get_u32(PARAM_ROD_IDLE_TIME) != 7)
+        fail("torn record read back");
+    if (!set_u32(PARAM_ROD_IDLE_TIME, 8) || get_u32(PARAM_ROD_IDLE_TIME) != 8)
+        fail("set after a torn record");
+    ParamStore_Init();
+    if (get_u32(PARAM_ROD_IDLE_TIME) != 8)
+        fail("value lost after a torn record");
+}
+
+static void test_legacy_migration(void)
+{
+    const uint8_t legacy[8] = { 'L', 'L', 'E', 'W', 0x34, 0x12, 0xFF, 0xFF };
+    uint16_t id = 0;
+    uint32_t len = 0;
+
+    (void)Flash_EraseSector(FLASH_SECTOR_PARAMS_A);
+    (void)Flash_EraseSector(FLASH_SECTOR_PARAMS_B);
+    (void)Flash_WriteData(FLASH_SECTOR_PARAMS_B_ADDRESS, legacy, sizeof(legacy));
+    ParamStore_Init();
+    if (!ParamStore_Get(PARAM_WELL_ID, &id, sizeof(id), &len) || len != 2 || id != 0x1234)
+        fail("old WELL_ID block not migrated");
+    if (word_at(SECTOR_A + 4) != STORE_MAGIC || !legacy_is(0x1234))
+        fail("migration did not start the store in sector 2");
+
+    id = 0x4321;
+    if (!ParamStore_Set(PARAM_WELL_ID, &id, sizeof(id)) || !legacy_is(0x4321))
+        fail("old WELL_ID block not updated after migration");
+    ParamStore_Init();
+    if (!ParamStore_Get(PARAM_WELL_ID, &id, sizeof(id), &len) || id != 0x4321)
+        fail("WELL_ID lost across init");
+}
+
+static void test_foreign_sector(void)
+{
+    const uint8_t foreign[8] = "FOREIGN";
+    uint32_t n = 0;
+
+    wipe();
+    (void)set_u32(PARAM_ROD_IDLE_TIME, 11);
+    (void)Flash_WriteData(FLASH_SECTOR_PARAMS_B_ADDRESS + 0x100, foreign, sizeof(foreign));
+    while (n < 1000 && set_fill(++n))
+        ;
+    if (n >= 1000)
+        fail("store never filled");
+    if (memcmp(SECTOR_B + 0x100, foreign, sizeof(foreign)) != 0)
+        fail("foreign sector erased");
+    if (get_u32(PARAM_ROD_IDLE_TIME) != 11)
+        fail("value lost after a refused compaction");
+}
+
+int main(void)
+{
+    if (!TargetStubs_Init())
+        return 1;
+    test_latest_wins();
+    test_compaction();
+    test_torn_record();
+    test_legacy_migration();
+    test_foreign_sector();
+    if (failures != 0)
+        return 1;
+    printf("PASS\n");
+    return 0;
+}
@@ -0,0 +1,252 @@
+/**
+  ******************************************************************************
+  * @file    target_stubs.c
+  * @brief   Host stand-ins for what the download engine needs from the
+  *          target: HAL tick, flash (sectors mapped at their STM32
+  *          addresses), boot logic, timing, statistics and events.
+  *
+  *          Flash writes only clear bits, as on the part, so a missing
+  *          erase shows up as a corrupt image. A reset or a boot of the
+  *          application ends the session by longjmp to TargetStubs_Exit.
+  ******************************************************************************
+  */
+
+#include "target_stubs.h"
+#include "app_metadata.h"
+#include "at_command.h"
+#include "bootloader_logic.h"
+#include "boot_timing.h"
+#include "events.h"
+#include "flash_ops.h"
+#include "session_stats.h"
+#include "transport_ble.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define FLASH_BASE_ADDRESS  0x08000000u
+#define FLASH_TOTAL_SIZE    0x80000u      /* STM32F401RE: 512 KB */
+
+jmp_buf TargetStubs_Exit;
+target_exit_t TargetStubs_ExitReason;
+
+static uint32_t download_sector = FLASH_SECTOR_DOWNLOAD;
+static uint64_t tick_origin_ns;
+
+const unsigned char _app_metadata_start[APP_METADATA_SIZE] = {
+    [APP_METADATA_OFFSET_VERSION] = '1', '.', '0', '.', '0'
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+bool TargetStubs_Init(void)
+{
+    void *flash = mmap((void *)(uintptr_t)FLASH_BASE_ADDRESS, FLASH_TOTAL_SIZE,
+                       PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    if (flash != (void *)(uintptr_t)FLASH_BASE_ADDRESS) {
+        perror("mmap flash");
+        return false;
+    }
+    memset(flash, 0xFF, FLASH_TOTAL_SIZE);
+    tick_origin_ns = now_ns();
+    return true;
+}
+
+/* HAL ----------------------------------------------------------------------*/
+
+uint32_t HAL_GetTick(void)
+{
+    return (uint32_t)((now_ns() - tick_origin_ns) / 1000000u);
+}
+
+void HAL_Delay(uint32_t ms)
+{
+    (void)ms;   /* the harness has nothing to wait for */
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, const uint8_t *data, uint16_t len, uint32_t timeout)
+{
+    (void)huart;
+    (void)data;
+    (void)len;
+    (void)timeout;
+    return HAL_OK;
+}
+
+void NVIC_SystemReset(void)
+{
+    if (TargetStubs_ExitReason == TARGET_EXIT_NONE)
+        TargetStubs_ExitReason = TARGET_EXIT_RESET;
+    longjmp(TargetStubs_Exit, 1);
+}
+
+void Error_Handler(void)
+{
+    NVIC_SystemReset();
+}
+
+/* Flash --------------------------------------------------------------------*/
+
+static uint32_t sector_size(uint32_t sector)
+{
+    if (sector < 4) return 0x4000;
+    if (sector == 4) return 0x10000;
+    return 0x20000;
+}
+
+uint32_t Flash_SectorAddress(uint32_t sector)
+{
+    return (sector == FLASH_SECTOR_CURRENT) ? FLASH_SECTOR_7_ADDRESS : FLASH_SECTOR_6_ADDRESS;
+}
+
+bool Flash_EraseSector(uint32_t sector)
+{
+    uint32_t base = FLASH_BASE_ADDRESS;
+    uint32_t i;
+
+    for (i = 0; i < sector; i++)
+        base += sector_size(i);
+    memset((void *)(uintptr_t)base, 0xFF, sector_size(sector));
+    return true;
+}
+
+bool Flash_WriteData(uint32_t address, const uint8_t *data, uint32_t length)
+{
+    uint8_t *p = (uint8_t *)(uintptr_t)address;
+    uint32_t i;
+
+    if (address < FLASH_BASE_ADDRESS || address + length > FLASH_BASE_ADDRESS + FLASH_TOTAL_SIZE)
+        return false;
+    for (i = 0; i < length; i++)
+        p[i] &= data[i];
+    return true;
+}
+
+bool Flash_ProgramFirmwareData(uint32_t offset, const uint8_t *data, uint32_t length)
+{
+    if (offset + length > FLASH_SECTOR_SIZE_6_7)
+        return false;
+    return Flash_WriteData(Flash_SectorAddress(download_sector) + offset, data, length);
+}
+
+bool Flash_SelectDownloadSector(uint32_t sector)
+{
+    download_sector = sector;
+    return true;
+}
+
+uint32_t Flash_GetDownloadSector(void)
+{
+    return download_sector;
+}
+
+flash_dl_state_t Flash_PrepareDownloadSector(bool allow_erase_ahead)
+{
+    (void)allow_erase_ahead;
+    return FLASH_DL_DIRTY;
+}
+
+bool Flash_EraseDownloadSector(void)
+{
+    return Flash_EraseSector(download_sector);
+}
+
+/* Boot logic ---------------------------------------------------------------*/
+
+void Bootloader_BootCurrent(void)
+{
+    TargetStubs_ExitReason = TARGET_EXIT_BOOT;
+    longjmp(TargetStubs_Exit, 1);
+}
+
+uint32_t Bootloader_ActiveSlot(void)
+{
+    return FLASH_SECTOR_CURRENT;
+}
+
+uint32_t Bootloader_DownloadSlot(void)
+{
+    return FLASH_SECTOR_DOWNLOAD;
+}
+
+bool Bootloader_DownloadSlotInUse(void)
+{
+    return false;
+}
+
+bool Bootloader_CommitDownload(uint32_t sector)
+{
+    (void)sector;
+    return true;
+}
+
+/* Timing, statistics, events -----------------------------------------------*/
+
+void BootTiming_Mark(boot_phase_t phase)
+{
+    (void)phase;
+}
+
+uint32_t BootTiming_Cycles(void)
+{
+    return 0;
+}
+
+void BootTiming_Report(void (*emit)(const char *line))
+{
+    emit("TIMING END");
+}
+
+void SessionStats_Begin(void) {}
+void SessionStats_TransferStart(void) {}
+void SessionStats_AddPacket(uint32_t bytes) { (void)bytes; }
+void SessionStats_AddRetransmit(void) {}
+void SessionStats_SetOverruns(uint32_t overruns) { (void)overruns; }
+void SessionStats_AddFlashProgram(uint32_t cycles) { (void)cycles; }
+void SessionStats_AddFlashErase(uint32_t cycles) { (void)cycles; }
+void SessionStats_SetAtRetries(uint32_t retries) { (void)retries; }
+void SessionStats_Finish(void) {}
+void SessionStats_Defer(uint16_t well_id, session_kind_t kind) { (void)well_id; (void)kind; }
+
+void SessionStats_Format(char *buf, size_t len)
+{
+    snprintf(buf, len, "STATS HOST");
+}
+
+bool SessionStats_Persist(uint16_t well_id, session_kind_t kind, bool success)
+{
+    (void)well_id;
+    (void)kind;
+    (void)success;
+    return true;
+}
+
+void SessionStats_ReportLog(void (*emit)(const char *line))
+{
+    emit("STATS END");
+}
+
+/* The loopback transport runs the PC side from its service hook, so there
+   is never anything to wait for. */
+uint32_t Events_Wait(uint32_t mask)
+{
+    return mask;
+}
+
+uint32_t AT_GetRetryCount(void)
+{
+    return 0;
+}
+
+const transport_t *TransportBle_Get(void)
+{
+    return NULL;
+}
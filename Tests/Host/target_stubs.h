@@ -0,0 +1,28 @@
+/**
+  ******************************************************************************
+  * @file    target_stubs.h
+  * @brief   Host harness side of target_stubs.c.
+  ******************************************************************************
+  */
+
+#ifndef TARGET_STUBS_H
+#define TARGET_STUBS_H
+
+#include <setjmp.h>
+#include <stdbool.h>
+
+typedef enum {
+    TARGET_EXIT_NONE,
+    TARGET_EXIT_RESET,      /* NVIC_SystemReset */
+    TARGET_EXIT_BOOT        /* Bootloader_BootCurrent */
+} target_exit_t;
+
+/* Set with setjmp before entering the engine; a reset or a boot of the
+   application returns there with TargetStubs_ExitReason set. */
+extern jmp_buf TargetStubs_Exit;
+extern target_exit_t TargetStubs_ExitReason;
+
+/* Map the flash at its STM32 address, erased. */
+bool TargetStubs_Init(void);
+
+#endif /* TARGET_STUBS_H */